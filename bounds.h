@@ -0,0 +1,179 @@
+#ifndef __BOUNDS_H
+#define __BOUNDS_H 1
+
+#include <vertex.h>
+#include <cmath>
+#include <stdint.h>
+
+#include <gl.h>
+
+/*
+ *  bounds.h : Bounding volumes and view frustum culling. A bounds is an
+ *             axis aligned box and a sphere around the same vertices;
+ *             groups and objects keep one each (worked out at the end
+ *             of a load), and a frustum made from the current GL
+ *             matrices tells draw() which of them can be skipped
+ */
+
+struct bounds {
+  vec   min, max;    // The box
+  vec   center;      // The sphere
+  float radius;
+  bool  empty;       // Nothing in it (or not worked out yet)
+
+  bounds( void ) {
+    clear();
+  }
+
+  void clear( void ) {
+    min = max = center = vec{ 0.0f, 0.0f, 0.0f };
+    radius = 0.0f;
+    empty  = true;
+  }
+
+  // Grow to take in b as well: the box around both boxes, and the
+  // smallest sphere around both spheres
+  void extend( const bounds &b ) {
+
+    if ( b.empty )
+      return;
+    if ( empty ) {
+      *this = b;
+      return;
+    }
+
+    min = vec{ fminf( min.x, b.min.x ), fminf( min.y, b.min.y ), fminf( min.z, b.min.z ) };
+    max = vec{ fmaxf( max.x, b.max.x ), fmaxf( max.y, b.max.y ), fmaxf( max.z, b.max.z ) };
+
+    vec d = b.center - center;
+    float dist = sqrtf( d.x*d.x + d.y*d.y + d.z*d.z );
+    if ( dist + b.radius <= radius )
+      return;
+    if ( dist + radius <= b.radius ) {
+      center = b.center;
+      radius = b.radius;
+      return;
+    }
+
+    float r = 0.5f * ( dist + radius + b.radius );
+    float k = ( r - radius ) / dist;
+    center = vec{ center.x + k*d.x, center.y + k*d.y, center.z + k*d.z };
+    radius = r;
+  }
+};
+
+// The bounds of count vertices, each stride floats apart with the
+// position first. The min/max and distance loops are left to the
+// compiler to vectorize; the sphere is centred on the box
+inline bounds boundsOf( const float *data, uint64_t count, uint stride ) {
+
+  bounds b;
+  if ( !count )
+    return b;
+
+  float x0 = data[0], y0 = data[1], z0 = data[2];
+  float x1 = x0, y1 = y0, z1 = z0;
+
+  #pragma omp simd reduction(min:x0,y0,z0) reduction(max:x1,y1,z1)
+  for ( uint64_t i=0; i<count; i++ ) {
+    const float *p = data + i*stride;
+    x0 = fminf( x0, p[0] );
+    y0 = fminf( y0, p[1] );
+    z0 = fminf( z0, p[2] );
+    x1 = fmaxf( x1, p[0] );
+    y1 = fmaxf( y1, p[1] );
+    z1 = fmaxf( z1, p[2] );
+  }
+
+  float cx = 0.5f * ( x0 + x1 ), cy = 0.5f * ( y0 + y1 ), cz = 0.5f * ( z0 + z1 );
+  float r2 = 0.0f;
+
+  #pragma omp simd reduction(max:r2)
+  for ( uint64_t i=0; i<count; i++ ) {
+    const float *p = data + i*stride;
+    float dx = p[0] - cx, dy = p[1] - cy, dz = p[2] - cz;
+    r2 = fmaxf( r2, dx*dx + dy*dy + dz*dz );
+  }
+
+  b.min    = vec{ x0, y0, z0 };
+  b.max    = vec{ x1, y1, z1 };
+  b.center = vec{ cx, cy, cz };
+  b.radius = sqrtf( r2 );
+  b.empty  = false;
+  return b;
+}
+
+/*
+ *  struct frustum: the six planes of a view volume, facing in, in the
+ *                  space the vertices are in (so from the projection
+ *                  times the modelview matrix)
+ */
+
+struct frustum {
+  float planes[6][4];    // a x + b y + c z + d, >= 0 inside
+
+  frustum( void ) {
+    for ( uint i=0; i<6; i++ )
+      planes[i][0] = planes[i][1] = planes[i][2] = planes[i][3] = 0.0f;
+  }
+
+  // From a projection * modelview matrix, column major as GL keeps them
+  void set( const float *m ) {
+    for ( uint i=0; i<6; i++ ) {
+      uint row = i/2;
+      float sign = ( i & 1 ) ? -1.0f : 1.0f;    // left/right, bottom/top, near/far
+      for ( uint j=0; j<4; j++ )
+	planes[i][j] = m[4*j+3] + sign * m[4*j+row];
+
+      float len = sqrtf( planes[i][0]*planes[i][0] + planes[i][1]*planes[i][1] + planes[i][2]*planes[i][2] );
+      if ( len > 0.0f )
+	for ( uint j=0; j<4; j++ )
+	  planes[i][j] /= len;
+    }
+    return;
+  }
+
+  // From the matrices current in GL
+  void fromGL( void ) {
+    float p[16], mv[16], m[16];
+    glGetFloatv( GL_PROJECTION_MATRIX, p );
+    glGetFloatv( GL_MODELVIEW_MATRIX, mv );
+    for ( uint c=0; c<4; c++ )
+      for ( uint r=0; r<4; r++ )
+	m[4*c+r] = p[r]*mv[4*c] + p[4+r]*mv[4*c+1] + p[8+r]*mv[4*c+2] + p[12+r]*mv[4*c+3];
+    set( m );
+    return;
+  }
+
+  // Could any of b be in view? The sphere first, and only if it's
+  // across a plane the box (its corner furthest inside that plane).
+  // Bounds that were never worked out are always drawn
+  bool visible( const bounds &b ) const {
+
+    if ( b.empty )
+      return true;
+
+    bool across = false;
+    for ( uint i=0; i<6; i++ ) {
+      const float *p = planes[i];
+      float d = p[0]*b.center.x + p[1]*b.center.y + p[2]*b.center.z + p[3];
+      if ( d < -b.radius )
+	return false;
+      across = across || d < b.radius;
+    }
+    if ( !across )
+      return true;
+
+    for ( uint i=0; i<6; i++ ) {
+      const float *p = planes[i];
+      float x = ( p[0] >= 0.0f ) ? b.max.x : b.min.x;
+      float y = ( p[1] >= 0.0f ) ? b.max.y : b.min.y;
+      float z = ( p[2] >= 0.0f ) ? b.max.z : b.min.z;
+      if ( p[0]*x + p[1]*y + p[2]*z + p[3] < 0.0f )
+	return false;
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __BUFFERS_H
+#define __BUFFERS_H 1
+
+#include <gl.h>
+#include <cstring>
+#include <cstdio>
+
+/*
+ *  buffers.h : What the current GL context can do with buffer objects.
+ *              Vertex and index buffers need GL 1.5, vertex array objects
+ *              GL 3.0 or ARB_vertex_array_object. Anything older gets
+ *              BUFFERS_NONE and is drawn from client arrays as before
+ */
+
+#define BUFFERS_NONE 0    // Client arrays only
+#define BUFFERS_VBO  1    // Vertex and index buffers
+#define BUFFERS_VAO  2    // ... and vertex array objects
+
+// Asked of the context current the first time there is one, then
+// remembered, so it assumes every context the models are drawn in is alike
+inline int bufferSupport( void ) {
+
+  static int support = -1;
+  if ( support >= 0 )
+    return support;
+
+  const char *version = (const char *)glGetString( GL_VERSION );
+  if ( !version )
+    return BUFFERS_NONE;  // No context yet, ask again later
+
+  int major = 0, minor = 0;
+  sscanf( version, "%d.%d", &major, &minor );
+
+  const char *extensions = (const char *)glGetString( GL_EXTENSIONS );
+  bool arbVAO = extensions && strstr( extensions, "GL_ARB_vertex_array_object" );
+
+  if ( major >= 3 || arbVAO )
+    support = BUFFERS_VAO;
+  else if ( major > 1 || ( major == 1 && minor >= 5 ) )
+    support = BUFFERS_VBO;
+  else
+    support = BUFFERS_NONE;
+
+  return support;
+}
+
+#endif
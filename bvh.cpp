@@ -0,0 +1,512 @@
+#include <bvh.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <omp.h>
+
+using namespace std;
+
+/*
+ * bvh.cpp : Building and walking the hierarchy. Each node's triangles
+ *           are binned along each axis by their centroids, and split
+ *           where the surface area heuristic says it's cheapest, unless
+ *           keeping them together is cheaper still. Big nodes have
+ *           their halves built as OpenMP tasks. Rays walk it nearest
+ *           child first, with the hit tested against each triangle's
+ *           corner and two edges (Moller-Trumbore), and points for the
+ *           nearest surface walk it nearest box first
+ */
+
+#define BVH_BINS      16     // Candidate splits per axis
+#define BVH_MAX_LEAF  16     // Split anything bigger whatever it costs
+#define BVH_MAX_DEPTH 64     // ... which is also as deep as the walk's stack goes
+#define BVH_TASK      4096   // Triangles in a node before its halves get tasks of their own
+
+struct bvh_build {
+  vector <float>    lo, hi, centroid;   // 3 a triangle
+  vector <uint32_t> order;              // The triangles, grouped by leaf as it goes
+  atomic <uint32_t> used;               // Nodes handed out so far
+};
+
+struct bin_box {
+  float    min[3], max[3];
+  uint32_t count;
+
+  bin_box( void ) {
+    min[0] = min[1] = min[2] = INFINITY;
+    max[0] = max[1] = max[2] = -INFINITY;
+    count = 0;
+  }
+
+  void extend( const float *l, const float *h ) {
+    for ( uint k=0; k<3; k++ ) {
+      min[k] = fminf( min[k], l[k] );
+      max[k] = fmaxf( max[k], h[k] );
+    }
+  }
+
+  void extend( const bin_box &b ) {
+    extend( b.min, b.max );
+    count += b.count;
+  }
+
+  float area( void ) const {
+    if ( !count )
+      return 0.0f;
+    float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+    return x*y + y*z + z*x;
+  }
+};
+
+// Lay out the node for order[begin,end), then split it (or not)
+template <typename node_type>
+static void subdivide( bvh_build &b, node_type *nodes, uint32_t index, uint32_t begin, uint32_t end, uint depth ) {
+
+  node_type &n = nodes[index];
+  uint32_t count = end - begin;
+
+  bin_box box, centroids;
+  for ( uint32_t i=begin; i<end; i++ ) {
+    uint32_t t = b.order[i];
+    box.extend( &b.lo[3*t], &b.hi[3*t] );
+    centroids.extend( &b.centroid[3*t], &b.centroid[3*t] );
+  }
+  box.count = count;
+  memcpy( n.min, box.min, sizeof(n.min) );
+  memcpy( n.max, box.max, sizeof(n.max) );
+  n.first = begin;
+  n.count = count;
+
+  if ( count <= 2 || depth+1 >= BVH_MAX_DEPTH )
+    return;
+
+  // The cheapest split over every axis and bin boundary
+  int axis = -1;
+  uint split = 0;
+  float best = INFINITY;
+
+  for ( uint k=0; k<3; k++ ) {
+    float extent = centroids.max[k] - centroids.min[k];
+    if ( !( extent > 0.0f ) )
+      continue;
+    float scale = BVH_BINS * 0.9999f / extent;
+
+    bin_box bins[BVH_BINS];
+    for ( uint32_t i=begin; i<end; i++ ) {
+      uint32_t t = b.order[i];
+      uint j = (uint)( ( b.centroid[3*t+k] - centroids.min[k] ) * scale );
+      bins[j].extend( &b.lo[3*t], &b.hi[3*t] );
+      bins[j].count++;
+    }
+
+    // Areas and counts to the left of each boundary, then from the right
+    float leftCost[BVH_BINS];
+    bin_box left, right;
+    for ( uint j=0; j<BVH_BINS-1; j++ ) {
+      left.extend( bins[j] );
+      leftCost[j] = left.area() * left.count;
+    }
+    for ( uint j=BVH_BINS-1; j>0; j-- ) {
+      right.extend( bins[j] );
+      float cost = leftCost[j-1] + right.area() * right.count;
+      if ( left.count && right.count && cost < best ) {
+	best = cost;
+	axis = k;
+	split = j;
+      }
+    }
+  }
+
+  // Is splitting (a step down, then the halves' triangles, each as likely
+  // to be tested as its box is big) any cheaper than testing them all?
+  float area = box.area();
+  bool keep = axis < 0 || ( 1.0f + best / area >= count );
+  if ( keep && count <= BVH_MAX_LEAF )
+    return;
+
+  uint32_t *first = b.order.data() + begin, *last = b.order.data() + end, *middle;
+  if ( axis >= 0 ) {
+    float scale = BVH_BINS * 0.9999f / ( centroids.max[axis] - centroids.min[axis] );
+    float lowest = centroids.min[axis];
+    const float *c = b.centroid.data();
+    middle = partition( first, last, [=]( uint32_t t ) {
+	return (uint)( ( c[3*t+axis] - lowest ) * scale ) < split;
+      } );
+  } else
+    middle = first + count/2;   // All in one place: any halves will do
+
+  uint32_t mid = begin + ( middle - first );
+  uint32_t children = b.used.fetch_add( 2 );
+  n.first = children;
+  n.count = 0;
+
+  if ( count > BVH_TASK ) {
+    #pragma omp task shared( b )
+    subdivide( b, nodes, children, begin, mid, depth+1 );
+    subdivide( b, nodes, children+1, mid, end, depth+1 );
+  } else {
+    subdivide( b, nodes, children, begin, mid, depth+1 );
+    subdivide( b, nodes, children+1, mid, end, depth+1 );
+  }
+  return;
+}
+
+void bvh::build( const vector <object> &objects, int threads ) {
+
+  this->nodes.clear();
+  this->triangles.clear();
+  this->refs.clear();
+
+  // Where every triangle comes from, and the corner it's fanned out from
+  vector <const group *> owner;
+  vector <uint64_t> corner;
+
+  for ( uint i=0; i<objects.size(); i++ ) {
+    for ( uint j=0; j<objects[i].getNumberOfGroups(); j++ ) {
+      const group *g = objects[i].getGroup( j );
+      uint64_t c = 0;
+      for ( uint f=0; f<g->getNumberOfFaces(); c += g->getFaceSize( f ), f++ ) {
+	uint n = g->getFaceSize( f );
+	for ( uint k=0; k+2<n; k++ ) {
+	  triangle_ref r = { i, j, f, k };
+	  this->refs.push_back( r );
+	  owner.push_back( g );
+	  corner.push_back( c );
+	}
+      }
+    }
+  }
+
+  int64_t count = this->refs.size();
+  if ( !count )
+    return;
+  if ( threads <= 0 )
+    threads = omp_get_max_threads();
+
+  // Each triangle's corners, box and centroid
+  vector <float> corners( 9*count );
+  bvh_build b;
+  b.lo.resize( 3*count );
+  b.hi.resize( 3*count );
+  b.centroid.resize( 3*count );
+  b.order.resize( count );
+
+  #pragma omp parallel for schedule(static) num_threads(threads)
+  for ( int64_t t=0; t<count; t++ ) {
+    const group *g = owner[t];
+    uint64_t c = corner[t];
+    uint32_t k = this->refs[t].triangle;
+    float *p = &corners[9*t];
+    memcpy( p,   g->getCornerData( c ),     3*sizeof(float) );
+    memcpy( p+3, g->getCornerData( c+k+1 ), 3*sizeof(float) );
+    memcpy( p+6, g->getCornerData( c+k+2 ), 3*sizeof(float) );
+
+    for ( uint a=0; a<3; a++ ) {
+      b.lo[3*t+a] = fminf( p[a], fminf( p[3+a], p[6+a] ) );
+      b.hi[3*t+a] = fmaxf( p[a], fmaxf( p[3+a], p[6+a] ) );
+      b.centroid[3*t+a] = ( p[a] + p[3+a] + p[6+a] ) * ( 1.0f/3.0f );
+    }
+    b.order[t] = t;
+  }
+
+  // There can't be more than 2n-1 nodes, so they never move while the
+  // tasks fill them in
+  this->nodes.resize( 2*count );
+  b.used = 1;
+  bvh_node *n = this->nodes.data();
+
+  #pragma omp parallel num_threads(threads)
+  #pragma omp single
+  subdivide( b, n, 0, 0, count, 0 );
+
+  this->nodes.resize( b.used );
+  this->nodes.shrink_to_fit();
+
+  // The triangles in leaf order, as a corner and two edges
+  vector <triangle_ref> sorted( count );
+  this->triangles.resize( 9*count );
+
+  #pragma omp parallel for schedule(static) num_threads(threads)
+  for ( int64_t i=0; i<count; i++ ) {
+    uint32_t t = b.order[i];
+    const float *p = &corners[9*t];
+    float *out = &this->triangles[9*i];
+    for ( uint a=0; a<3; a++ ) {
+      out[a]   = p[a];
+      out[3+a] = p[3+a] - p[a];
+      out[6+a] = p[6+a] - p[a];
+    }
+    sorted[i] = this->refs[t];
+  }
+  this->refs.swap( sorted );
+  return;
+}
+
+// Where the ray gets into the node's box, or INFINITY if it misses it (or
+// only gets there after tmax)
+static inline float enter( const float *min, const float *max, const float *o, const float *inv, float tmax ) {
+  float near = 0.0f, far = tmax;
+  for ( uint k=0; k<3; k++ ) {
+    float t0 = ( min[k] - o[k] ) * inv[k];
+    float t1 = ( max[k] - o[k] ) * inv[k];
+    near = fmaxf( near, fminf( t0, t1 ) );
+    far  = fminf( far,  fmaxf( t0, t1 ) );
+  }
+  return ( near <= far ) ? near : INFINITY;
+}
+
+template <bool any>
+bool bvh::traverse( const ray &r, ray_hit &hit ) const {
+
+  if ( this->nodes.empty() )
+    return false;
+
+  const float o[3] = { r.origin.x, r.origin.y, r.origin.z };
+  const float d[3] = { r.direction.x, r.direction.y, r.direction.z };
+  const float inv[3] = { 1.0f/d[0], 1.0f/d[1], 1.0f/d[2] };
+  float tmax = r.tmax;
+  bool found = false;
+
+  struct { uint32_t node; float t; } stack[BVH_MAX_DEPTH];
+  uint sp = 0;
+
+  const bvh_node *n = &this->nodes[0];
+  if ( enter( n->min, n->max, o, inv, tmax ) == INFINITY )
+    return false;
+
+  while ( true ) {
+
+    if ( n->count ) {
+      for ( uint32_t i = n->first; i < n->first + n->count; i++ ) {
+	const float *tri = &this->triangles[9*i];
+	const float *e1 = tri+3, *e2 = tri+6;
+
+	float px = d[1]*e2[2] - d[2]*e2[1];
+	float py = d[2]*e2[0] - d[0]*e2[2];
+	float pz = d[0]*e2[1] - d[1]*e2[0];
+	float det = e1[0]*px + e1[1]*py + e1[2]*pz;
+	if ( det == 0.0f )
+	  continue;
+	float invDet = 1.0f / det;
+
+	float sx = o[0] - tri[0], sy = o[1] - tri[1], sz = o[2] - tri[2];
+	float u = ( sx*px + sy*py + sz*pz ) * invDet;
+	if ( u < 0.0f || u > 1.0f )
+	  continue;
+
+	float qx = sy*e1[2] - sz*e1[1];
+	float qy = sz*e1[0] - sx*e1[2];
+	float qz = sx*e1[1] - sy*e1[0];
+	float v = ( d[0]*qx + d[1]*qy + d[2]*qz ) * invDet;
+	if ( v < 0.0f || u + v > 1.0f )
+	  continue;
+
+	float t = ( e2[0]*qx + e2[1]*qy + e2[2]*qz ) * invDet;
+	if ( t <= 0.0f || t >= tmax )
+	  continue;
+
+	found = true;
+	if ( any )
+	  return true;
+	tmax = t;
+	hit.t = t;
+	hit.u = u;
+	hit.v = v;
+	hit.object   = this->refs[i].object;
+	hit.group    = this->refs[i].group;
+	hit.face     = this->refs[i].face;
+	hit.triangle = this->refs[i].triangle;
+      }
+    } else {
+      // Nearer child next, the other on the stack for later
+      uint32_t a = n->first, b = n->first + 1;
+      float ta = enter( this->nodes[a].min, this->nodes[a].max, o, inv, tmax );
+      float tb = enter( this->nodes[b].min, this->nodes[b].max, o, inv, tmax );
+      if ( tb < ta ) {
+	std::swap( a, b );
+	std::swap( ta, tb );
+      }
+      if ( ta != INFINITY ) {
+	if ( tb != INFINITY ) {
+	  stack[sp].node = b;
+	  stack[sp].t = tb;
+	  sp++;
+	}
+	n = &this->nodes[a];
+	continue;
+      }
+    }
+
+    // Back up to the nearest node left that's still nearer than the hit
+    while ( sp && stack[sp-1].t >= tmax )
+      sp--;
+    if ( !sp )
+      break;
+    n = &this->nodes[ stack[--sp].node ];
+  }
+
+  return found;
+}
+
+bool bvh::raycast( const ray &r, ray_hit &hit ) const {
+  hit = ray_hit();
+  return traverse<false>( r, hit );
+}
+
+bool bvh::anyHit( const ray &r ) const {
+  ray_hit hit;
+  return traverse<true>( r, hit );
+}
+
+void bvh::raycast( const vector <ray> &rays, vector <ray_hit> &hits, int threads ) const {
+
+  int64_t n = rays.size();
+  hits.resize( n );
+  if ( threads <= 0 )
+    threads = omp_get_max_threads();
+
+  #pragma omp parallel for schedule(dynamic,256) num_threads(threads)
+  for ( int64_t i=0; i<n; i++ )
+    raycast( rays[i], hits[i] );
+  return;
+}
+
+// How far (squared) q is from the node's box, 0 inside it
+static inline float boxDistance2( const float *min, const float *max, const float *q ) {
+  float d = 0.0f;
+  for ( uint k=0; k<3; k++ ) {
+    float e = fmaxf( fmaxf( min[k] - q[k], q[k] - max[k] ), 0.0f );
+    d += e*e;
+  }
+  return d;
+}
+
+// The point of a triangle (its corner a and edges ab, ac) nearest p, as
+// a + u ab + v ac, by which of its corners, edges or face p is over
+// (Ericson, Real-Time Collision Detection 5.1.5). Returns the distance squared
+static float closestOnTriangle( const float *tri, const float *p, float &u, float &v ) {
+
+  const float *a = tri, *ab = tri+3, *ac = tri+6;
+  float ap[3] = { p[0]-a[0], p[1]-a[1], p[2]-a[2] };
+  float d1 = ab[0]*ap[0] + ab[1]*ap[1] + ab[2]*ap[2];
+  float d2 = ac[0]*ap[0] + ac[1]*ap[1] + ac[2]*ap[2];
+
+  float bp[3] = { ap[0]-ab[0], ap[1]-ab[1], ap[2]-ab[2] };
+  float d3 = ab[0]*bp[0] + ab[1]*bp[1] + ab[2]*bp[2];
+  float d4 = ac[0]*bp[0] + ac[1]*bp[1] + ac[2]*bp[2];
+
+  float cp[3] = { ap[0]-ac[0], ap[1]-ac[1], ap[2]-ac[2] };
+  float d5 = ab[0]*cp[0] + ab[1]*cp[1] + ab[2]*cp[2];
+  float d6 = ac[0]*cp[0] + ac[1]*cp[1] + ac[2]*cp[2];
+
+  float vc = d1*d4 - d3*d2, vb = d5*d2 - d1*d6, va = d3*d6 - d5*d4;
+
+  if ( d1 <= 0.0f && d2 <= 0.0f ) {                          // corner a
+    u = 0.0f;
+    v = 0.0f;
+  } else if ( d3 >= 0.0f && d4 <= d3 ) {                     // corner b
+    u = 1.0f;
+    v = 0.0f;
+  } else if ( d6 >= 0.0f && d5 <= d6 ) {                     // corner c
+    u = 0.0f;
+    v = 1.0f;
+  } else if ( vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f ) {     // edge ab
+    u = d1 / ( d1 - d3 );
+    v = 0.0f;
+  } else if ( vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f ) {     // edge ac
+    u = 0.0f;
+    v = d2 / ( d2 - d6 );
+  } else if ( va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f ) {   // edge bc
+    v = ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) );
+    u = 1.0f - v;
+  } else {                                                   // the face
+    float denom = 1.0f / ( va + vb + vc );
+    u = vb * denom;
+    v = vc * denom;
+  }
+
+  float x = ap[0] - u*ab[0] - v*ac[0];
+  float y = ap[1] - u*ab[1] - v*ac[1];
+  float z = ap[2] - u*ab[2] - v*ac[2];
+  return x*x + y*y + z*z;
+}
+
+bool bvh::closestPoint( const vec &p, ray_hit &hit, float maxDistance ) const {
+
+  hit = ray_hit();
+  if ( this->nodes.empty() )
+    return false;
+
+  const float q[3] = { p.x, p.y, p.z };
+  float best = maxDistance * maxDistance;
+  bool found = false;
+
+  struct { uint32_t node; float d; } stack[BVH_MAX_DEPTH];
+  uint sp = 0;
+
+  const bvh_node *n = &this->nodes[0];
+  if ( boxDistance2( n->min, n->max, q ) >= best )
+    return false;
+
+  while ( true ) {
+
+    if ( n->count ) {
+      for ( uint32_t i = n->first; i < n->first + n->count; i++ ) {
+	float u, v;
+	float d = closestOnTriangle( &this->triangles[9*i], q, u, v );
+	if ( d >= best )
+	  continue;
+	found = true;
+	best = d;
+	hit.u = u;
+	hit.v = v;
+	hit.object   = this->refs[i].object;
+	hit.group    = this->refs[i].group;
+	hit.face     = this->refs[i].face;
+	hit.triangle = this->refs[i].triangle;
+      }
+    } else {
+      // Nearer child next, the other on the stack for later
+      uint32_t a = n->first, b = n->first + 1;
+      float da = boxDistance2( this->nodes[a].min, this->nodes[a].max, q );
+      float db = boxDistance2( this->nodes[b].min, this->nodes[b].max, q );
+      if ( db < da ) {
+	std::swap( a, b );
+	std::swap( da, db );
+      }
+      if ( da < best ) {
+	if ( db < best ) {
+	  stack[sp].node = b;
+	  stack[sp].d = db;
+	  sp++;
+	}
+	n = &this->nodes[a];
+	continue;
+      }
+    }
+
+    while ( sp && stack[sp-1].d >= best )
+      sp--;
+    if ( !sp )
+      break;
+    n = &this->nodes[ stack[--sp].node ];
+  }
+
+  if ( found )
+    hit.t = sqrtf( best );
+  return found;
+}
+
+void bvh::closestPoint( const vector <vec> &points, vector <ray_hit> &hits, float maxDistance, int threads ) const {
+
+  int64_t n = points.size();
+  hits.resize( n );
+  if ( threads <= 0 )
+    threads = omp_get_max_threads();
+
+  #pragma omp parallel for schedule(dynamic,256) num_threads(threads)
+  for ( int64_t i=0; i<n; i++ )
+    closestPoint( points[i], hits[i], maxDistance );
+  return;
+}
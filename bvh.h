@@ -0,0 +1,127 @@
+#ifndef __BVH_H
+#define __BVH_H 1
+
+#include <object.h>
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+/*
+ *  bvh.h : A bounding volume hierarchy over every triangle of a set of
+ *          objects (quads count as the two triangles fanned out from
+ *          their first corner), for picking, line of sight and snapping
+ *          to the surface. Built top down with a binned surface area
+ *          heuristic, the subtrees shared out across the cores, and
+ *          queried with rays (or points) in the objects' own space. It
+ *          keeps its own copy of the triangles, so it has to be built
+ *          again if the geometry changes
+ */
+
+// An object number for a ray that hit nothing
+#define RAY_MISS 0xFFFFFFFFu
+
+struct ray {
+  vec   origin;
+  vec   direction;    // Needn't be unit length: t is in lengths of it
+  float tmax;         // Only hits nearer than this count
+
+  ray( void ) {
+    origin = direction = vec{ 0.0f, 0.0f, 0.0f };
+    tmax = INFINITY;
+  }
+
+  ray( const vec &o, const vec &d, float t=INFINITY ) {
+    origin = o;
+    direction = d;
+    tmax = t;
+  }
+};
+
+struct ray_hit {
+  float    t;          // Where along the ray: origin + t * direction
+  float    u, v;       // Barycentrics: the point is (1-u-v) a + u b + v c
+  uint32_t object;     // Which object (RAY_MISS for none) ...
+  uint32_t group;      // ... group in it ...
+  uint32_t face;       // ... and face in that
+  uint32_t triangle;   // The triangle of the face: a, b, c are its corners 0, triangle+1, triangle+2
+
+  ray_hit( void ) {
+    t = INFINITY;
+    u = v = 0.0f;
+    object = RAY_MISS;
+    group = face = triangle = 0;
+  }
+};
+
+class bvh {
+
+ public:
+
+  bvh( void ) {
+    return;
+  }
+
+  // Over every triangle of the objects, replacing whatever was there.
+  // threads = 0 for all of them
+  void build( const std::vector <object> &objects, int threads=0 );
+
+  // The nearest triangle the ray hits, if any
+  bool raycast( const ray &r, ray_hit &hit ) const;
+
+  // Does the ray hit anything at all? (Stops at the first triangle found)
+  bool anyHit( const ray &r ) const;
+
+  // A batch of rays, shared out across the cores (threads = 0 for all of
+  // them). Misses come back with object set to RAY_MISS
+  void raycast( const std::vector <ray> &rays, std::vector <ray_hit> &hits, int threads=0 ) const;
+
+  // The nearest point to p on any triangle, if there's one within
+  // maxDistance: t is how far it is, and u, v where on the triangle
+  bool closestPoint( const vec &p, ray_hit &hit, float maxDistance=INFINITY ) const;
+
+  // ... and for a batch of points, shared out across the cores
+  void closestPoint( const std::vector <vec> &points, std::vector <ray_hit> &hits,
+		     float maxDistance=INFINITY, int threads=0 ) const;
+
+  uint64_t getNumberOfTriangles( void ) const {
+    return this->refs.size();
+  }
+
+  uint64_t getNumberOfNodes( void ) const {
+    return this->nodes.size();
+  }
+
+  uint64_t getMemoryBytes( void ) const {
+    return this->nodes.capacity() * sizeof(bvh_node) +
+	   this->triangles.capacity() * sizeof(float) +
+	   this->refs.capacity() * sizeof(triangle_ref);
+  }
+
+  bool empty( void ) const {
+    return this->nodes.empty();
+  }
+
+ protected:
+
+  // 32 bytes: the box, then either the first of two children side by
+  // side (count 0) or the first of count triangles
+  struct bvh_node {
+    float    min[3];
+    uint32_t first;
+    float    max[3];
+    uint32_t count;
+  };
+
+  // Where a triangle came from
+  struct triangle_ref {
+    uint32_t object, group, face, triangle;
+  };
+
+  std::vector <bvh_node>     nodes;       // nodes[0] is the root
+  std::vector <float>        triangles;   // Each one's a and the edges b-a and c-a, in leaf order
+  std::vector <triangle_ref> refs;        // ... and where it came from, in the same order
+
+  template <bool any> bool traverse( const ray &r, ray_hit &hit ) const;
+};
+
+#endif
@@ -0,0 +1,495 @@
+#include <model.h>
+#include <tangents.h>
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace std;
+
+/*
+ * cache.cpp : A binary snapshot of a loaded model. Everything the text
+ *             loader works out (objects, render groups, the flattened
+ *             per-corner arrays, materials and which textures they use)
+ *             is written out as-is, so reading it back is a matter of
+ *             mapping the file and copying the arrays in.
+ *
+ *  Layout (native byte order, checked with the order mark):
+ *    header    : magic "OBJC", version, order mark, flags, levels of
+ *                detail and their ratio, v/vt/vn/face/object counts,
+ *                .mtl file name
+ *    materials : count, then name, Ns, Ka, Kd, Ks, Ni, d, illum and the
+ *                diffuse/ambient/specular/bound texture file names
+ *    objects   : count, then for each: name, group count, and per group
+ *                ID, material name, shading, face count, corner count,
+ *                corners per face, per-corner flags (has a texture
+ *                coordinate), then the vertex, normal and texture
+ *                arrays, and for each level of detail its error and its
+ *                triangles as corner numbers (so they don't depend on
+ *                how the vertices are welded)
+ */
+
+#define CACHE_MAGIC   0x434A424F    // "OBJC"
+#define CACHE_VERSION 2
+#define CACHE_ORDER   0x01020304
+
+// Load options that change the geometry, so a cache built one way isn't used for the other
+#define CACHE_TRIANGULATED 0x1
+#define CACHE_OPTIMIZED    0x2     // faces stored in vertex cache order (see optimize.h)
+#define CACHE_OVERDRAW     0x4
+#define CACHE_NO_NORMALS   0x8     // the vertex layout (see vertex.h) left the normals out,
+#define CACHE_TEXTURES_2D  0x10    // ... kept two texture coordinates rather than three,
+#define CACHE_NO_TEXTURES  0x20    // ... or none at all
+#define CACHE_SMOOTHED     0x40    // smoothed normals (see normals.h), the crease angle in the top 16 bits
+
+// Accumulates the cache in memory, then writes it out in one go
+struct cache_writer {
+  vector <char> buf;
+
+  void put( const void *p, size_t n ) {
+    const char *c = (const char *)p;
+    buf.insert( buf.end(), c, c+n );
+  }
+
+  void u8 ( uint8_t  v ) { put( &v, sizeof(v) ); }
+  void u32( uint32_t v ) { put( &v, sizeof(v) ); }
+  void u64( uint64_t v ) { put( &v, sizeof(v) ); }
+  void f32( float    v ) { put( &v, sizeof(v) ); }
+
+  void str( const string &s ) {
+    u32( s.length() );
+    put( s.data(), s.length() );
+  }
+
+  void floats( const vector<float> &v ) {
+    u64( v.size() );
+    put( v.data(), v.size() * sizeof(float) );
+  }
+
+  void u32s( const vector<uint32_t> &v ) {
+    u64( v.size() );
+    put( v.data(), v.size() * sizeof(uint32_t) );
+  }
+};
+
+// Walks a mapped cache, refusing to read past the end of it
+struct cache_reader {
+  const char *p;
+  const char *end;
+  bool        good;
+
+  cache_reader( const char *data, size_t size ) {
+    p    = data;
+    end  = data + size;
+    good = ( data != 0x0 );
+  }
+
+  const char * get( size_t n ) {
+    if ( !good || (size_t)(end - p) < n ) {
+      good = false;
+      return 0x0;
+    }
+    const char *here = p;
+    p += n;
+    return here;
+  }
+
+  template <class T> T value( void ) {
+    T v = T();
+    const char *c = get( sizeof(T) );
+    if ( c )
+      memcpy( &v, c, sizeof(T) );
+    return v;
+  }
+
+  uint8_t  u8 ( void ) { return value<uint8_t>();  }
+  uint32_t u32( void ) { return value<uint32_t>(); }
+  uint64_t u64( void ) { return value<uint64_t>(); }
+  float    f32( void ) { return value<float>();    }
+
+  string str( void ) {
+    uint32_t n = u32();
+    const char *c = get( n );
+    return c ? string( c, n ) : string();
+  }
+
+  // Hands back a pointer into the mapped file, no copying
+  const float * floats( uint64_t &n ) {
+    n = u64();
+    if ( n > (uint64_t)(end - p) / sizeof(float) ) {
+      good = false;
+      return 0x0;
+    }
+    return (const float *)get( n * sizeof(float) );
+  }
+
+  const uint32_t * u32s( uint64_t &n ) {
+    n = u64();
+    if ( n > (uint64_t)(end - p) / sizeof(uint32_t) ) {
+      good = false;
+      return 0x0;
+    }
+    return (const uint32_t *)get( n * sizeof(uint32_t) );
+  }
+};
+
+static bool modifiedTime( const string &file, struct timespec &t ) {
+  struct stat st;
+  if ( stat( file.c_str(), &st ) )
+    return false;
+#ifdef __DARWIN__
+  t = st.st_mtimespec;
+#else
+  t = st.st_mtim;
+#endif
+  return true;
+}
+
+static bool newerThan( const struct timespec &a, const struct timespec &b ) {
+  return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec >= b.tv_nsec);
+}
+
+string model::getCacheFile( void ) {
+  if ( this->options.cacheFile != "" )
+    return this->options.cacheFile;
+  return this->objFile + ".cache";
+}
+
+uint32_t model::cacheFlags( void ) {
+  uint32_t flags = 0;
+  if ( this->options.triangulate )
+    flags |= CACHE_TRIANGULATED;
+  if ( this->options.indexed && this->options.optimize )
+    flags |= CACHE_OPTIMIZED;
+  if ( this->options.indexed && this->options.optimize && this->options.overdraw )
+    flags |= CACHE_OVERDRAW;
+  if ( !this->options.layout.normals )
+    flags |= CACHE_NO_NORMALS;
+  if ( this->options.layout.textures == 2 )
+    flags |= CACHE_TEXTURES_2D;
+  if ( !this->options.layout.textures )
+    flags |= CACHE_NO_TEXTURES;
+  if ( this->options.smooth )
+    flags |= CACHE_SMOOTHED | ( (uint32_t)( this->options.creaseAngle * 100.0f ) & 0xFFFF ) << 16;
+  return flags;
+}
+
+bool model::saveCache( string file ) {
+
+  if ( file == "" )
+    file = this->getCacheFile();
+
+  cache_writer w;
+
+  w.u32( CACHE_MAGIC );
+  w.u32( CACHE_VERSION );
+  w.u32( CACHE_ORDER );
+  w.u32( this->cacheFlags() );
+  w.u32( this->options.lods );
+  w.f32( this->options.lods ? this->options.lodRatio : 0.0f );
+  w.u64( this->NumberOfVertices );
+  w.u64( this->NumberOfTextures );
+  w.u64( this->NumberOfNormals );
+  w.u32( this->NumberOfFaces );
+  w.u32( this->NumberOfObjects );
+  w.str( this->materials.size() ? this->mtlFile : "" );
+
+  w.u32( this->materials.size() );
+  for ( uint i=0; i<this->materials.size(); i++ ) {
+    material &m = this->materials[i];
+
+    w.str( m.getName() );
+    w.f32( m.getNs() );
+    for ( uint j=0; j<3; j++ ) w.f32( m.getKa()[j] );
+    for ( uint j=0; j<3; j++ ) w.f32( m.getKd()[j] );
+    for ( uint j=0; j<3; j++ ) w.f32( m.getKs()[j] );
+    w.f32( m.getNi() );
+    w.f32( m.getD() );
+    w.u32( (uint32_t)m.getIllum() );
+    w.str( m.getDiffuseTexture() );
+    w.str( m.getAmbientTexture() );
+    w.str( m.getSpecularTexture() );
+    w.str( m.getTextureFile() );
+  }
+
+  w.u32( this->objects.size() );
+  for ( uint i=0; i<this->objects.size(); i++ ) {
+    object &o = this->objects[i];
+
+    w.str( o.getName() );
+    w.u32( o.getNumberOfGroups() );
+
+    for ( uint j=0; j<o.getNumberOfGroups(); j++ ) {
+      group *g = o.getGroup( j );
+      uint nfaces = g->getNumberOfFaces();
+      uint64_t corners = g->getNumberOfCorners();
+
+      w.str( g->getID() );
+      w.str( g->getMaterial().getName() );
+      w.u32( g->getShading() );
+      w.u32( nfaces );
+      w.u64( corners );
+
+      for ( uint k=0; k<nfaces; k++ )
+	w.u8( g->getFaceSize( k ) );
+
+      for ( uint64_t c=0; c<corners; c++ )
+	w.u8( g->isCornerTextured( c ) ? 1 : 0 );
+
+      // Always the separate per-corner arrays, so it reads back whatever
+      // the layout or indexing
+      vector <float> v, n, t;
+      g->getCornerArrays( v, n, t );
+      w.floats( v );
+      w.floats( n );
+      w.floats( t );
+
+      // A corner for each vertex, to put the levels' triangles in terms of
+      vector <uint32_t> corner( g->getNumberOfVertices(), 0 );
+      for ( uint64_t c=corners; c-- > 0; )
+	corner[ g->isIndexed() ? g->getIndex( c ) : c ] = c;
+
+      w.u32( g->getNumberOfLevels()-1 );
+      for ( uint k=1; k<g->getNumberOfLevels(); k++ ) {
+	vector <uint32_t> tris = g->getLevelIndices( k );
+	for ( uint64_t i=0; i<tris.size(); i++ )
+	  tris[i] = corner[ tris[i] ];
+	w.f32( g->getLevelError( k ) );
+	w.u32s( tris );
+      }
+    }
+  }
+
+  // Write to the side and move it into place, so nobody ever maps half a cache
+  string tmp = file + ".tmp";
+  FILE *fp = fopen( tmp.c_str(), "wb" );
+  if ( !fp ) {
+    perror( tmp.c_str() );
+    return false;
+  }
+
+  bool ok = fwrite( w.buf.data(), 1, w.buf.size(), fp ) == w.buf.size();
+  ok = ( fclose( fp ) == 0 ) && ok;
+
+  if ( !ok || rename( tmp.c_str(), file.c_str() ) ) {
+    perror( file.c_str() );
+    remove( tmp.c_str() );
+    return false;
+  }
+
+  if ( this->debug )
+    cout << "Cached " << this->objFile << " in " << file << "\n";
+
+  return true;
+}
+
+bool model::loadCache( string file, bool validate ) {
+
+  if ( file == "" )
+    file = this->getCacheFile();
+
+  struct timespec cacheTime, srcTime;
+  if ( !modifiedTime( file, cacheTime ) )
+    return false;
+
+  // Not worth reading if the .obj has changed since
+  if ( validate && (!modifiedTime( this->objFile, srcTime ) || !newerThan( cacheTime, srcTime )) )
+    return false;
+
+  reader in( file );
+  if ( !in.isOpen() )
+    return false;
+
+  cache_reader r( in.getData(), in.getSize() );
+
+  if ( r.u32() != CACHE_MAGIC || r.u32() != CACHE_VERSION || r.u32() != CACHE_ORDER ) {
+    cout << file << " isn't a model cache this version of the library can read\n";
+    return false;
+  }
+
+  if ( r.u32() != this->cacheFlags() )
+    return false;
+
+  // Levels made some other way would be no good either
+  uint32_t lods = r.u32();
+  float ratio = r.f32();
+  if ( lods != this->options.lods || ( lods && ratio != this->options.lodRatio ) )
+    return false;
+
+  uint64_t vertices = r.u64(), textures = r.u64(), normals = r.u64();
+  uint32_t faces = r.u32(), objects = r.u32();
+  string   mtl   = r.str();
+
+  // ... or if the materials have
+  if ( validate && mtl != "" && (!modifiedTime( mtl, srcTime ) || !newerThan( cacheTime, srcTime )) )
+    return false;
+
+  vector <material> mats( r.u32() );
+  for ( uint i=0; i<mats.size() && r.good; i++ ) {
+    material &m = mats[i];
+    float k[3];
+
+    m.setID( i );
+    m.setName( r.str() );
+    m.setNs( r.f32() );
+    for ( uint j=0; j<3; j++ ) k[j] = r.f32();
+    m.setKa( k );
+    for ( uint j=0; j<3; j++ ) k[j] = r.f32();
+    m.setKd( k );
+    for ( uint j=0; j<3; j++ ) k[j] = r.f32();
+    m.setKs( k );
+    m.setNi( r.f32() );
+    m.setD( r.f32() );
+    m.setIllum( (int)r.u32() );
+
+    string diffuse = r.str(), ambient = r.str(), specular = r.str(), bound = r.str();
+    if ( diffuse  != "" ) m.setDiffuseTexture ( diffuse,  false );
+    if ( ambient  != "" ) m.setAmbientTexture ( ambient,  false );
+    if ( specular != "" ) m.setSpecularTexture( specular, false );
+
+    // The texture the material ended up bound to goes last, so it's the one bound again
+    if ( bound != "" ) {
+      if ( bound == diffuse )
+	m.setDiffuseTexture( bound, false );
+      else if ( bound == ambient )
+	m.setAmbientTexture( bound, false );
+      else
+	m.setSpecularTexture( bound, false );
+    }
+  }
+
+  // First of any repeated name wins, as in model::addMaterial()
+  unordered_map <string, uint> index;
+  for ( uint i=0; i<mats.size(); i++ )
+    index.insert( make_pair( mats[i].getName(), i ) );
+
+  vector <object> objs( r.u32() );
+  for ( uint i=0; i<objs.size() && r.good; i++ ) {
+    object &o = objs[i];
+    o.setName( r.str() );
+
+    uint32_t ngroups = r.u32();
+    for ( uint j=0; j<ngroups && r.good; j++ ) {
+
+      string   id      = r.str();
+      string   matName = r.str();
+      uint32_t shading = r.u32();
+      uint32_t nfaces  = r.u32();
+      uint64_t ncorner = r.u64();
+
+      const uint8_t *types = (const uint8_t *)r.get( nfaces );
+      const uint8_t *flags = (const uint8_t *)r.get( ncorner );
+
+      uint64_t nv, nn, nt;
+      const float *v = r.floats( nv );
+      const float *n = r.floats( nn );
+      const float *t = r.floats( nt );
+
+      if ( !r.good || nv != 3*ncorner || nn != 3*ncorner || nt > 3*ncorner ) {
+	r.good = false;
+	break;
+      }
+
+      material m;
+      unordered_map<string, uint>::iterator found = index.find( matName );
+      if ( found != index.end() )
+	m = mats[found->second];
+
+      group g( m, shading );
+      g.setID( id );
+      g.setIndexed( this->options.indexed );
+      g.setLayout( this->options.layout );
+      g.setTangentAttribute( this->options.tangentAttribute );
+
+      // Rebuild the faces straight from the flattened arrays
+      uint64_t c = 0, tc = 0;
+      for ( uint k=0; k<nfaces && r.good; k++ ) {
+	face f( types[k] );
+
+	if ( c + types[k] > ncorner ) {
+	  r.good = false;
+	  break;
+	}
+
+	for ( uint l=0; l<types[k]; l++, c++ ) {
+	  vec p  = { v[3*c], v[3*c+1], v[3*c+2] };
+	  vec nm = { n[3*c], n[3*c+1], n[3*c+2] };
+
+	  vertex vtx( p );
+	  vtx.setNormal( nm );
+	  if ( flags[c] ) {
+	    if ( 3*tc+3 > nt ) {
+	      r.good = false;
+	      break;
+	    }
+	    vec tx = { t[3*tc], t[3*tc+1], t[3*tc+2] };
+	    vtx.setTextureCoordinates( tx );
+	    tc++;
+	  }
+	  f.addVertex( vtx );
+	}
+	g.addFace( f );
+      }
+
+      // Tangents aren't kept, they're worked out again from what is
+      if ( this->options.tangents )
+	generateTangents( g );
+
+      // The levels are, once the vertices are settled
+      uint32_t levels = r.u32();
+      for ( uint k=0; k<levels && r.good; k++ ) {
+	float error = r.f32();
+	uint64_t count;
+	const uint32_t *corners = r.u32s( count );
+	if ( !r.good || count % 3 ) {
+	  r.good = false;
+	  break;
+	}
+
+	vector <uint32_t> tris( count );
+	for ( uint64_t i=0; i<count; i++ ) {
+	  if ( corners[i] >= ncorner ) {
+	    r.good = false;
+	    break;
+	  }
+	  tris[i] = g.isIndexed() ? g.getIndex( corners[i] ) : corners[i];
+	}
+	if ( r.good )
+	  g.addLevel( tris, error );
+      }
+      g.packIndices();
+
+      o.addGroup( std::move(g) );
+    }
+    o.computeBounds();
+  }
+
+  if ( !r.good ) {
+    cout << file << " is damaged, ignoring it\n";
+    return false;
+  }
+
+  this->NumberOfVertices = vertices;
+  this->NumberOfTextures = textures;
+  this->NumberOfNormals  = normals;
+  this->NumberOfFaces    = faces;
+  this->NumberOfObjects  = objects;
+  this->NumberOfGroups   = 0;
+  for ( uint i=0; i<objs.size(); i++ )
+    this->NumberOfGroups += objs[i].getNumberOfGroups();
+
+  if ( mtl != "" )
+    this->mtlFile = mtl;
+  this->materials.swap( mats );
+  this->materialIndex.swap( index );
+  this->objects.swap( objs );
+  this->materialsLoaded = true;
+
+  this->requestTextures();
+
+  if ( this->debug )
+    cout << "Loaded " << this->objFile << " from " << file << "\n";
+
+  return true;
+}
@@ -16,7 +16,9 @@
  *  face.h : Class file for building openGL "faces". A face is 
  *           either a triangle or a quadrilaterial (this class
  *           tries to be agnostic about which it is). Mainly 
- *           holds a set of 3 or 4 vertices
+ *           holds a set of 3 or 4 vertices, in place rather than on
+ *           the heap. Faces only carry corners into a group and back
+ *           out (see group::getFace), the group keeps the arrays
  */
 
 class face {
@@ -26,8 +28,9 @@ class face {
     if ( type != LINE && type != TRIANGLE && type != QUAD )
       type = TRIANGLE;
 
-    this->type = type;
-    this->vertices.reserve(type);
+    this->type  = type;
+    this->count = 0;
+    this->flat  = false;
 
     return;
   }
@@ -36,60 +39,59 @@ class face {
     if ( t != LINE && t != TRIANGLE && t != QUAD )
       t = TRIANGLE;
 
-    this->type = t;
-    this->vertices.reserve(type);
+    this->type  = t;
+    this->count = 0;
+    this->flat  = false;
 
     return;
   }
 
   ~face(void) {
-    this->vertices.clear();
     return;
   }
 
-  // Overload the assignment operator
-  inline face operator = (const face &f) {
-    copy( f.vertices.begin(), f.vertices.end(), back_inserter( (*this).vertices ) );
-    (*this).type     = f.type;
-    return (*this);
-  }
-
-  void addVertex( vertex  v ) {
-    vertices.push_back(v);
+  // Past the face's type, extra vertices are dropped
+  void addVertex( const vertex &v ) {
+    if ( this->count == this->type )
+      return;
+    this->vertices[this->count++] = v;
 
-    if ( vertices.size() == type && !v.hasNormals() ) {
+    if ( this->count == type && !v.hasNormals() ) {
       vec n = this->calculateNormal();
     
-      for ( uint i=0; i<this->vertices.size(); i++ )
+      for ( uint i=0; i<this->count; i++ )
 	this->vertices[i].setNormal( n );
+      this->flat = true;
     }
     return;
   }
 
-  void addVertex( vertex *v ) {
-    this->vertices.push_back((*v));
-
-    if ( vertices.size() == type && !v->hasNormals() ) {
-      vec n = this->calculateNormal();
-
-      for ( uint i=0; i<this->vertices.size(); i++ )
-	this->vertices[i].setNormal( n );
-
-    }
-  
+  void addVertex( const vertex *v ) {
+    this->addVertex( *v );
     return;
   }
 
-  int getType(void) {
+  int getType(void) const {
     return this->type;
   }
 
-  int getNumVertices(void) {
-    return this->vertices.size();
+  int getNumVertices(void) const {
+    return this->count;
+  }
+
+  // True if the normals are the face's own, worked out for want of any
+  // in the file (see normals.h for smoothing them)
+  bool hasFlatNormal(void) const {
+    return this->flat;
+  }
+
+  const vertex & getVertex( uint i ) const {
+    return this->vertices[i];
   }
 
-  std::vector<vertex> getVertices(void) {
-    return this->vertices;
+  // A copy: getVertex() is the way to look without one
+  std::vector<vertex> getVertices(void) const {
+    return std::vector<vertex>( this->vertices, this->vertices + this->count );
   }
 
   void draw(void) {
@@ -100,7 +102,7 @@ class face {
       glBegin(GL_QUADS);
     }
 
-    for ( uint i=0; i<vertices.size(); i++ ) {
+    for ( uint i=0; i<this->count; i++ ) {
       vec v = vertices[i].getVtx();
       glVertex3f( v.x, v.y, v.z );
 
@@ -123,8 +125,10 @@ class face {
   friend std::ostream & operator << (std::ostream&, face&);
 
  protected:
-  std::vector<vertex> vertices;
+  vertex vertices[QUAD];
   unsigned int type;
+  unsigned int count;    // vertices added so far
+  bool flat;             // normals made up by calculateNormal()
 
   vec calculateNormal(void) {
 
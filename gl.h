@@ -1,3 +1,7 @@
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES 1 /*-- buffer objects, see buffers.h --*/
+#endif
+
 #include <GL/gl.h>   /*--         OpenGL       --*/
 #include <GL/glu.h>  /*-- GLU support library  --*/
 #include <GL/glut.h> /*-- GLUT support library --*/
@@ -2,14 +2,35 @@
 #define __GROUP_H 1
 
 #include <face.h>
+#include <optimize.h>
+#include <buffers.h>
+#include <bounds.h>
+#include <lod.h>
 #include <vector>
+#include <cstring>
+#include <stdint.h>
 
 #include <gl.h>
 
+// Material ID of the catch-all group faces land in before any usemtl or s line
+#define DEFAULT_GROUP -2
+
+// An empty slot in a group's weld table
+#define NO_VERTEX 0xFFFFFFFFu
+
 /*
  *  group.h: class definition for a render group. A render group is a 
  *           collection of faces (defined in face.h) which share a 
- *           common material and shading model
+ *           common material and shading model. The vertices handed to
+ *           GL are interleaved in one array, packed as the group's
+ *           vertex_layout (see vertex.h) says, and that array is the
+ *           only copy: the faces are just where each one's corners
+ *           start, and getFace() puts a face back together on demand. Indexed groups (see
+ *           setIndexed) keep each distinct vertex once and draw through
+ *           an index buffer with glDrawElements. Once upload() has put
+ *           the arrays in GL buffer objects they're drawn from there.
+ *           Coarser levels of detail (see lod.h) are more triangle lists
+ *           over the same vertices
  */
 
 class group {
@@ -22,6 +43,12 @@ class group {
     consistant    = false;
     size          = 0;
     first         = true;
+    materialID    = DEFAULT_GROUP;
+    indexed       = false;
+    layout        = vertex_layout( format.normals, 0 );
+    vbo = ibo = vao = 0;
+    bufferLevels  = 0;
+    tangentAttribute = -1;
 
     this->ID = "default_0";
     return;
@@ -32,18 +59,22 @@ class group {
     consistant    = false;
     size          = 0;
     first         = true;
+    indexed       = false;
+    layout        = vertex_layout( format.normals, 0 );
+    vbo = ibo = vao = 0;
+    bufferLevels  = 0;
+    tangentAttribute = -1;
     this->mat = m;
     this->shading = s;
+    this->materialID = m.getID();
     this->ID = this->mat.getName() + "_" + std::to_string(s);
 
     return;
   }
 
   ~group(){
-    faces.clear();
-    vertices.clear();
-    normals.clear();
-    textures.clear();
+    faceStart.clear();
+    data.clear();
     return;
   }
 
@@ -54,44 +85,253 @@ class group {
 
   // Overload of the assignment operator
   inline group & operator = (const group &g) {
-    (*this).faces         = g.faces;
+    (*this).faceStart     = g.faceStart;
+    (*this).cornerTextured = g.cornerTextured;
+    (*this).faceFlat      = g.faceFlat;
     (*this).mat           = g.mat;
     (*this).shading       = g.shading;
     (*this).consistant    = g.consistant;
     (*this).ID            = g.ID;
+    (*this).materialID    = g.materialID;
     (*this).size          = g.size;
     (*this).first         = g.first;
 
-    (*this).vertices      = g.vertices;
-    (*this).normals       = g.normals;
-    (*this).textures      = g.textures;
+    (*this).data          = g.data;
+    (*this).format        = g.format;
+    (*this).layout        = g.layout;
+
+    (*this).indexed       = g.indexed;
+    (*this).indices       = g.indices;
+    (*this).shortIndices  = g.shortIndices;
+    (*this).weld          = g.weld;
+
+    // Copies share the GL buffers (like textures); release() them once
+    (*this).vbo           = g.vbo;
+    (*this).ibo           = g.ibo;
+    (*this).vao           = g.vao;
+    (*this).bufferLevels  = g.bufferLevels;
+    (*this).tangentAttribute = g.tangentAttribute;
+    (*this).box           = g.box;
+
+    (*this).lods            = g.lods;
+    (*this).lodIndices      = g.lodIndices;
+    (*this).lodShortIndices = g.lodShortIndices;
 
     return (*this);
   }
 
-  void addFace( face f ) {
-    this->faces.push_back(f);
+  group( group &&g ) {
+    (*this) = std::move( g );
+    return;
+  }
+
+  // Moving takes the arrays over rather than copying them
+  inline group & operator = (group &&g) {
+    (*this).faceStart     = std::move( g.faceStart );
+    (*this).cornerTextured = std::move( g.cornerTextured );
+    (*this).faceFlat      = std::move( g.faceFlat );
+    (*this).mat           = g.mat;
+    (*this).shading       = g.shading;
+    (*this).consistant    = g.consistant;
+    (*this).ID            = std::move( g.ID );
+    (*this).materialID    = g.materialID;
+    (*this).size          = g.size;
+    (*this).first         = g.first;
+
+    (*this).data          = std::move( g.data );
+    (*this).format        = g.format;
+    (*this).layout        = g.layout;
+
+    (*this).indexed       = g.indexed;
+    (*this).indices       = std::move( g.indices );
+    (*this).shortIndices  = std::move( g.shortIndices );
+    (*this).weld          = std::move( g.weld );
+
+    (*this).vbo           = g.vbo;
+    (*this).ibo           = g.ibo;
+    (*this).vao           = g.vao;
+    (*this).bufferLevels  = g.bufferLevels;
+    (*this).tangentAttribute = g.tangentAttribute;
+    (*this).box           = g.box;
+
+    (*this).lods            = std::move( g.lods );
+    (*this).lodIndices      = std::move( g.lodIndices );
+    (*this).lodShortIndices = std::move( g.lodShortIndices );
+
+    return (*this);
+  }
+
+  void addFace( const face &f ) {
+    this->faceStart.push_back( getNumberOfCorners() );
+    this->faceFlat.push_back( f.hasFlatNormal() );
     this->addVertexToVector(f);
     return;
   }
 
-  void addFace( face *f ) {
-    this->faces.push_back((*f));
-    this->addVertexToVector(*f);
+  void addFace( const face *f ) {
+    this->addFace( *f );
     return;
   }
 
   void flush( void ) {
-    faces.clear();
-    vertices.clear();
-    normals.clear();
-    textures.clear();
+    faceStart.clear();
+    cornerTextured.clear();
+    faceFlat.clear();
+    data.clear();
+    indices.clear();
+    shortIndices.clear();
+    weld.clear();
+    box.clear();
+    clearLevels();
+    layout = vertex_layout( format.normals, 0 );
+    release();
     mat.flush();
     shading = 0;
   }
 
-  uint getNumberOfFaces( void ) {
-    return this->faces.size();
+  uint getNumberOfFaces( void ) const {
+    return this->faceStart.size();
+  }
+
+  // Corners of every face put together (as many as the index array has
+  // in an indexed group, otherwise as many as there are vertices)
+  uint64_t getNumberOfCorners( void ) const {
+    if ( this->indexed )
+      return this->indices.size() + this->shortIndices.size();
+    return getNumberOfVertices();
+  }
+
+  // What the faces come to in triangles (a quad is two, a line none)
+  uint64_t getNumberOfTriangles( void ) const {
+    uint64_t n = 0;
+    for ( uint i=0; i<this->faceStart.size(); i++ ) {
+      uint s = getFaceSize( i );
+      n += ( s > 2 ) ? s-2 : 0;
+    }
+    return n;
+  }
+
+  uint getFaceSize( uint i ) const {
+    uint64_t end = ( i+1 < this->faceStart.size() ) ? this->faceStart[i+1] : getNumberOfCorners();
+    return end - this->faceStart[i];
+  }
+
+  // The n'th corner, as a vertex with whatever the layout kept
+  vertex getCorner( uint64_t c ) const {
+    const float *p = &this->data[ this->layout.stride() * cornerVertex( c ) ];
+    vec v = { p[0], p[1], p[2] };
+    vertex vtx( v );
+
+    if ( this->layout.normals ) {
+      vec n = { p[3], p[4], p[5] };
+      vtx.setNormal( n );
+    }
+
+    if ( isCornerTextured( c ) ) {
+      const float *t = p + this->layout.textureOffset();
+      vec tx = { t[0], t[1], ( this->layout.textures > 2 ) ? t[2] : 0.0f };
+      vtx.setTextureCoordinates( tx );
+    }
+    return vtx;
+  }
+
+  bool isCornerTextured( uint64_t c ) const {
+    return this->layout.textures && c < this->cornerTextured.size() && this->cornerTextured[c];
+  }
+
+  // Did the i'th face come without normals (so it has the flat one face.h works out)?
+  bool isFaceFlat( uint i ) const {
+    return this->faceFlat[i];
+  }
+
+  // The packed floats (see getLayout) of the vertex the c'th corner uses
+  const float * getCornerData( uint64_t c ) const {
+    return &this->data[ this->layout.stride() * cornerVertex( c ) ];
+  }
+
+  // Give the c'th corner a new normal. In an indexed group every corner
+  // sharing its vertex gets it too, so reweld() once they're all done
+  void setCornerNormal( uint64_t c, const vec &n ) {
+    if ( !this->layout.normals )
+      return;
+    float *p = &this->data[ this->layout.stride() * cornerVertex( c ) + this->layout.normalOffset() ];
+    p[0] = n.x;
+    p[1] = n.y;
+    p[2] = n.z;
+    return;
+  }
+
+  // Give every corner a tangent (4 floats a corner: see tangents.h),
+  // making room for them in the layout first. Corners of an indexed group
+  // that shared a vertex but get different tangents are split apart
+  void setCornerTangents( const std::vector<float> &t ) {
+
+    if ( t.size() != 4*getNumberOfCorners() )
+      return;
+
+    vertex_layout to = this->layout;
+    to.tangents = 4;
+    repack( to );
+
+    if ( this->indexed ) {
+      reweld( t.data() );
+      return;
+    }
+
+    uint stride = this->layout.stride(), offset = this->layout.tangentOffset();
+    for ( uint64_t c=0; c<getNumberOfCorners(); c++ )
+      memcpy( &this->data[ stride*c + offset ], &t[4*c], 4*sizeof(float) );
+    return;
+  }
+
+  // Weld an indexed group's corners again from scratch, after their
+  // vertices have changed (vertices that have become the same are merged).
+  // If tangents are given (4 floats a corner) they go in as it's done.
+  // The vertices are numbered afresh, so any levels of detail go
+  void reweld( const float *tangents=0x0 ) {
+
+    if ( !this->indexed )
+      return;
+    clearLevels();
+
+    bool narrow = this->shortIndices.size() > 0;
+    std::vector<uint32_t> corners;
+    if ( narrow ) {
+      corners.assign( this->shortIndices.begin(), this->shortIndices.end() );
+      std::vector<uint16_t>().swap( this->shortIndices );
+    } else
+      corners.swap( this->indices );
+
+    std::vector<float> old;
+    old.swap( this->data );
+    std::vector<uint32_t>().swap( this->weld );
+
+    uint stride = this->layout.stride(), offset = this->layout.tangentOffset();
+    std::vector<float> key( stride );
+    this->indices.reserve( corners.size() );
+    for ( uint64_t c=0; c<corners.size(); c++ ) {
+      const float *p = &old[ stride*corners[c] ];
+      if ( tangents && this->layout.tangents ) {
+	memcpy( key.data(), p, stride*sizeof(float) );
+	memcpy( &key[offset], tangents + 4*c, 4*sizeof(float) );
+	p = key.data();
+      }
+      this->indices.push_back( weldVertex( p ) );
+    }
+
+    std::vector<uint32_t>().swap( this->weld );
+    if ( narrow )
+      packIndices();
+    return;
+  }
+
+  // The i'th face, built from the arrays (nothing keeps it afterwards)
+  face getFace( uint i ) const {
+    uint n = getFaceSize( i );
+    face f( n );
+    for ( uint64_t c = this->faceStart[i]; c < this->faceStart[i] + n; c++ )
+      f.addVertex( getCorner( c ) );
+    return f;
   }
 
   void setMaterial( material m ) {
@@ -99,7 +339,7 @@ class group {
     return;
   }
 
-  material getMaterial( void ) {
+  const material & getMaterial( void ) const {
     return this->mat;
   }
 
@@ -107,29 +347,320 @@ class group {
     this->mat.setD( alpha );
   }
 
+  void setTextureID( uint id ) {
+    this->mat.setTextureID( id );
+  }
+
   void setShading( unsigned int s=0 ) {
     this->shading = s;
     return;
   }
 
-  unsigned int getShading( void ) {
+  unsigned int getShading( void ) const {
     return this->shading;
   }
 
-  std::string getID(void) {
+  // The material's ID in the model (-1 for no material, DEFAULT_GROUP for the catch-all group)
+  int getMaterialID( void ) const {
+    return this->materialID;
+  }
+
+  const std::string & getID(void) const {
     return this->ID;
   }
 
-  std::vector <face> getFaceVector(void) {
-    return this->faces;
+  void setID( std::string id ) {
+    this->ID = id;
+  }
+
+  // Weld identical corners (same position, normal and texture coordinates)
+  // into one vertex and draw with an index buffer. Set it before adding faces
+  void setIndexed( bool on ) {
+    this->indexed = on;
+    return;
+  }
+
+  bool isIndexed( void ) const {
+    return this->indexed;
+  }
+
+  // How the vertices should be packed. Texture coordinates only take up
+  // room once some corner has them (then every vertex gets them, zero
+  // where the face had none), and tangents once setCornerTangents() has
+  // some. Changing it repacks what's there already
+  void setLayout( vertex_layout format ) {
+    this->format = format;
+    repack( vertex_layout( format.normals, this->layout.textures ? format.textures : 0, this->layout.tangents ) );
+    return;
+  }
+
+  // The generic vertex attribute the tangents are handed to GL as (they
+  // have no fixed function array), for a shader to pick up; -1 for none
+  void setTangentAttribute( int index ) {
+    this->tangentAttribute = index;
+    return;
+  }
+
+  int getTangentAttribute( void ) const {
+    return this->tangentAttribute;
+  }
+
+  // Work out the box and sphere around the vertices (done at the end of
+  // a load; adding faces clears them until it's done again)
+  void computeBounds( void ) {
+    this->box = boundsOf( this->data.data(), getNumberOfVertices(), this->layout.stride() );
+    return;
+  }
+
+  const bounds & getBounds( void ) const {
+    return this->box;
+  }
+
+  // The layout the data is actually packed in
+  vertex_layout getLayout( void ) const {
+    return this->layout;
+  }
+
+  // The interleaved array handed to GL: one vertex per corner, or in an
+  // indexed group one per distinct vertex
+  const std::vector<float> & getInterleavedArray( void ) const {
+    return this->data;
+  }
+
+  uint64_t getNumberOfVertices( void ) const {
+    return this->data.size() / this->layout.stride();
+  }
+
+  // Copies of the separate attributes, for anyone who wants them that way
+  std::vector<float> getVertexArray  (void) const { return attribute( 0, 3 ); }
+  std::vector<float> getNormalArray  (void) const { return attribute( this->layout.normalOffset(), this->layout.normals ); }
+  std::vector<float> getTextureArray (void) const { return attribute( this->layout.textureOffset(), this->layout.textures ); }
+  std::vector<float> getTangentArray (void) const { return attribute( this->layout.tangentOffset(), this->layout.tangents ); }
+
+  // An indexed group's corners, as 32 bit indices until packIndices()
+  // (after which they're 16 bit if there are few enough vertices)
+  const std::vector<uint32_t> & getIndexArray      (void) const { return this->indices;      }
+  const std::vector<uint16_t> & getShortIndexArray (void) const { return this->shortIndices; }
+
+  uint64_t getNumberOfIndices( void ) const {
+    return this->indices.size() + this->shortIndices.size();
+  }
+
+  uint32_t getIndex( uint64_t i ) const {
+    return this->shortIndices.size() ? this->shortIndices[i] : this->indices[i];
+  }
+
+  // Done adding faces: drop the weld table, and narrow the indices (and
+  // any levels' indices) to 16 bits if every vertex can be reached that way
+  void packIndices( void ) {
+    std::vector<uint32_t>().swap( this->weld );
+    if ( getNumberOfVertices() > 65536 )
+      return;
+    if ( this->indices.size() ) {
+      this->shortIndices.assign( this->indices.begin(), this->indices.end() );
+      std::vector<uint32_t>().swap( this->indices );
+    }
+    if ( this->lodIndices.size() ) {
+      this->lodShortIndices.assign( this->lodIndices.begin(), this->lodIndices.end() );
+      std::vector<uint32_t>().swap( this->lodIndices );
+    }
+    return;
+  }
+
+  // Levels of detail (see lod.h and simplify.h). Level 0 is the group as
+  // it is, and each one after it a coarser list of triangles over the
+  // same vertices, with how far its surface may be from the full one
+  uint getNumberOfLevels( void ) const {
+    return 1 + this->lods.size();
+  }
+
+  float getLevelError( uint level ) const {
+    return ( level && level <= this->lods.size() ) ? this->lods[level-1].error : 0.0f;
+  }
+
+  uint64_t getLevelTriangles( uint level ) const {
+    return ( level && level <= this->lods.size() ) ? this->lods[level-1].count / 3 : getNumberOfTriangles();
+  }
+
+  // A level's triangles as vertex numbers, three apiece (level 0 only for
+  // a group of triangles)
+  std::vector<uint32_t> getLevelIndices( uint level ) const {
+    std::vector<uint32_t> tris;
+    if ( !level ) {
+      if ( this->indexed )
+	for ( uint64_t i=0; i<getNumberOfIndices(); i++ )
+	  tris.push_back( getIndex( i ) );
+      else if ( getNumberOfTriangles() * 3 == getNumberOfVertices() )
+	for ( uint64_t i=0; i<getNumberOfVertices(); i++ )
+	  tris.push_back( i );
+      return tris;
+    }
+    if ( level > this->lods.size() )
+      return tris;
+    const lod_level &l = this->lods[level-1];
+    for ( uint64_t i = l.first; i < l.first + l.count; i++ )
+      tris.push_back( this->lodShortIndices.size() ? this->lodShortIndices[i] : this->lodIndices[i] );
+    return tris;
+  }
+
+  // Put the next (coarser) level after the rest. As wide as the levels
+  // before it, or the group's own indices if they've been narrowed
+  void addLevel( const std::vector<uint32_t> &tris, float error ) {
+    lod_level l = { this->lodIndices.size() + this->lodShortIndices.size(), tris.size(), error };
+    if ( this->lodShortIndices.size() || this->shortIndices.size() )
+      this->lodShortIndices.insert( this->lodShortIndices.end(), tris.begin(), tris.end() );
+    else
+      this->lodIndices.insert( this->lodIndices.end(), tris.begin(), tris.end() );
+    this->lods.push_back( l );
+    return;
+  }
+
+  // Anything that renumbers the vertices or adds faces drops the levels,
+  // to be made again
+  void clearLevels( void ) {
+    this->bufferLevels = 0;
+    std::vector<lod_level>().swap( this->lods );
+    std::vector<uint32_t>().swap( this->lodIndices );
+    std::vector<uint16_t>().swap( this->lodShortIndices );
+    return;
+  }
+
+  // The coarsest level whose error comes to no more than pixels, with
+  // pixelsPerUnit pixels to a unit of length (see lod_view)
+  uint pickLevel( float pixelsPerUnit, float pixels ) const {
+    for ( uint k=this->lods.size(); k>0; k-- )
+      if ( this->lods[k-1].error * pixelsPerUnit <= pixels )
+	return k;
+    return 0;
+  }
+
+  // Reorder an indexed triangle group for the post-transform vertex cache
+  // (and, if asked, for less overdraw), then renumber the vertices in the
+  // order they're used. The faces are the triangles, so they (and a cache
+  // written from them) come out in the same order
+  void optimize( bool overdraw=false ) {
+
+    if ( !this->indexed || this->faceStart.empty() )
+      return;
+    for ( uint i=0; i<this->faceStart.size(); i++ )
+      if ( getFaceSize( i ) != TRIANGLE )
+	return;
+    clearLevels();
+
+    bool narrow = this->shortIndices.size() > 0;
+    if ( narrow ) {
+      this->indices.assign( this->shortIndices.begin(), this->shortIndices.end() );
+      std::vector<uint16_t>().swap( this->shortIndices );
+    }
+
+    uint32_t count = getNumberOfVertices();
+    std::vector<uint32_t> order;
+    optimizeVertexCache( this->indices.data(), this->indices.size(), count, order );
+    if ( overdraw )
+      optimizeOverdraw( this->indices.data(), this->data.data(), this->layout.stride(), order );
+
+    std::vector<uint32_t> tris( this->indices.size() );
+    std::vector<bool> textured( this->cornerTextured.size() ), flat( this->faceFlat.size() );
+    for ( uint t=0; t<order.size(); t++ ) {
+      for ( uint k=0; k<3; k++ )
+	tris[3*t+k] = this->indices[3*order[t]+k];
+      if ( textured.size() )
+	for ( uint k=0; k<3; k++ )
+	  textured[3*t+k] = this->cornerTextured[3*order[t]+k];
+      flat[t] = this->faceFlat[order[t]];
+    }
+    this->indices.swap( tris );
+    this->cornerTextured.swap( textured );
+    this->faceFlat.swap( flat );
+
+    // Then the vertices, in the order the triangles now use them
+    std::vector<uint32_t> remap;
+    optimizeVertexFetch( this->indices.data(), this->indices.size(), count, remap );
+    for ( uint i=0; i<this->indices.size(); i++ )
+      this->indices[i] = remap[ this->indices[i] ];
+    remapArray( this->data, remap, this->layout.stride() );
+
+    // Any weld table is out of date now (it's rebuilt if more faces come)
+    std::vector<uint32_t>().swap( this->weld );
+    if ( narrow )
+      packIndices();
+    return;
+  }
+
+  // How well the index buffer uses a post-transform vertex cache (see optimize.h)
+  cache_stats getCacheStats( void ) const {
+    cache_stats none = { 0.0f, 0.0f };
+    if ( !this->indexed || this->faceStart.empty() || getFaceSize( 0 ) != TRIANGLE )
+      return none;
+    if ( this->indices.size() )
+      return analyzeVertexCache( this->indices.data(), this->indices.size(), getNumberOfVertices() );
+    std::vector<uint32_t> wide( this->shortIndices.begin(), this->shortIndices.end() );
+    return analyzeVertexCache( wide.data(), wide.size(), getNumberOfVertices() );
+  }
+
+  // Bytes held in the arrays handed to GL
+  uint64_t getGeometryBytes( void ) const {
+    return this->data.size() * sizeof(float)
+      + this->indices.size() * sizeof(uint32_t) + this->shortIndices.size() * sizeof(uint16_t)
+      + this->lodIndices.size() * sizeof(uint32_t) + this->lodShortIndices.size() * sizeof(uint16_t);
+  }
+
+  // Everything the group's geometry takes up, faces and all
+  uint64_t getMemoryBytes( void ) const {
+    return this->data.capacity() * sizeof(float)
+      + this->indices.capacity() * sizeof(uint32_t) + this->shortIndices.capacity() * sizeof(uint16_t)
+      + this->faceStart.capacity() * sizeof(uint32_t) + this->cornerTextured.capacity() / 8
+      + this->faceFlat.capacity() / 8
+      + this->lods.capacity() * sizeof(lod_level)
+      + this->lodIndices.capacity() * sizeof(uint32_t) + this->lodShortIndices.capacity() * sizeof(uint16_t)
+      + this->weld.capacity() * sizeof(uint32_t) + sizeof(group);
+  }
+
+  // The per-corner arrays, as a non-indexed group would have them (every
+  // corner has a normal, zero if the layout left them out, and texture
+  // coordinates go in only for the corners that had them)
+  void getCornerArrays( std::vector<float> &v, std::vector<float> &n, std::vector<float> &t ) const {
+    uint64_t corners = getNumberOfCorners();
+    v.clear();
+    n.clear();
+    t.clear();
+    v.reserve( 3*corners );
+    n.reserve( 3*corners );
+
+    for ( uint64_t c=0; c<corners; c++ ) {
+      const float *p = &this->data[ this->layout.stride() * cornerVertex( c ) ];
+      v.insert( v.end(), p, p+3 );
+      if ( this->layout.normals )
+	n.insert( n.end(), p+3, p+6 );
+      else
+	n.insert( n.end(), 3, 0.0f );
+
+      if ( isCornerTextured( c ) ) {
+	const float *tx = p + this->layout.textureOffset();
+	t.push_back( tx[0] );
+	t.push_back( tx[1] );
+	t.push_back( ( this->layout.textures > 2 ) ? tx[2] : 0.0f );
+      }
+    }
+    return;
+  }
+
+  // Every face at once. Better to go through them with getFace() on a big
+  // group, as this puts them all in memory again
+  std::vector <face> getFaceVector(void) const {
+    std::vector <face> faces;
+    faces.reserve( this->faceStart.size() );
+    for ( uint i=0; i<this->faceStart.size(); i++ )
+      faces.push_back( getFace( i ) );
+    return faces;
   }
 
   bool checkConsistancy(void) {
 
     this->consistant = false;
 
-    for ( uint i=1; i<this->faces.size(); i++ ) {
-      if ( this->faces[i].getType() != this->faces[i-1].getType() ) {
+    for ( uint i=1; i<this->faceStart.size(); i++ ) {
+      if ( getFaceSize( i ) != getFaceSize( i-1 ) ) {
 	std::cout << "Group " << this->ID << " is inconsistant\n";
 	return false;
       }
@@ -139,34 +670,40 @@ class group {
     return true;
   }
 
-  void addVertexToVector( face f ) {
-    std::vector<vertex> vtx = f.getVertices();
+  void addVertexToVector( const face &f ) {
 
-    for ( uint j=0; j<vtx.size(); j++ ) {
+    this->box.clear();
+    if ( this->lods.size() )
+      clearLevels();
 
-      vec v = vtx[j].getVtx();
-      vec n = vtx[j].getNorm();
-      vec t;
-      bool hasTex = vtx[j].hasTextureCoordinates();
+    // Packed already? Go back to 32 bit indices to carry on
+    if ( this->indexed && this->shortIndices.size() ) {
+      this->indices.assign( this->shortIndices.begin(), this->shortIndices.end() );
+      std::vector<uint16_t>().swap( this->shortIndices );
+    }
 
-      if ( hasTex )
-	t = vtx[j].getTex();
+    for ( int j=0; j<f.getNumVertices(); j++ ) {
+      const vertex &vtx = f.getVertex( j );
 
-      this->vertices.push_back(v.x);
-      this->normals.push_back(n.x);
-      if ( hasTex )
-	this->textures.push_back(t.x);
+      // The first texture coordinates to turn up make room for them all
+      bool hasTex = vtx.hasTextureCoordinates();
+      if ( hasTex && !this->layout.textures && this->format.textures )
+	repack( vertex_layout( this->format.normals, this->format.textures, this->layout.tangents ) );
 
-      this->vertices.push_back(v.y);
-      this->normals.push_back(n.y);
-      if ( hasTex )
-	this->textures.push_back(t.y);
+      // Only start keeping track of which corners have them then, too
+      if ( this->layout.textures && ( hasTex || this->cornerTextured.size() ) ) {
+	this->cornerTextured.resize( getNumberOfCorners(), false );
+	this->cornerTextured.push_back( hasTex );
+      }
 
-      this->vertices.push_back(v.z);
-      this->normals.push_back(n.z);
-      if ( hasTex )
-	this->textures.push_back(t.z);
+      float packed[13];
+      vec v = vtx.getVtx(), n = vtx.getNorm(), t = vtx.getTex();
+      pack( v, n, hasTex ? &t : 0x0, packed );
 
+      if ( this->indexed )
+	this->indices.push_back( weldVertex( packed ) );
+      else
+	this->data.insert( this->data.end(), packed, packed + this->layout.stride() );
     }
 
     return;
@@ -174,59 +711,166 @@ class group {
 
   void drawPoints(void) {
 
+    uint stride = this->layout.stride();
+
     glBegin(GL_POINTS);
-    for ( uint i=0; i<size; i+=3 ) {
-      glVertex3f( vertices[i], vertices[i+1], vertices[i+2] );
+    for ( uint64_t i=0; i<this->data.size(); i+=stride ) {
+      glVertex3fv( &this->data[i] );
     }
     glEnd();
 
     return;
   }
 
-  void drawArrays(void) {
-    float *v = this->vertices.data();
-    float *n = this->normals.data();
-    float *t = 0x0;
-
-    if ( this->textures.size() > 0 )
-      t = this->textures.data();
+  // Point GL at the interleaved array: base is where it starts, or 0x0
+  // for the start of the bound vertex buffer
+  void enableArrays( const float *base ) {
+    GLsizei bytes = this->layout.stride() * sizeof(float);
 
-    int size = this->vertices.size()/3;
-    
     glEnableClientState(GL_VERTEX_ARRAY);			// Enable vertex arrays
-    glEnableClientState(GL_NORMAL_ARRAY);			// Enable normal arrays
-
-    if ( this->textures.size() > 0 )
-      glEnableClientState(GL_TEXTURE_COORD_ARRAY);		// Enable texture arrays
+    glVertexPointer(3, GL_FLOAT, bytes, base);		        // Vertex Pointer to vertex array
 
-    glVertexPointer(3, GL_FLOAT, 0, v);		               	// Vertex Pointer to vertex array
-    glNormalPointer(GL_FLOAT, 0, n);			        // Normal pointer to normal array
-    if ( this->textures.size() > 0 ) {
-      glTexCoordPointer(3, GL_FLOAT, 0, t);		        // Texture pointer to normal array
+    if ( this->layout.normals ) {
+      glEnableClientState(GL_NORMAL_ARRAY);			// Enable normal arrays
+      glNormalPointer(GL_FLOAT, bytes, base + this->layout.normalOffset());
     }
 
-    if ( this->faces[0].getType() == TRIANGLE )
-      glDrawArrays(GL_TRIANGLES, 0, size);                      // Draw the triangles
+    if ( this->layout.textures ) {
+      glEnableClientState(GL_TEXTURE_COORD_ARRAY);		// Enable texture arrays
+      glTexCoordPointer(this->layout.textures, GL_FLOAT, bytes, base + this->layout.textureOffset());
+    }
 
-    else if ( this->faces[0].getType() == QUAD )
-      glDrawArrays(GL_QUADS, 0, size);		                // or the quads
+    if ( this->layout.tangents && this->tangentAttribute >= 0 ) {
+      glEnableVertexAttribArray(this->tangentAttribute);		// Tangents, for the shader
+      glVertexAttribPointer(this->tangentAttribute, 4, GL_FLOAT, GL_FALSE, bytes, base + this->layout.tangentOffset());
+    }
+    return;
+  }
 
+  void disableArrays(void) {
     glDisableClientState(GL_VERTEX_ARRAY);			// Disable vertex arrays
-    glDisableClientState(GL_NORMAL_ARRAY);			// Disable normal arrays
-    if ( this->textures.size() > 0 )
+    if ( this->layout.normals )
+      glDisableClientState(GL_NORMAL_ARRAY);			// Disable normal arrays
+    if ( this->layout.textures )
       glDisableClientState(GL_TEXTURE_COORD_ARRAY);		// Disable texture arrays
+    if ( this->layout.tangents && this->tangentAttribute >= 0 )
+      glDisableVertexAttribArray(this->tangentAttribute);
+    return;
+  }
+
+  void drawArrays(void) {
+
+    int size = getNumberOfVertices();
+
+    enableArrays( this->data.data() );
+
+    glDrawArrays(primitive( getFaceSize(0) ), 0, size);	// Draw the triangles, quads or lines
+
+    disableArrays();
+
+    return;
+  }
+
+  void drawElements(void) {
+
+    enableArrays( this->data.data() );
+
+    GLenum mode = primitive( getFaceSize(0) );
+    if ( this->shortIndices.size() )
+      glDrawElements(mode, this->shortIndices.size(), GL_UNSIGNED_SHORT, this->shortIndices.data());
+    else
+      glDrawElements(mode, this->indices.size(), GL_UNSIGNED_INT, this->indices.data());
+
+    disableArrays();
 
     return;
   }
 
+  // One of the levels of detail, from the client arrays
+  void drawLevel( uint level ) {
+
+    const lod_level &l = this->lods[level-1];
+
+    enableArrays( this->data.data() );
+
+    if ( this->lodShortIndices.size() )
+      glDrawElements(GL_TRIANGLES, l.count, GL_UNSIGNED_SHORT, &this->lodShortIndices[l.first]);
+    else
+      glDrawElements(GL_TRIANGLES, l.count, GL_UNSIGNED_INT, &this->lodIndices[l.first]);
+
+    disableArrays();
+
+    return;
+  }
+
+  // From the buffers upload() made: the group, or one of its levels of
+  // detail (their indices follow the group's own in the index buffer)
+  void drawBuffers( uint level=0 ) {
+
+    if ( this->vao )
+      glBindVertexArray( this->vao );
+    else {
+      glBindBuffer( GL_ARRAY_BUFFER, this->vbo );
+      enableArrays( 0x0 );
+      if ( this->ibo )
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, this->ibo );
+    }
+
+    GLenum mode = primitive( getFaceSize(0) );
+    bool narrow = this->shortIndices.size() || this->lodShortIndices.size();
+    GLenum type = narrow ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    if ( level && level <= this->lods.size() ) {
+      const lod_level &l = this->lods[level-1];
+      uint64_t first = getNumberOfIndices() + l.first;
+      glDrawElements(GL_TRIANGLES, l.count, type, (const GLvoid *)( first * ( narrow ? sizeof(uint16_t) : sizeof(uint32_t) ) ));
+    } else if ( this->indexed )
+      glDrawElements(mode, getNumberOfIndices(), type, 0x0);
+    else
+      glDrawArrays(mode, 0, getNumberOfVertices());
+
+    if ( this->vao )
+      glBindVertexArray( 0 );
+    else {
+      disableArrays();
+      glBindBuffer( GL_ARRAY_BUFFER, 0 );
+      glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+    }
+
+    return;
+  }
+
+  // Face by face, for a group that mixes triangles, quads and lines
   void drawFaces(void) {
 
-    for(std::vector<face>::iterator it=faces.begin(); it != faces.end(); it++ )
-      it->draw();
+    uint stride = this->layout.stride();
+
+    for ( uint i=0; i<this->faceStart.size(); i++ ) {
+      uint n = getFaceSize( i );
+
+      glBegin( primitive( n ) );
+      for ( uint64_t c = this->faceStart[i]; c < this->faceStart[i] + n; c++ ) {
+	const float *p = &this->data[ stride * cornerVertex( c ) ];
+	if ( this->layout.normals )
+	  glNormal3fv( p + this->layout.normalOffset() );
+	if ( isCornerTextured( c ) )
+	  ( this->layout.textures > 2 ) ? glTexCoord3fv( p + this->layout.textureOffset() )
+	                                : glTexCoord2fv( p + this->layout.textureOffset() );
+	glVertex3fv( p );
+      }
+      glEnd();
+    }
 
     return;
   }
 
+  static GLenum primitive( uint corners ) {
+    if ( corners == QUAD )
+      return GL_QUADS;
+    if ( corners == LINE )
+      return GL_LINES;
+    return GL_TRIANGLES;
+  }
+
   void setupMaterial(void) {
     float *ka = this->mat.getKd();  // Ambient  color -- usually {0,0,0}, so use diffuse color instead
     float *kd = this->mat.getKd();  // Diffuse  color
@@ -257,7 +901,85 @@ class group {
     }
   }
 
-  void draw(void) {
+  // Copy the arrays into GL buffer objects, and set up a vertex array
+  // object too where the context has them, so draw() stops sending the
+  // vertices every frame. Needs a current context. False if the context
+  // can't (or the group is drawn face by face), and draw() carries on as
+  // before. Upload again after changing the group
+  bool upload(void) {
+
+    if ( first ) {
+      checkConsistancy();
+      first = false;
+    }
+
+    int support = bufferSupport();
+    if ( support == BUFFERS_NONE || !this->consistant || this->data.empty() )
+      return false;
+
+    if ( !this->vbo )
+      glGenBuffers( 1, &this->vbo );
+    glBindBuffer( GL_ARRAY_BUFFER, this->vbo );
+    glBufferData( GL_ARRAY_BUFFER, this->data.size() * sizeof(float), this->data.data(), GL_STATIC_DRAW );
+
+    // The group's indices, then every level's after them
+    if ( this->indexed || this->lods.size() ) {
+      if ( !this->ibo )
+	glGenBuffers( 1, &this->ibo );
+      glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, this->ibo );
+
+      bool narrow = this->shortIndices.size() || this->lodShortIndices.size();
+      uint64_t size = narrow ? sizeof(uint16_t) : sizeof(uint32_t);
+      uint64_t own = getNumberOfIndices(), levels = this->lodIndices.size() + this->lodShortIndices.size();
+      const void *ownData = narrow ? (const void *)this->shortIndices.data() : (const void *)this->indices.data();
+      const void *levelData = narrow ? (const void *)this->lodShortIndices.data() : (const void *)this->lodIndices.data();
+
+      glBufferData( GL_ELEMENT_ARRAY_BUFFER, ( own + levels ) * size, 0x0, GL_STATIC_DRAW );
+      if ( own )
+	glBufferSubData( GL_ELEMENT_ARRAY_BUFFER, 0, own * size, ownData );
+      if ( levels )
+	glBufferSubData( GL_ELEMENT_ARRAY_BUFFER, own * size, levels * size, levelData );
+    }
+    this->bufferLevels = this->lods.size();
+
+    // The vertex array object remembers the pointers, enables and index
+    // buffer, so drawing is just a bind
+    if ( support == BUFFERS_VAO ) {
+      if ( !this->vao )
+	glGenVertexArrays( 1, &this->vao );
+      glBindVertexArray( this->vao );
+      glBindBuffer( GL_ARRAY_BUFFER, this->vbo );
+      enableArrays( 0x0 );
+      if ( this->ibo )
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, this->ibo );
+      glBindVertexArray( 0 );
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+    return true;
+  }
+
+  bool isUploaded(void) const {
+    return this->vbo != 0;
+  }
+
+  // Free the GL buffers (for this group and every copy of it)
+  void release(void) {
+    if ( this->vao )
+      glDeleteVertexArrays( 1, &this->vao );
+    if ( this->ibo )
+      glDeleteBuffers( 1, &this->ibo );
+    if ( this->vbo )
+      glDeleteBuffers( 1, &this->vbo );
+    this->vbo = this->ibo = this->vao = 0;
+    this->bufferLevels = 0;
+    return;
+  }
+
+  // At a level of detail (0 for the whole group, see pickLevel)
+  void draw( uint level=0 ) {
 
     if ( first ) {
       checkConsistancy();
@@ -266,7 +988,19 @@ class group {
 
     setupMaterial();
     
-    if ( this->consistant )
+    if ( level > this->lods.size() || !this->consistant )
+      level = 0;
+
+    // Levels made since the upload aren't in the index buffer
+    if ( level && this->vbo && level <= this->bufferLevels )
+      drawBuffers( level );
+    else if ( level )
+      drawLevel( level );
+    else if ( this->consistant && this->vbo )
+      drawBuffers();
+    else if ( this->consistant && this->indexed )
+      drawElements();
+    else if ( this->consistant )
       drawArrays();
     else
       drawFaces();
@@ -280,8 +1014,11 @@ class group {
   friend std::ostream & operator << (std::ostream &, group &);
 
  protected:
-  std::vector <face> faces;
+  std::vector <uint32_t> faceStart;    // Each face's first corner
+  std::vector <bool> cornerTextured;   // Which corners had texture coordinates (empty until one does)
+  std::vector <bool> faceFlat;         // Which faces had no normals of their own
   std::string ID;
+  int          materialID;
   material     mat;
   unsigned int shading;
   bool consistant;
@@ -289,9 +1026,163 @@ class group {
 
   bool first;
 
-  std::vector<float> vertices;
-  std::vector<float> normals;
-  std::vector<float> textures;
+  std::vector<float> data;   // Interleaved vertices
+  vertex_layout format;      // How they should be packed
+  vertex_layout layout;      // How they are packed (no texture coordinates until some turn up)
+
+  bool indexed;    // Weld corners and draw with glDrawElements
+
+  GLuint vbo;      // GL buffers from upload(), 0 until then
+  GLuint ibo;
+  GLuint vao;
+  uint bufferLevels;    // How many levels of detail upload() put in ibo
+
+  int tangentAttribute;    // See setTangentAttribute()
+
+  bounds box;      // Around the vertices, from computeBounds()
+
+  std::vector<uint32_t> indices;
+  std::vector<uint16_t> shortIndices;
+
+  std::vector<lod_level> lods;             // Coarser levels of detail, coarsest last
+  std::vector<uint32_t>  lodIndices;       // ... their triangles, one level after another
+  std::vector<uint16_t>  lodShortIndices;  // ... or narrowed, as the indices are
+
+  // Open addressed hash table of the distinct vertices (NO_VERTEX where
+  // empty), kept at most half full, while an indexed group is being built
+  std::vector<uint32_t> weld;
+
+  // Move each vertex's floats to where remap says
+  static void remapArray( std::vector<float> &a, const std::vector<uint32_t> &remap, uint stride ) {
+    if ( a.size() != stride*remap.size() )
+      return;
+    std::vector<float> b( a.size() );
+    for ( uint32_t v=0; v<remap.size(); v++ )
+      memcpy( &b[stride*remap[v]], &a[stride*v], stride*sizeof(float) );
+    a.swap( b );
+    return;
+  }
+
+  // One vertex in the current layout (t is null if the corner has no texture coordinates)
+  void pack( const vec &v, const vec &n, const vec *t, float *out ) {
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+    float *o = out + 3;
+    if ( this->layout.normals ) {
+      *o++ = n.x;
+      *o++ = n.y;
+      *o++ = n.z;
+    }
+    const float tex[3] = { t ? t->x : 0.0f, t ? t->y : 0.0f, t ? t->z : 0.0f };
+    for ( uint i=0; i<this->layout.textures; i++ )
+      *o++ = tex[i];
+    for ( uint i=0; i<this->layout.tangents; i++ )
+      *o++ = 0.0f;
+    return;
+  }
+
+  // Repack the data into another layout, keeping what carries over
+  void repack( vertex_layout to ) {
+
+    vertex_layout from = this->layout;
+    this->layout = to;
+    if ( !to.textures )
+      std::vector<bool>().swap( this->cornerTextured );
+    if ( from == to || this->data.empty() )
+      return;
+
+    uint64_t count = this->data.size() / from.stride();
+    std::vector<float> packed( count * to.stride(), 0.0f );
+
+    for ( uint64_t i=0; i<count; i++ ) {
+      const float *src = &this->data[ i*from.stride() ];
+      float *dst = &packed[ i*to.stride() ];
+      memcpy( dst, src, 3*sizeof(float) );
+      if ( from.normals && to.normals )
+	memcpy( dst + to.normalOffset(), src + from.normalOffset(), 3*sizeof(float) );
+      uint t = ( from.textures < to.textures ) ? from.textures : to.textures;
+      memcpy( dst + to.textureOffset(), src + from.textureOffset(), t*sizeof(float) );
+      if ( from.tangents && to.tangents )
+	memcpy( dst + to.tangentOffset(), src + from.tangentOffset(), 4*sizeof(float) );
+    }
+    this->data.swap( packed );
+
+    // Vertices that were the same may not be now (and the hashes change)
+    if ( this->weld.size() )
+      rehash( this->weld.size() );
+    return;
+  }
+
+  // Which vertex the c'th corner uses
+  uint32_t cornerVertex( uint64_t c ) const {
+    if ( !this->indexed )
+      return c;
+    return this->shortIndices.size() ? this->shortIndices[c] : this->indices[c];
+  }
+
+  // n floats starting at offset from every vertex
+  std::vector<float> attribute( uint offset, uint n ) const {
+    std::vector<float> a;
+    uint stride = this->layout.stride();
+    if ( !n )
+      return a;
+    a.reserve( getNumberOfVertices() * n );
+    for ( uint64_t i=0; i<this->data.size(); i+=stride )
+      a.insert( a.end(), &this->data[i+offset], &this->data[i+offset] + n );
+    return a;
+  }
+
+  static uint64_t hashVertex( const float *f, uint n ) {
+    uint64_t h = 1469598103934665603ULL;
+    for ( uint i=0; i<n; i++ ) {
+      uint32_t bits;
+      memcpy( &bits, f+i, sizeof(bits) );
+      h = ( h ^ bits ) * 1099511628211ULL;
+    }
+    return h ^ ( h >> 29 );
+  }
+
+  void rehash( size_t slots ) {
+    uint stride = this->layout.stride();
+    this->weld.assign( slots, NO_VERTEX );
+    for ( uint32_t k=0; k<getNumberOfVertices(); k++ ) {
+      size_t i = hashVertex( &this->data[stride*k], stride ) & ( slots-1 );
+      while ( this->weld[i] != NO_VERTEX )
+	i = ( i+1 ) & ( slots-1 );
+      this->weld[i] = k;
+    }
+    return;
+  }
+
+  // Index of this (packed) vertex, adding it if it's new. Compares bit
+  // patterns, so only truly identical corners are welded
+  uint32_t weldVertex( const float *key ) {
+
+    uint stride = this->layout.stride();
+    uint32_t count = getNumberOfVertices();
+
+    if ( 2*(size_t)(count+1) > this->weld.size() ) {
+      size_t slots = this->weld.size() ? 2*this->weld.size() : 1024;
+      while ( slots < 2*(size_t)(count+1) )
+	slots *= 2;
+      rehash( slots );
+    }
+
+    size_t mask = this->weld.size()-1;
+    for ( size_t i = hashVertex( key, stride ) & mask; ; i = ( i+1 ) & mask ) {
+      uint32_t k = this->weld[i];
+
+      if ( k == NO_VERTEX ) {
+	this->weld[i] = count;
+	this->data.insert( this->data.end(), key, key+stride );
+	return count;
+      }
+
+      if ( !memcmp( &this->data[stride*k], key, stride*sizeof(float) ) )
+	return k;
+    }
+  }
 
 };
 #endif
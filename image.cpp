@@ -0,0 +1,586 @@
+#include <image.h>
+#include <reader.h>
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <strings.h>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <zlib.h>
+
+#ifdef HAVE_MAGICK
+#include <Magick++.h>
+#endif
+
+using namespace std;
+
+/*
+ * image.cpp : The built in image decoders. Each one decodes straight from
+ *             the (memory mapped) file into the RGBA buffer handed to GL
+ */
+
+static uint16_t le16( const unsigned char *p ) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t be32( const unsigned char *p ) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static bool hasExtension( const string &file, const char *ext ) {
+  size_t n = strlen( ext );
+  if ( file.length() < n )
+    return false;
+  return strcasecmp( file.c_str() + file.length() - n, ext ) == 0;
+}
+
+// Deflate never expands by more than this, so a PNG can't hold more
+// pixel data than its IDAT chunks times this
+#define MAX_INFLATE 1032
+
+// Guard against sizes that would overflow (or just eat all the memory)
+static bool sensibleSize( uint64_t w, uint64_t h ) {
+  return w && h && w <= (1 << 16) && h <= (1 << 16);
+}
+
+/*
+ *  PNG: every colour type and bit depth, with or without interlacing.
+ *       16 bit samples keep their high byte, tRNS becomes alpha
+ */
+
+class png_decoder : public image_decoder {
+
+ public:
+
+  string getName( void ) { return "PNG"; }
+
+  bool recognizes( const unsigned char *data, size_t size, const string &file ) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    return size >= 8 && memcmp( data, signature, 8 ) == 0;
+  }
+
+  bool decode( const unsigned char *data, size_t size, vector <unsigned char> &rgba, uint &w, uint &h ) {
+
+    const unsigned char *p = data + 8, *end = data + size;
+
+    vector <unsigned char> idat, palette, alpha;
+    uint depth = 0, type = 0, interlace = 0;
+    bool header = false;
+    w = h = 0;
+
+    // Gather up the chunks we care about
+    while ( p + 12 <= end ) {
+      uint32_t len = be32( p );
+      const unsigned char *tag = p + 4, *body = p + 8;
+      if ( len > (size_t)(end - body) - 4 )
+	return false;
+
+      if ( !memcmp( tag, "IHDR", 4 ) && len >= 13 ) {
+	w = be32( body );
+	h = be32( body+4 );
+	depth = body[8];
+	type  = body[9];
+	interlace = body[12];
+	header = true;
+      }
+      else if ( !memcmp( tag, "PLTE", 4 ) )
+	palette.assign( body, body+len );
+      else if ( !memcmp( tag, "tRNS", 4 ) )
+	alpha.assign( body, body+len );
+      else if ( !memcmp( tag, "IDAT", 4 ) )
+	idat.insert( idat.end(), body, body+len );
+      else if ( !memcmp( tag, "IEND", 4 ) )
+	break;
+
+      p = body + len + 4;   // skip the CRC
+    }
+
+    if ( !header || !sensibleSize( w, h ) || interlace > 1 )
+      return false;
+
+    uint channels;
+    switch ( type ) {
+    case 0: channels = 1; break;   // grey
+    case 2: channels = 3; break;   // RGB
+    case 3: channels = 1; break;   // palette
+    case 4: channels = 2; break;   // grey + alpha
+    case 6: channels = 4; break;   // RGBA
+    default: return false;
+    }
+    if ( depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16 )
+      return false;
+    if ( depth < 8 && channels > 1 )
+      return false;
+    if ( type == 3 && ( depth > 8 || palette.size() < 3 ) )
+      return false;
+
+    uint bits  = channels * depth;
+    uint pixel = ( bits + 7 ) / 8;   // filters work on whole bytes
+
+    // The passes: the whole image, or Adam7's seven
+    static const uint adam7[7][4] = { {0,0,8,8}, {4,0,8,8}, {0,4,4,8}, {2,0,4,4}, {0,2,2,4}, {1,0,2,2}, {0,1,1,2} };
+    static const uint whole[1][4] = { {0,0,1,1} };
+    const uint (*passes)[4] = interlace ? adam7 : whole;
+    uint npasses = interlace ? 7 : 1;
+
+    // Work out how much filtered data there should be, and inflate it
+    uint64_t raw = 0;
+    for ( uint i=0; i<npasses; i++ ) {
+      uint64_t pw = passWidth( w, passes[i] ), ph = passWidth( h, passes[i]+1 );
+      if ( pw && ph )
+	raw += ph * ( 1 + (pw * bits + 7) / 8 );
+    }
+
+    // A header can claim any size, the data has to back it up
+    if ( raw / MAX_INFLATE > idat.size() )
+      return false;
+
+    vector <unsigned char> filtered( raw );
+    uLongf got = raw;
+    if ( uncompress( filtered.data(), &got, idat.data(), idat.size() ) != Z_OK || got != raw )
+      return false;
+
+    rgba.assign( (size_t)w * h * 4, 0 );
+
+    unsigned char *row = filtered.data();
+    for ( uint i=0; i<npasses; i++ ) {
+      uint pw = passWidth( w, passes[i] ), ph = passWidth( h, passes[i]+1 );
+      if ( !pw || !ph )
+	continue;
+
+      size_t stride = ( (uint64_t)pw * bits + 7 ) / 8;
+      const unsigned char *prev = 0x0;
+
+      for ( uint y=0; y<ph; y++ ) {
+	unsigned char filter = row[0], *line = row + 1;
+	if ( !unfilter( filter, line, prev, stride, pixel ) )
+	  return false;
+
+	uint ty = passes[i][1] + y * passes[i][3];
+	for ( uint x=0; x<pw; x++ ) {
+	  uint tx = passes[i][0] + x * passes[i][2];
+	  expand( line, x, type, depth, palette, alpha, &rgba[ ((size_t)ty * w + tx) * 4 ] );
+	}
+
+	prev = line;
+	row += stride + 1;
+      }
+    }
+
+    return true;
+  }
+
+ protected:
+
+  static uint passWidth( uint size, const uint *pass ) {
+    // pass[0] is the start, pass[2] the step (for heights: pass[1], pass[3])
+    return ( size > pass[0] ) ? ( size - pass[0] + pass[2] - 1 ) / pass[2] : 0;
+  }
+
+  static unsigned char paeth( int a, int b, int c ) {
+    int p = a + b - c, pa = abs(p-a), pb = abs(p-b), pc = abs(p-c);
+    if ( pa <= pb && pa <= pc )
+      return a;
+    return ( pb <= pc ) ? b : c;
+  }
+
+  static bool unfilter( unsigned char filter, unsigned char *line, const unsigned char *prev, size_t n, uint pixel ) {
+
+    switch ( filter ) {
+    case 0:
+      break;
+    case 1:
+      for ( size_t i=pixel; i<n; i++ )
+	line[i] += line[i-pixel];
+      break;
+    case 2:
+      if ( prev )
+	for ( size_t i=0; i<n; i++ )
+	  line[i] += prev[i];
+      break;
+    case 3:
+      for ( size_t i=0; i<n; i++ ) {
+	int left = ( i >= pixel ) ? line[i-pixel] : 0, up = prev ? prev[i] : 0;
+	line[i] += ( left + up ) >> 1;
+      }
+      break;
+    case 4:
+      for ( size_t i=0; i<n; i++ ) {
+	int left = ( i >= pixel ) ? line[i-pixel] : 0, up = prev ? prev[i] : 0;
+	int corner = ( prev && i >= pixel ) ? prev[i-pixel] : 0;
+	line[i] += paeth( left, up, corner );
+      }
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+
+  // Sample c of pixel x, at its own bit depth
+  static uint sample( const unsigned char *line, uint x, uint c, uint channels, uint depth ) {
+    if ( depth == 8 )
+      return line[ x*channels + c ];
+    if ( depth == 16 ) {
+      const unsigned char *s = line + 2*(x*channels + c);
+      return (s[0] << 8) | s[1];
+    }
+    // 1, 2 and 4 bit samples are packed high bits first (and only ever one channel)
+    uint bit = x * depth;
+    return ( line[bit >> 3] >> ( 8 - depth - (bit & 7) ) ) & ( (1 << depth) - 1 );
+  }
+
+  static unsigned char to8( uint v, uint depth ) {
+    if ( depth == 16 )
+      return v >> 8;
+    if ( depth == 8 )
+      return v;
+    return v * 255 / ( (1 << depth) - 1 );
+  }
+
+  static void expand( const unsigned char *line, uint x, uint type, uint depth,
+		      const vector <unsigned char> &palette, const vector <unsigned char> &alpha, unsigned char *out ) {
+
+    switch ( type ) {
+    case 0: {
+      uint g = sample( line, x, 0, 1, depth );
+      out[0] = out[1] = out[2] = to8( g, depth );
+      out[3] = ( alpha.size() >= 2 && g == (uint)((alpha[0] << 8) | alpha[1]) ) ? 0 : 255;
+      break;
+    }
+    case 2: {
+      uint r = sample( line, x, 0, 3, depth ), g = sample( line, x, 1, 3, depth ), b = sample( line, x, 2, 3, depth );
+      out[0] = to8( r, depth );
+      out[1] = to8( g, depth );
+      out[2] = to8( b, depth );
+      out[3] = ( alpha.size() >= 6 && r == (uint)((alpha[0] << 8) | alpha[1]) &&
+		 g == (uint)((alpha[2] << 8) | alpha[3]) && b == (uint)((alpha[4] << 8) | alpha[5]) ) ? 0 : 255;
+      break;
+    }
+    case 3: {
+      uint i = sample( line, x, 0, 1, depth );
+      if ( 3*i+2 < palette.size() ) {
+	out[0] = palette[3*i];
+	out[1] = palette[3*i+1];
+	out[2] = palette[3*i+2];
+      }
+      out[3] = ( i < alpha.size() ) ? alpha[i] : 255;
+      break;
+    }
+    case 4:
+      out[0] = out[1] = out[2] = to8( sample( line, x, 0, 2, depth ), depth );
+      out[3] = to8( sample( line, x, 1, 2, depth ), depth );
+      break;
+    case 6:
+      for ( uint c=0; c<4; c++ )
+	out[c] = to8( sample( line, x, c, 4, depth ), depth );
+      break;
+    }
+    return;
+  }
+};
+
+/*
+ *  TGA: true colour (15/16/24/32 bit), grey and colour mapped images,
+ *       plain or run length encoded, either way up
+ */
+
+class tga_decoder : public image_decoder {
+
+ public:
+
+  string getName( void ) { return "TGA"; }
+
+  // No signature to go on... just the name and a header that adds up
+  bool recognizes( const unsigned char *data, size_t size, const string &file ) {
+    if ( size < 18 || !hasExtension( file, ".tga" ) )
+      return false;
+    uint type = data[2] & ~8u;
+    return type >= 1 && type <= 3;
+  }
+
+  bool decode( const unsigned char *data, size_t size, vector <unsigned char> &rgba, uint &w, uint &h ) {
+
+    const unsigned char *end = data + size;
+    uint idLength  = data[0];
+    uint mapped    = data[1];
+    uint type      = data[2];
+    uint mapFirst  = le16( data+3 ), mapLength = le16( data+5 ), mapBits = data[7];
+    uint bits      = data[16];
+    uint described = data[17];
+
+    w = le16( data+12 );
+    h = le16( data+14 );
+    if ( !sensibleSize( w, h ) )
+      return false;
+
+    bool rle  = ( type & 8 ) != 0;
+    uint kind = type & ~8u;
+
+    const unsigned char *p = data + 18 + idLength;
+
+    // Colour map, if there is one, turned into RGBA up front
+    vector <unsigned char> map;
+    if ( mapped ) {
+      uint entry = ( mapBits + 7 ) / 8;
+      if ( p + (size_t)mapLength * entry > end )
+	return false;
+      map.resize( ( mapFirst + mapLength ) * 4, 0 );
+      for ( uint i=0; i<mapLength; i++, p+=entry )
+	if ( !colour( p, mapBits, &map[ (mapFirst+i)*4 ] ) )
+	  return false;
+    }
+
+    uint pixel = ( bits + 7 ) / 8;
+    if ( !pixel || pixel > 4 || ( kind == 1 && !mapped ) )
+      return false;
+
+    // Rows come bottom first unless bit 5 of the descriptor says otherwise
+    bool topFirst = ( described & 0x20 ) != 0;
+    rgba.resize( (size_t)w * h * 4 );
+
+    size_t count = (size_t)w * h, n = 0;
+    while ( n < count ) {
+
+      // Runs are a header byte then one pixel (repeated) or the raw pixels
+      uint run = 1;
+      bool repeat = false;
+      if ( rle ) {
+	if ( p >= end )
+	  return false;
+	run    = ( *p & 0x7F ) + 1;
+	repeat = ( *p & 0x80 ) != 0;
+	p++;
+      }
+
+      for ( uint i=0; i<run && n<count; i++, n++ ) {
+	if ( p + pixel > end )
+	  return false;
+
+	size_t x = n % w, y = n / w;
+	if ( !topFirst )
+	  y = h - 1 - y;
+	unsigned char *out = &rgba[ (y*w + x) * 4 ];
+
+	if ( kind == 1 ) {
+	  uint index = ( pixel == 1 ) ? p[0] : le16( p );
+	  if ( (size_t)index*4 + 3 >= map.size() )
+	    return false;
+	  memcpy( out, &map[ index*4 ], 4 );
+	} else if ( kind == 3 ) {
+	  out[0] = out[1] = out[2] = p[0];
+	  out[3] = ( pixel > 1 ) ? p[1] : 255;
+	} else if ( !colour( p, bits, out ) )
+	  return false;
+
+	if ( !repeat || i+1 == run )
+	  p += pixel;
+      }
+    }
+
+    return true;
+  }
+
+ protected:
+
+  // One BGR(A) pixel of a true colour image or colour map
+  static bool colour( const unsigned char *p, uint bits, unsigned char *out ) {
+    switch ( bits ) {
+    case 15:
+    case 16: {
+      uint v = le16( p );
+      out[0] = ( (v >> 10) & 31 ) * 255 / 31;
+      out[1] = ( (v >>  5) & 31 ) * 255 / 31;
+      out[2] = (  v        & 31 ) * 255 / 31;
+      out[3] = 255;
+      return true;
+    }
+    case 24:
+    case 32:
+      out[0] = p[2];
+      out[1] = p[1];
+      out[2] = p[0];
+      out[3] = ( bits == 32 ) ? p[3] : 255;
+      return true;
+    }
+    return false;
+  }
+};
+
+/*
+ *  PPM/PGM: the binary kinds (P6 and P5), 8 or 16 bits a sample
+ */
+
+class ppm_decoder : public image_decoder {
+
+ public:
+
+  string getName( void ) { return "PPM"; }
+
+  bool recognizes( const unsigned char *data, size_t size, const string &file ) {
+    return size >= 3 && data[0] == 'P' && ( data[1] == '5' || data[1] == '6' ) && isspace( data[2] );
+  }
+
+  bool decode( const unsigned char *data, size_t size, vector <unsigned char> &rgba, uint &w, uint &h ) {
+
+    const unsigned char *p = data + 2, *end = data + size;
+    uint channels = ( data[1] == '6' ) ? 3 : 1;
+    uint maxval;
+
+    if ( !number( p, end, w ) || !number( p, end, h ) || !number( p, end, maxval ) )
+      return false;
+    if ( !sensibleSize( w, h ) || !maxval || maxval > 65535 || p >= end )
+      return false;
+    p++;   // the single whitespace before the pixels
+
+    uint bytes = ( maxval > 255 ) ? 2 : 1;
+    size_t count = (size_t)w * h;
+    if ( (size_t)(end - p) < count * channels * bytes )
+      return false;
+
+    rgba.resize( count * 4 );
+    for ( size_t i=0; i<count; i++ ) {
+      unsigned char *out = &rgba[ i*4 ];
+      for ( uint c=0; c<channels; c++, p+=bytes ) {
+	uint v = ( bytes == 2 ) ? ( (p[0] << 8) | p[1] ) : p[0];
+	out[c] = ( maxval == 255 ) ? v : v * 255 / maxval;
+      }
+      if ( channels == 1 )
+	out[1] = out[2] = out[0];
+      out[3] = 255;
+    }
+    return true;
+  }
+
+ protected:
+
+  // Next decimal number in the header, skipping white space and comments
+  static bool number( const unsigned char *&p, const unsigned char *end, uint &n ) {
+    while ( p < end && ( isspace( *p ) || *p == '#' ) ) {
+      if ( *p == '#' )
+	while ( p < end && *p != '\n' )
+	  p++;
+      else
+	p++;
+    }
+    if ( p >= end || !isdigit( *p ) )
+      return false;
+    for ( n = 0; p < end && isdigit( *p ); p++ )
+      n = n*10 + ( *p - '0' );
+    return true;
+  }
+};
+
+#ifdef HAVE_MAGICK
+/*
+ *  Anything else: let ImageMagick have a go
+ */
+
+class magick_decoder : public image_decoder {
+
+ public:
+
+  string getName( void ) { return "ImageMagick"; }
+
+  bool recognizes( const unsigned char *data, size_t size, const string &file ) {
+    return true;
+  }
+
+  bool decode( const unsigned char *data, size_t size, vector <unsigned char> &rgba, uint &w, uint &h ) {
+
+    static once_flag initialized;
+    call_once( initialized, [](){ Magick::InitializeMagick(""); } );
+
+    try {
+      Magick::Blob in( data, size ), out;
+      Magick::Image image( in );
+
+      image.write( &out, "RGBA", 8 );
+      w = image.columns();
+      h = image.rows();
+
+      const unsigned char *pixels = (const unsigned char *)out.data();
+      rgba.assign( pixels, pixels + out.length() );
+      return rgba.size() == (size_t)w * h * 4;
+    }
+    catch( Magick::Exception &error ) {
+      cout << "Caught exception: " << error.what() << endl;
+      return false;
+    }
+  }
+};
+#endif
+
+// The decoders to try, added ones first
+static mutex                  decodersLock;
+static vector <image_decoder *> decoders;
+
+static vector <image_decoder *> builtInDecoders( void ) {
+  static png_decoder png;
+  static tga_decoder tga;
+  static ppm_decoder ppm;
+  vector <image_decoder *> list = { &png, &tga, &ppm };
+  if ( magickDecoder() )
+    list.push_back( magickDecoder() );
+  return list;
+}
+
+image_decoder *magickDecoder( void ) {
+#ifdef HAVE_MAGICK
+  static magick_decoder magick;
+  return &magick;
+#else
+  return 0x0;
+#endif
+}
+
+void addImageDecoder( image_decoder *decoder ) {
+  lock_guard<mutex> hold( decodersLock );
+  decoders.insert( decoders.begin(), decoder );
+  return;
+}
+
+bool decodeImageFile( string file, vector <unsigned char> &rgba, uint &w, uint &h ) {
+
+  reader in( file );
+  if ( !in.isOpen() ) {
+    perror( file.c_str() );
+    return false;
+  }
+
+  const unsigned char *data = (const unsigned char *)in.getData();
+  size_t size = in.getSize();
+
+  vector <image_decoder *> list;
+  {
+    lock_guard<mutex> hold( decodersLock );
+    list = decoders;
+  }
+  vector <image_decoder *> builtIn = builtInDecoders();
+  list.insert( list.end(), builtIn.begin(), builtIn.end() );
+
+  for ( uint i=0; i<list.size(); i++ ) {
+    if ( !list[i]->recognizes( data, size, file ) )
+      continue;
+
+    // Runs on the texture threads, so an image too big to hold just fails
+    try {
+      if ( list[i]->decode( data, size, rgba, w, h ) )
+	return true;
+    }
+    catch( std::bad_alloc &error ) {
+      vector <unsigned char>().swap( rgba );
+      cout << file << " is too big to decode\n";
+      return false;
+    }
+    cout << "Couldn't read " << file << " as " << list[i]->getName() << "\n";
+    return false;
+  }
+
+  cout << "No decoder for " << file << "\n";
+  return false;
+}
@@ -0,0 +1,44 @@
+#ifndef __IMAGE_H
+#define __IMAGE_H 1
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ *  image.h : Turns texture files into pixels ready for glTexImage2D: RGBA,
+ *            8 bits a channel, top row first. PNG, TGA and binary PPM/PGM
+ *            are read directly (see image.cpp); anything else goes to
+ *            ImageMagick when the library is built with it (MAGICK=1 in
+ *            the Makefile, which defines HAVE_MAGICK)
+ */
+
+class image_decoder {
+
+ public:
+  virtual ~image_decoder() {}
+
+  // For messages
+  virtual std::string getName( void ) = 0;
+
+  // Does this look like something we can read? Gets the whole file and its name
+  virtual bool recognizes( const unsigned char *data, size_t size, const std::string &file ) = 0;
+
+  // Fill in rgba (w*h*4 bytes), w and h. False if the file is damaged or unsupported
+  virtual bool decode( const unsigned char *data, size_t size, std::vector <unsigned char> &rgba, uint &w, uint &h ) = 0;
+};
+
+// Read an image file with the first decoder that recognizes it. Safe to
+// call from several threads at once
+bool decodeImageFile( std::string file, std::vector <unsigned char> &rgba, uint &w, uint &h );
+
+// Add a decoder, tried ahead of the built in ones. The caller keeps
+// ownership, and the decoder has to outlive any loading
+void addImageDecoder( image_decoder *decoder );
+
+// The ImageMagick fallback on its own, for comparing against (imagebench).
+// 0x0 when the library is built without it
+image_decoder *magickDecoder( void );
+
+#endif
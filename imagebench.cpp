@@ -0,0 +1,102 @@
+#include <image.h>
+#include <reader.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+using namespace std;
+
+/*
+ * imagebench.cpp : How fast textures decode, in ms per megapixel: each file
+ *                  through decodeImageFile() (the built in PNG/TGA/PPM
+ *                  decoders) and, when the library has it, through the
+ *                  ImageMagick fallback the built in ones replaced. Takes
+ *                  the best of several runs, so the first read off the
+ *                  disk doesn't count against either.
+ *
+ *   usage: imagebench <image> [image ...] [-r runs]
+ */
+
+static double seconds( chrono::steady_clock::time_point since ) {
+  return chrono::duration<double>( chrono::steady_clock::now() - since ).count();
+}
+
+static void report( const char *what, double time, uint w, uint h ) {
+  cout << "  " << what << time * 1e3 / ( (double)w * h / 1e6 ) << " ms/Mpixel (" << time * 1e3 << " ms)\n";
+  return;
+}
+
+int main( int argc, char **argv ) {
+
+  uint runs = 5;
+  vector <string> files;
+  for ( int i=1; i<argc; i++ ) {
+    if ( string( argv[i] ) == "-r" && i+1 < argc )
+      runs = atoi( argv[++i] );
+    else
+      files.push_back( argv[i] );
+  }
+  if ( files.empty() || !runs ) {
+    cout << "usage: " << argv[0] << " <image> [image ...] [-r runs]\n";
+    return 1;
+  }
+
+  image_decoder *magick = magickDecoder();
+  if ( !magick )
+    cout << "(built without ImageMagick, timing the built in decoders only)\n";
+
+  for ( uint f=0; f<files.size(); f++ ) {
+
+    vector <unsigned char> rgba;
+    uint w = 0, h = 0;
+    double best = 0.0;
+    for ( uint r=0; r<runs; r++ ) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      if ( !decodeImageFile( files[f], rgba, w, h ) ) {
+	best = -1.0;
+	break;
+      }
+      double time = seconds( start );
+      if ( !r || time < best )
+	best = time;
+    }
+    if ( best < 0.0 || !w || !h )
+      continue;
+
+    cout << files[f] << ": " << w << "x" << h << "\n";
+    report( "decodeImageFile: ", best, w, h );
+
+    if ( !magick )
+      continue;
+
+    // Same pixels expected back, from the same mapped file
+    reader in( files[f] );
+    const unsigned char *data = (const unsigned char *)in.getData();
+    vector <unsigned char> other;
+    uint mw = 0, mh = 0;
+    best = -1.0;
+    for ( uint r=0; r<runs; r++ ) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      if ( !magick->decode( data, in.getSize(), other, mw, mh ) ) {
+	best = -1.0;
+	break;
+      }
+      double time = seconds( start );
+      if ( best < 0.0 || time < best )
+	best = time;
+    }
+    if ( best < 0.0 ) {
+      cout << "  " << magick->getName() << ": couldn't read it\n";
+      continue;
+    }
+    report( "ImageMagick:     ", best, mw, mh );
+    if ( mw != w || mh != h || other != rgba )
+      cout << "  (RESULTS DIFFER)\n";
+  }
+
+  return 0;
+}
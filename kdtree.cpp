@@ -0,0 +1,258 @@
+#include <kdtree.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <omp.h>
+
+using namespace std;
+
+/*
+ * kdtree.cpp : Building and searching the tree. Each node's points are
+ *              split at their median (nth_element) along the widest
+ *              axis, the halves of big nodes as OpenMP tasks. Searches
+ *              go nearest box first and skip any box further away than
+ *              the best so far (or than the radius)
+ */
+
+#define KD_LEAF      8        // Nodes this small aren't split any further
+#define KD_TASK      65536    // Points in a node before its halves get tasks of their own
+#define KD_MAX_DEPTH 64       // As deep as the search's stack goes (halving, it never gets close)
+
+template <typename point_type, typename node_type>
+static void split( point_type *points, node_type *nodes, atomic <uint32_t> &used,
+		   uint32_t index, uint64_t begin, uint64_t end ) {
+
+  node_type &n = nodes[index];
+  uint64_t count = end - begin;
+
+  for ( uint k=0; k<3; k++ ) {
+    n.min[k] = INFINITY;
+    n.max[k] = -INFINITY;
+  }
+  for ( uint64_t i=begin; i<end; i++ )
+    for ( uint k=0; k<3; k++ ) {
+      n.min[k] = fminf( n.min[k], points[i].p[k] );
+      n.max[k] = fmaxf( n.max[k], points[i].p[k] );
+    }
+
+  n.first = begin;
+  n.count = count;
+  if ( count <= KD_LEAF )
+    return;
+
+  uint axis = 0;
+  for ( uint k=1; k<3; k++ )
+    if ( n.max[k] - n.min[k] > n.max[axis] - n.min[axis] )
+      axis = k;
+
+  uint64_t mid = begin + count/2;
+  nth_element( points + begin, points + mid, points + end,
+	       [axis]( const point_type &a, const point_type &b ) { return a.p[axis] < b.p[axis]; } );
+
+  uint32_t children = used.fetch_add( 2 );
+  n.first = children;
+  n.count = 0;
+
+  if ( count > KD_TASK ) {
+    #pragma omp task shared( used )
+    split( points, nodes, used, children, begin, mid );
+    split( points, nodes, used, children+1, mid, end );
+  } else {
+    split( points, nodes, used, children, begin, mid );
+    split( points, nodes, used, children+1, mid, end );
+  }
+  return;
+}
+
+void kd_tree::build( const vector <object> &objects, int threads ) {
+
+  this->points.clear();
+  this->nodes.clear();
+  this->owners.clear();
+
+  // Every group with vertices, and where its points start
+  vector <const group *> groups;
+  vector <uint64_t> start( 1, 0 );
+  for ( uint i=0; i<objects.size(); i++ )
+    for ( uint j=0; j<objects[i].getNumberOfGroups(); j++ ) {
+      const group *g = objects[i].getGroup( j );
+      if ( !g->getNumberOfVertices() )
+	continue;
+      kd_owner o = { i, j };
+      this->owners.push_back( o );
+      groups.push_back( g );
+      start.push_back( start.back() + g->getNumberOfVertices() );
+    }
+
+  uint64_t count = start.back();
+  if ( !count )
+    return;
+  if ( threads <= 0 )
+    threads = omp_get_max_threads();
+
+  this->points.resize( count );
+
+  #pragma omp parallel for schedule(dynamic) num_threads(threads)
+  for ( int64_t k=0; k<(int64_t)groups.size(); k++ ) {
+    const float *data = groups[k]->getInterleavedArray().data();
+    uint stride = groups[k]->getLayout().stride();
+    for ( uint64_t v=0; v < start[k+1] - start[k]; v++ ) {
+      kd_point &p = this->points[ start[k] + v ];
+      memcpy( p.p, data + v*stride, 3*sizeof(float) );
+      p.owner = k;
+      p.vertex = v;
+    }
+  }
+
+  // Halving down to leaves of more than KD_LEAF/2 points, there are
+  // fewer than 2n/(KD_LEAF/2) nodes, so they never move while the tasks
+  // fill them in
+  this->nodes.resize( 2*( count/(KD_LEAF/2) + 1 ) );
+  atomic <uint32_t> used( 1 );
+  kd_point *p = this->points.data();
+  kd_node *n = this->nodes.data();
+
+  #pragma omp parallel num_threads(threads)
+  #pragma omp single
+  split( p, n, used, 0, 0, count );
+
+  this->nodes.resize( used );
+  this->nodes.shrink_to_fit();
+  return;
+}
+
+static inline float distance2( const float *p, const float *q ) {
+  float x = p[0] - q[0], y = p[1] - q[1], z = p[2] - q[2];
+  return x*x + y*y + z*z;
+}
+
+// How far (squared) q is from a box, 0 inside it
+static inline float boxDistance2( const float *min, const float *max, const float *q ) {
+  float d = 0.0f;
+  for ( uint k=0; k<3; k++ ) {
+    float e = fmaxf( fmaxf( min[k] - q[k], q[k] - max[k] ), 0.0f );
+    d += e*e;
+  }
+  return d;
+}
+
+vertex_hit kd_tree::hitFor( uint64_t i, float distance ) const {
+  const kd_point &p = this->points[i];
+  vertex_hit hit;
+  hit.distance = distance;
+  hit.position = vec{ p.p[0], p.p[1], p.p[2] };
+  hit.object   = this->owners[ p.owner ].object;
+  hit.group    = this->owners[ p.owner ].group;
+  hit.vertex   = p.vertex;
+  return hit;
+}
+
+bool kd_tree::nearest( const vec &p, vertex_hit &hit, float maxDistance ) const {
+
+  hit = vertex_hit();
+  if ( this->nodes.empty() )
+    return false;
+
+  const float q[3] = { p.x, p.y, p.z };
+  float best = maxDistance * maxDistance;
+  uint64_t found = this->points.size();
+
+  struct { uint32_t node; float d; } stack[KD_MAX_DEPTH];
+  uint sp = 0;
+
+  const kd_node *n = &this->nodes[0];
+  if ( boxDistance2( n->min, n->max, q ) >= best )
+    return false;
+
+  while ( true ) {
+
+    if ( n->count ) {
+      for ( uint64_t i = n->first; i < n->first + n->count; i++ ) {
+	float d = distance2( this->points[i].p, q );
+	if ( d < best ) {
+	  best = d;
+	  found = i;
+	}
+      }
+    } else {
+      // Nearer child next, the other on the stack for later
+      uint32_t a = n->first, b = n->first + 1;
+      float da = boxDistance2( this->nodes[a].min, this->nodes[a].max, q );
+      float db = boxDistance2( this->nodes[b].min, this->nodes[b].max, q );
+      if ( db < da ) {
+	std::swap( a, b );
+	std::swap( da, db );
+      }
+      if ( da < best ) {
+	if ( db < best ) {
+	  stack[sp].node = b;
+	  stack[sp].d = db;
+	  sp++;
+	}
+	n = &this->nodes[a];
+	continue;
+      }
+    }
+
+    while ( sp && stack[sp-1].d >= best )
+      sp--;
+    if ( !sp )
+      break;
+    n = &this->nodes[ stack[--sp].node ];
+  }
+
+  if ( found == this->points.size() )
+    return false;
+
+  hit = hitFor( found, sqrtf( best ) );
+  return true;
+}
+
+void kd_tree::within( const vec &p, float radius, vector <vertex_hit> &hits ) const {
+
+  if ( this->nodes.empty() )
+    return;
+
+  const float q[3] = { p.x, p.y, p.z };
+  float r2 = radius * radius;
+  size_t first = hits.size();
+
+  uint32_t stack[KD_MAX_DEPTH];
+  uint sp = 0;
+  stack[sp++] = 0;
+
+  while ( sp ) {
+    const kd_node &n = this->nodes[ stack[--sp] ];
+    if ( boxDistance2( n.min, n.max, q ) > r2 )
+      continue;
+
+    if ( n.count ) {
+      for ( uint64_t i = n.first; i < n.first + n.count; i++ ) {
+	float d = distance2( this->points[i].p, q );
+	if ( d <= r2 )
+	  hits.push_back( hitFor( i, sqrtf( d ) ) );
+      }
+    } else {
+      stack[sp++] = n.first;
+      stack[sp++] = n.first + 1;
+    }
+  }
+
+  sort( hits.begin() + first, hits.end(),
+	[]( const vertex_hit &a, const vertex_hit &b ) { return a.distance < b.distance; } );
+  return;
+}
+
+void kd_tree::nearest( const vector <vec> &points, vector <vertex_hit> &hits, float maxDistance, int threads ) const {
+
+  int64_t n = points.size();
+  hits.resize( n );
+  if ( threads <= 0 )
+    threads = omp_get_max_threads();
+
+  #pragma omp parallel for schedule(dynamic,256) num_threads(threads)
+  for ( int64_t i=0; i<n; i++ )
+    nearest( points[i], hits[i], maxDistance );
+  return;
+}
@@ -0,0 +1,103 @@
+#ifndef __KDTREE_H
+#define __KDTREE_H 1
+
+#include <object.h>
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+/*
+ *  kdtree.h : A k-d tree over the vertices of a set of objects, for
+ *             snapping to the nearest vertex and finding the vertices
+ *             near a point. Each node splits its points at the median
+ *             along the axis they're widest in, and keeps the box they
+ *             fill (much tighter than the split planes alone, when the
+ *             points all lie on a surface), down to leaves of at most 8
+ *             points: about 32 bytes a vertex. Every vertex of every
+ *             group is in it, so a position shared by several vertices
+ *             (for different normals, or every corner of a group that
+ *             isn't indexed) turns up once for each. Built across the
+ *             cores, and like the BVH it keeps its own copy, to be built
+ *             again if the geometry changes
+ */
+
+struct vertex_hit {
+  float    distance;   // From the query point
+  vec      position;
+  uint32_t object;     // Which object (0xFFFFFFFF for none) ...
+  uint32_t group;      // ... group in it ...
+  uint32_t vertex;     // ... and vertex in that (see group::getInterleavedArray)
+
+  vertex_hit( void ) {
+    distance = INFINITY;
+    position = vec{ 0.0f, 0.0f, 0.0f };
+    object = 0xFFFFFFFFu;
+    group = vertex = 0;
+  }
+};
+
+class kd_tree {
+
+ public:
+
+  kd_tree( void ) {
+    return;
+  }
+
+  // Over every vertex of the objects, replacing whatever was there.
+  // threads = 0 for all of them
+  void build( const std::vector <object> &objects, int threads=0 );
+
+  // The vertex nearest p, if there's one within maxDistance
+  bool nearest( const vec &p, vertex_hit &hit, float maxDistance=INFINITY ) const;
+
+  // Every vertex within radius of p, nearest first (appended to hits)
+  void within( const vec &p, float radius, std::vector <vertex_hit> &hits ) const;
+
+  // The nearest vertex to each of a batch of points, shared out across the
+  // cores (threads = 0 for all of them)
+  void nearest( const std::vector <vec> &points, std::vector <vertex_hit> &hits,
+		float maxDistance=INFINITY, int threads=0 ) const;
+
+  uint64_t getNumberOfVertices( void ) const {
+    return this->points.size();
+  }
+
+  uint64_t getMemoryBytes( void ) const {
+    return this->points.capacity() * sizeof(kd_point) + this->nodes.capacity() * sizeof(kd_node) +
+	   this->owners.capacity() * sizeof(kd_owner);
+  }
+
+  bool empty( void ) const {
+    return this->points.empty();
+  }
+
+ protected:
+
+  struct kd_point {
+    float    p[3];
+    uint32_t owner;    // Index into owners
+    uint32_t vertex;
+  };
+
+  struct kd_owner {
+    uint32_t object, group;
+  };
+
+  // As the BVH's: the box, then either the first of two children side by
+  // side (count 0) or the first of count points
+  struct kd_node {
+    float    min[3];
+    uint32_t first;
+    float    max[3];
+    uint32_t count;
+  };
+
+  std::vector <kd_point> points;   // In leaf order
+  std::vector <kd_node>  nodes;    // nodes[0] is the root
+  std::vector <kd_owner> owners;   // Which group each point came from
+
+  vertex_hit hitFor( uint64_t i, float distance ) const;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef __LOD_H
+#define __LOD_H 1
+
+#include <bounds.h>
+#include <cmath>
+#include <stdint.h>
+
+#include <gl.h>
+
+/*
+ *  lod.h : Levels of detail. A group can keep coarser versions of
+ *          itself (made by simplify.h), each just another triangle list
+ *          over the same vertices, along with how far its surface may
+ *          have moved from the full one. A lod_view made from the
+ *          current GL matrices and viewport tells draw() how many pixels
+ *          that distance comes to on screen for an object, so each
+ *          group is drawn at the coarsest level that still looks the same
+ */
+
+struct lod_level {
+  uint64_t first;    // Where its indices start in the group's level index array
+  uint64_t count;    // ... and how many (three a triangle)
+  float    error;    // How far from the full surface, in the model's units
+};
+
+struct lod_view {
+  float modelview[16];
+  float scale;          // Longest axis of the modelview, as a length in the model comes out in eye space
+  float pixels;         // Pixels a unit of eye space covers at depth 1 (anywhere, without perspective)
+  bool  perspective;
+  float threshold;      // Most a level's error may look, in pixels
+
+  lod_view( void ) {
+    for ( uint i=0; i<16; i++ )
+      modelview[i] = ( i%5 ) ? 0.0f : 1.0f;
+    scale = pixels = 1.0f;
+    perspective = false;
+    threshold = 1.0f;
+  }
+
+  // From the matrices and viewport current in GL
+  void fromGL( float threshold=1.0f ) {
+    float p[16];
+    GLint viewport[4];
+    glGetFloatv( GL_PROJECTION_MATRIX, p );
+    glGetFloatv( GL_MODELVIEW_MATRIX, this->modelview );
+    glGetIntegerv( GL_VIEWPORT, viewport );
+    set( p, viewport[2], viewport[3], threshold );
+    return;
+  }
+
+  // From a projection matrix (column major, as GL keeps it) and the
+  // viewport's size, with the modelview already in place
+  void set( const float *projection, int width, int height, float threshold=1.0f ) {
+    const float *m = this->modelview;
+    this->scale = 0.0f;
+    for ( uint c=0; c<3; c++ )
+      this->scale = fmaxf( this->scale, sqrtf( m[4*c]*m[4*c] + m[4*c+1]*m[4*c+1] + m[4*c+2]*m[4*c+2] ) );
+
+    this->pixels = fmaxf( fabsf( projection[0] ) * 0.5f * width, fabsf( projection[5] ) * 0.5f * height );
+    this->perspective = projection[11] != 0.0f;
+    this->threshold = threshold;
+    return;
+  }
+
+  // The most pixels a unit of length in the model covers anywhere in b:
+  // at the near side of its sphere, or everywhere the same without
+  // perspective. Infinite once the eye is that close (draw everything)
+  float pixelsPerUnit( const bounds &b ) const {
+
+    if ( b.empty )
+      return INFINITY;
+    if ( !this->perspective )
+      return this->scale * this->pixels;
+
+    const float *m = this->modelview;
+    float z = m[2]*b.center.x + m[6]*b.center.y + m[10]*b.center.z + m[14];
+    float depth = -z - this->scale * b.radius;
+    if ( depth <= 0.0f )
+      return INFINITY;
+    return this->scale * this->pixels / depth;
+  }
+};
+
+#endif
@@ -2,10 +2,11 @@
 #define __MATERIAL_H 1
 
 #include <string>
+#include <vector>
 #include <iostream>
 #include <gl.h>
-#include <Magick++.h> 
-using namespace Magick; 
+#include <image.h>
+#include <mipmap.h>
 
 /*
  *  material.h : Defines a structure for holding information on materials
@@ -25,6 +26,7 @@ class material {
   }
 
   void flush( void ) {
+    this->id              = -1;
     this->name            = "";
     this->Ns              = 0.0f;
     this->Ni              = 0.0f;
@@ -34,6 +36,7 @@ class material {
     this->diffuseTexture  = "";
     this->ambientTexture  = "";
     this->specularTexture = "";
+    this->textureFile     = "";
 
     for ( uint i=0; i<4; i++ ) 
       this->Ka[i] = this->Kd[i] = this->Ks[i] = 0.0f;
@@ -41,6 +44,7 @@ class material {
   }
 
   inline material & operator = (const material &rhs) {
+    (*this).id              = rhs.id;
     (*this).name            = rhs.name;
     (*this).Ns              = rhs.Ns;
     (*this).Ni              = rhs.Ni;
@@ -50,6 +54,7 @@ class material {
     (*this).diffuseTexture  = rhs.diffuseTexture;
     (*this).ambientTexture  = rhs.ambientTexture;
     (*this).specularTexture = rhs.specularTexture;
+    (*this).textureFile     = rhs.textureFile;
     for ( uint i=0; i<4; i++ ) {
       (*this).Ka[i] = rhs.Ka[i];
       (*this).Kd[i] = rhs.Kd[i];
@@ -59,6 +64,7 @@ class material {
   };
 
   void setName  ( std::string n ) {this->name = n;}
+  void setID    ( int i )         {this->id = i;}
   void setNs    ( float Ns )      {this->Ns = Ns;}
   void setNi    ( float Ni )      {this->Ni = Ni;}
   void setIllum ( int illum )     {this->illum = illum;}
@@ -81,45 +87,75 @@ class material {
       this->Ks[i] = ks[i];
   }
 
-  void setDiffuseTexture( std::string textureFile ) {
+  // Setting a texture normally decodes and uploads it right away. Pass
+  // upload=false to just note the file, for when there's no GL context
+  // yet... the texture can be loaded later with loadTexture()
+  void setDiffuseTexture( std::string textureFile, bool upload=true ) {
     this->textureID = 0;
     this->diffuseTexture = textureFile;
+    this->textureFile = textureFile;
+    if ( !upload )
+      return;
     this->textureID = getImageData(textureFile);
     std::cout << "Image " << textureFile << " bound to diffuse texture " << textureID 
 	      << " for material " << this->name << "\n";
     return;
   }
-  void setAmbientTexture( std::string textureFile ) {
+  void setAmbientTexture( std::string textureFile, bool upload=true ) {
     this->textureID = 0;
     this->ambientTexture = textureFile;
+    this->textureFile = textureFile;
+    if ( !upload )
+      return;
     textureID = getImageData(textureFile);
     std::cout << "Image " << textureFile << " bound to ambient texture " << textureID 
 	      << " for material " << this->name << "\n";
     return;
   }
-  void setSpecularTexture( std::string textureFile ) {
+  void setSpecularTexture( std::string textureFile, bool upload=true ) {
     this->textureID = 0;
     this->specularTexture = textureFile;
+    this->textureFile = textureFile;
+    if ( !upload )
+      return;
     textureID = getImageData(textureFile);
     std::cout << "Image " << textureFile << " bound to specular texture " << textureID 
 	      << " for material " << this->name << "\n";
     return;
   }
 
-  float  getNs                   (void)    {return this->Ns;}
-  float  getNi                   (void)    {return this->Ni;}
-  float  getD                    (void)    {return this->d;}
-  float  getIllum                (void)    {return this->illum;}
-  float *getKa                   (void)    {return this->Ka;}
-  float *getKd                   (void)    {return this->Kd;}
-  float *getKs                   (void)    {return this->Ks;}
-  uint   getTextureID            (void)    {return this->textureID;}
-  std::string getName            (void)    {return this->name;}
-  std::string getDiffuseTexture  (void)    {return this->diffuseTexture;}
-  std::string getAmbientTexture  (void)    {return this->ambientTexture;}
-  std::string getSpecularTexture (void)    {return this->specularTexture;}
+  // Upload an image that was decoded elsewhere (see decodeImage) as this material's texture
+  void loadTexture( const unsigned char *rgba, uint w, uint h ) {
+    this->textureID = uploadImage( rgba, w, h );
+    std::cout << "Image " << this->textureFile << " bound to texture " << textureID 
+	      << " for material " << this->name << "\n";
+    return;
+  }
+
+  void setTextureID( uint id ) {
+    this->textureID = id;
+  }
+
+  float  getNs                   (void) const {return this->Ns;}
+  float  getNi                   (void) const {return this->Ni;}
+  float  getD                    (void) const {return this->d;}
+  float  getIllum                (void) const {return this->illum;}
+  float *getKa                   (void)       {return this->Ka;}
+  float *getKd                   (void)       {return this->Kd;}
+  float *getKs                   (void)       {return this->Ks;}
+  const float *getKa             (void) const {return this->Ka;}
+  const float *getKd             (void) const {return this->Kd;}
+  const float *getKs             (void) const {return this->Ks;}
+  uint   getTextureID            (void) const {return this->textureID;}
+  int    getID                   (void) const {return this->id;}
+  const std::string & getName            (void) const {return this->name;}
+  const std::string & getDiffuseTexture  (void) const {return this->diffuseTexture;}
+  const std::string & getAmbientTexture  (void) const {return this->ambientTexture;}
+  const std::string & getSpecularTexture (void) const {return this->specularTexture;}
+  const std::string & getTextureFile     (void) const {return this->textureFile;}
 
  protected:
+  int   id;          // Index in the owning model's material list (-1 if it isn't in one)
   std::string name;  // From the newmtl line
   float Ns;          // Specular exponent (shininess)
   float Ka[4];       // Ambient  RGB color
@@ -132,62 +168,69 @@ class material {
   std::string diffuseTexture;  // Diffuse  texture image : map_Kd in mtl file
   std::string ambientTexture;  // Ambient  texture image : map_Ka in mtl file
   std::string specularTexture; // Specular texture image : map_Ks in mtl file
+  std::string textureFile;     // Whichever of those was set last... the one that gets bound
 
   uint textureID;
 
   unsigned int getImageData( std::string textureName ) {
 
-    InitializeMagick("");
+    mip_chain chain;
+    if ( !decodeImage( textureName, chain ) )
+      return 0;
+
+    return uploadImage( chain );
+  }
+
+ public:
 
-    // Construct the image object (on the stack). Seperating image
-    // construction from the read operation ensures that a failure
-    // to read the image file doesn't render the image object useless. 
-    Image image;
-    Blob blob;
+  // Read an image file into RGBA pixels. Doesn't touch GL, so this can
+  // be done on any thread (several at once, see texture.h)
+  static bool decodeImage( std::string textureName, std::vector <unsigned char> &rgba, uint &w, uint &h ) {
 
     std::cout << "Loading texture from " << textureName << "\n";
+    return decodeImageFile( textureName, rgba, w, h );
+  }
 
-    try { 
-      // Read a file into image object 
-      image.read( textureName );
+  // ... or straight into a mip chain, kept on disk next to the image
+  // (as <image>.mips) if useDisk is set
+  static bool decodeImage( std::string textureName, mip_chain &chain, bool useDisk=false ) {
 
-      // Set the write format as JPEG
-      image.magick( "JPEG" );
+    std::cout << "Loading texture from " << textureName << "\n";
+    return loadMipChain( textureName, chain, useDisk );
+  }
 
-      // And write it to a blob
-      image.write( &blob, "RGBA" );
+  // Hand RGBA pixels to GL as a new (mipmapped) texture. Needs a current GL context
+  static unsigned int uploadImage( const unsigned char *rgba, uint w, uint h ) {
 
-      uint w = image.columns();
-      uint h = image.rows();
-      uint texID;
+    mip_chain chain;
+    buildMipChain( rgba, w, h, chain );
+    return uploadImage( chain );
+  }
 
-      // Create a new OpenGL texture...
-      glGenTextures(1, &texID);
+  static unsigned int uploadImage( const mip_chain &chain ) {
 
-      // Bind the new texture to a GL_TEXTURE_2D... Future texture functions will modify this texture
-      glBindTexture(GL_TEXTURE_2D, texID);
+    uint texID;
 
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // Create a new OpenGL texture...
+    glGenTextures(1, &texID);
 
-      // Load the image data
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, blob.data());
+    // Bind the new texture to a GL_TEXTURE_2D... Future texture functions will modify this texture
+    glBindTexture(GL_TEXTURE_2D, texID);
 
-      // Return the blob
-      return texID;
-    }
-    catch( Exception &error ) { 
-      std::cout << "Caught exception: " << error.what() << std::endl;
-      return 0;
-    } 
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, chain.levels()-1);
 
-    return 0;
+    // Load the image data, one level at a time
+    for ( uint i=0; i<chain.levels(); i++ )
+      glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, chain.widths[i], chain.heights[i], 0, GL_RGBA, GL_UNSIGNED_BYTE, chain.level(i));
 
+    // Return the texture
+    return texID;
   }
 
-
 };
 
 #endif
@@ -0,0 +1,202 @@
+#include <mipmap.h>
+#include <image.h>
+#include <reader.h>
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdint.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/*
+ * mipmap.cpp : Building mip chains, and keeping them on disk.
+ *
+ *  .mips layout (native byte order, checked with the order mark):
+ *    magic "MIPS", version, order mark, the source image's size and
+ *    modification time (seconds, nanoseconds), width and height of
+ *    level 0, number of levels, then the levels' pixels, largest first
+ */
+
+#define MIPS_MAGIC   0x5350494D    // "MIPS"
+#define MIPS_VERSION 1
+#define MIPS_ORDER   0x01020304
+
+struct mips_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t order;
+  uint32_t levels;
+  uint64_t sourceSize;
+  int64_t  sourceSeconds;
+  int64_t  sourceNanoseconds;
+  uint32_t width;
+  uint32_t height;
+};
+
+// Halve one level into the next, rows shared out across the cores. An odd
+// width or height loses its last column or row (a side of 1 stays 1)
+static void halve( const unsigned char *src, uint sw, uint sh, unsigned char *dst, uint dw, uint dh ) {
+
+  #pragma omp parallel for schedule(static) if ( (uint64_t)dw * dh > 65536 )
+  for ( uint y=0; y<dh; y++ ) {
+    const unsigned char *r0 = src + (size_t)(2*y) * sw * 4;
+    const unsigned char *r1 = src + (size_t)( (2*y+1 < sh) ? 2*y+1 : 2*y ) * sw * 4;
+    unsigned char *out = dst + (size_t)y * dw * 4;
+
+    for ( uint x=0; x<dw; x++ ) {
+      uint x0 = 2*x * 4, x1 = ( (2*x+1 < sw) ? 2*x+1 : 2*x ) * 4;
+      for ( uint c=0; c<4; c++ )
+	out[4*x+c] = ( r0[x0+c] + r0[x1+c] + r1[x0+c] + r1[x1+c] + 2 ) >> 2;
+    }
+  }
+  return;
+}
+
+// Fill in the sizes and offsets of every level, down to 1x1. Returns the
+// total size in bytes
+static size_t layout( uint w, uint h, mip_chain &chain ) {
+
+  chain.clear();
+
+  size_t total = 0;
+  for ( uint lw=w, lh=h; ; lw = (lw > 1) ? lw/2 : 1, lh = (lh > 1) ? lh/2 : 1 ) {
+    chain.offsets.push_back( total );
+    chain.widths.push_back( lw );
+    chain.heights.push_back( lh );
+    total += (size_t)lw * lh * 4;
+    if ( lw == 1 && lh == 1 )
+      break;
+  }
+  return total;
+}
+
+void buildMipChain( const unsigned char *rgba, uint w, uint h, mip_chain &chain ) {
+
+  // Lay out the levels first so the buffer is only allocated once
+  chain.pixels.resize( layout( w, h, chain ) );
+  memcpy( chain.pixels.data(), rgba, (size_t)w * h * 4 );
+
+  for ( uint i=1; i<chain.levels(); i++ )
+    halve( chain.level(i-1), chain.widths[i-1], chain.heights[i-1],
+	   chain.pixels.data() + chain.offsets[i], chain.widths[i], chain.heights[i] );
+
+  return;
+}
+
+static bool sourceStats( const string &file, struct stat &st ) {
+  return stat( file.c_str(), &st ) == 0;
+}
+
+static void sourceTime( const struct stat &st, int64_t &s, int64_t &ns ) {
+#ifdef __DARWIN__
+  s  = st.st_mtimespec.tv_sec;
+  ns = st.st_mtimespec.tv_nsec;
+#else
+  s  = st.st_mtim.tv_sec;
+  ns = st.st_mtim.tv_nsec;
+#endif
+  return;
+}
+
+bool readMipCache( string file, mip_chain &chain ) {
+
+  struct stat st;
+  if ( !sourceStats( file, st ) )
+    return false;
+
+  reader in( file + ".mips" );
+  if ( !in.isOpen() || in.getSize() < sizeof(mips_header) )
+    return false;
+
+  mips_header hdr;
+  memcpy( &hdr, in.getData(), sizeof(hdr) );
+
+  // Only good for exactly the image it was made from
+  int64_t s, ns;
+  sourceTime( st, s, ns );
+  if ( hdr.magic != MIPS_MAGIC || hdr.version != MIPS_VERSION || hdr.order != MIPS_ORDER ||
+       hdr.sourceSize != (uint64_t)st.st_size || hdr.sourceSeconds != s || hdr.sourceNanoseconds != ns ||
+       !hdr.width || !hdr.height || hdr.width > (1 << 16) || hdr.height > (1 << 16) )
+    return false;
+
+  // Work the layout out again rather than trusting the file for it
+  size_t total = layout( hdr.width, hdr.height, chain );
+
+  if ( chain.levels() != hdr.levels || in.getSize() != sizeof(hdr) + total ) {
+    chain.clear();
+    return false;
+  }
+
+  const unsigned char *data = (const unsigned char *)in.getData() + sizeof(hdr);
+  chain.pixels.assign( data, data + total );
+  return true;
+}
+
+bool writeMipCache( string file, const mip_chain &chain ) {
+
+  struct stat st;
+  if ( !chain.levels() || !sourceStats( file, st ) )
+    return false;
+
+  mips_header hdr;
+  memset( &hdr, 0, sizeof(hdr) );
+  hdr.magic      = MIPS_MAGIC;
+  hdr.version    = MIPS_VERSION;
+  hdr.order      = MIPS_ORDER;
+  hdr.levels     = chain.levels();
+  hdr.sourceSize = st.st_size;
+  hdr.width      = chain.widths[0];
+  hdr.height     = chain.heights[0];
+  sourceTime( st, hdr.sourceSeconds, hdr.sourceNanoseconds );
+
+  // Write to the side and move it into place, as the model cache does
+  string cache = file + ".mips", tmp = cache + ".tmp";
+  FILE *fp = fopen( tmp.c_str(), "wb" );
+  if ( !fp ) {
+    perror( tmp.c_str() );
+    return false;
+  }
+
+  bool ok = fwrite( &hdr, sizeof(hdr), 1, fp ) == 1 &&
+	    fwrite( chain.pixels.data(), 1, chain.pixels.size(), fp ) == chain.pixels.size();
+  ok = ( fclose( fp ) == 0 ) && ok;
+
+  if ( !ok || rename( tmp.c_str(), cache.c_str() ) ) {
+    perror( cache.c_str() );
+    remove( tmp.c_str() );
+    return false;
+  }
+  return true;
+}
+
+bool loadMipChain( string file, mip_chain &chain, bool useDisk ) {
+
+  vector <unsigned char> rgba;
+  uint w, h;
+
+  // The chain is another third again on top of the decoded image, and
+  // this runs on the texture threads, so running out of room just fails
+  try {
+    if ( useDisk && readMipCache( file, chain ) )
+      return true;
+
+    if ( !decodeImageFile( file, rgba, w, h ) )
+      return false;
+
+    buildMipChain( rgba.data(), w, h, chain );
+  }
+  catch( std::bad_alloc &error ) {
+    chain.clear();
+    vector <unsigned char>().swap( rgba );
+    cout << file << " is too big to decode\n";
+    return false;
+  }
+
+  if ( useDisk )
+    writeMipCache( file, chain );
+
+  return true;
+}
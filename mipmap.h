@@ -0,0 +1,50 @@
+#ifndef __MIPMAP_H
+#define __MIPMAP_H 1
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ *  mipmap.h : A texture's full mip chain, from the image itself down to
+ *             1x1, every level RGBA at 8 bits a channel, all in one
+ *             buffer. Each level is a 2x2 box filter of the one above.
+ *             Chains can be kept on disk next to their image (as
+ *             <image>.mips) so later runs skip the decode altogether
+ */
+
+struct mip_chain {
+  std::vector <unsigned char> pixels;    // every level, largest first
+  std::vector <size_t>        offsets;   // where each level starts in pixels
+  std::vector <uint>          widths;
+  std::vector <uint>          heights;
+
+  uint levels( void ) const {
+    return offsets.size();
+  }
+
+  const unsigned char * level( uint i ) const {
+    return pixels.data() + offsets[i];
+  }
+
+  void clear( void ) {
+    std::vector<unsigned char>().swap( pixels );
+    offsets.clear();
+    widths.clear();
+    heights.clear();
+  }
+};
+
+// Build the whole chain from a w x h RGBA image
+void buildMipChain( const unsigned char *rgba, uint w, uint h, mip_chain &chain );
+
+// The chain for an image file: from <file>.mips if that's up to date with
+// the file (and useDisk is set), otherwise decoded and built, and then
+// written out to <file>.mips if useDisk is set. Safe on several threads at once
+bool loadMipChain( std::string file, mip_chain &chain, bool useDisk=true );
+
+bool readMipCache ( std::string file, mip_chain &chain );
+bool writeMipCache( std::string file, const mip_chain &chain );
+
+#endif
@@ -1,7 +1,15 @@
 #include <model.h>
 
+#include <reader.h>
+#include <triangulate.h>
+#include <normals.h>
+#include <tangents.h>
+#include <simplify.h>
+
 #include <iostream>
-#include <fstream>
+#include <cstdlib>
+#include <omp.h>
+#include <sys/resource.h>
 
 using namespace std;
 
@@ -22,8 +30,7 @@ ostream & operator << (ostream & os, model &m ) {
 
   os << "Model loaded " << m.objects.size() << " objects from " << m.objFile << " with materials in " << m.mtlFile << "\n";
   for ( uint i=0; i<m.objects.size(); i++ ) {
-    object o = m.objects[i];
-    os << o << "\n";
+    os << m.objects[i] << "\n";
   }
   return os;
 }
@@ -39,7 +46,7 @@ ostream & operator << (ostream &os, object &o) {
 
 ostream & operator << (ostream &os, group &g) {
 
-  os << "    Group " << g.ID << " has " << g.faces.size() << " faces using material " 
+  os << "    Group " << g.ID << " has " << g.faceStart.size() << " faces using material " 
      << g.mat.getName() << " with shading " << g.shading << "\n";
   
   /*for ( uint i=0; i<g.faces.size(); i++ ) {
@@ -59,7 +66,7 @@ ostream & operator << (ostream &os, group &g) {
 
 ostream & operator << (ostream &os, face &f) {
 
-  for ( uint i=0; i<f.vertices.size(); i++ ) {
+  for ( uint i=0; i<f.count; i++ ) {
     cout << "\t  vertex " << i;
     if ( f.vertices[i].hasNormals() )
       os << " has a normal ";
@@ -83,9 +90,17 @@ ostream & operator << (ostream &os, vec &v) {
   return os;
 }
 
-model::model(string objFile, string mtlFile) {
+model::model(string objFile, string mtlFile, load_options options) {
+
+  this->options = options;
+
+  // Caching the model caches its textures' mip chains too
+  this->textures.setDiskCache( this->options.useCache );
 
   this->NumberOfVertices = this->NumberOfTextures = this->NumberOfNormals = 0;
+  this->NumberOfFaces = this->NumberOfObjects = this->NumberOfGroups = 0;
+  this->materialsLoaded = false;
+  this->loaded = false;
 
   this->objFile = objFile;
   if ( mtlFile == "" ) {
@@ -94,19 +109,36 @@ model::model(string objFile, string mtlFile) {
   } else
     this->mtlFile = mtlFile;
 
-  if ( ! this->parseModel() ) {
-    cout << "Error parsing " << objFile << "\n";
-    return;
-  }
-
   if ( this->debug )
     cout << this->objFile << ", " << this->mtlFile << "\n";
 
-  if ( ! this->loadMaterials() )
-    cout << "No materials associated with model\n";
+  // A single pass over the file... materials are pulled in as soon
+  // as the mtllib (or the first usemtl) line turns up
+  bool caching = this->options.useCache && !this->options.streaming();
+
+  // Skip the text entirely if there's an up to date binary copy
+  if ( caching && this->loadCache() )
+    this->loaded = true;
 
-  if ( ! this->loadModel() )
-    cout << "Failed to load model from " << this->objFile << "\n";
+  else {
+    this->loaded = this->loadModel();
+    if ( ! this->loaded )
+      cout << "Failed to load model from " << this->objFile << "\n";
+    else if ( caching )
+      this->saveCache();
+  }
+
+  // The textures have been decoding all along... make them into GL
+  // textures now (and the arrays into buffers, if asked), unless that's
+  // been left for finalize()
+  if ( this->loaded && !this->options.deferGL ) {
+    this->bindTextures();
+    if ( this->options.buffers )
+      this->uploadBuffers();
+  }
+
+  if ( this->options.progress )
+    this->options.progress->done = true;
 
   ic = {0.0f,0.0f,0.0f,0.0f,0.0f,1.0f};
   listNum = 0;
@@ -122,6 +154,24 @@ model::~model(void) {
 
 void model::draw(void) {
 
+  frustum view;
+  if ( this->options.cull )
+    view.fromGL();
+
+  if ( this->options.lods && this->options.lodPixels > 0.0f ) {
+    lod_view detail;
+    detail.fromGL( this->options.lodPixels );
+    for(std::vector<object>::iterator it=objects.begin(); it != objects.end(); it++ )
+      it->draw( detail, this->options.cull ? &view : 0x0 );
+    return;
+  }
+
+  if ( this->options.cull ) {
+    for(std::vector<object>::iterator it=objects.begin(); it != objects.end(); it++ )
+      it->draw( view );
+    return;
+  }
+
   for(std::vector<object>::iterator it=objects.begin(); it != objects.end(); it++ ) {
     it->draw();
   }
@@ -131,7 +181,8 @@ void model::draw(void) {
 void model::makeList(void) {
   listNum = glGenLists (1);
   glNewList( listNum, GL_COMPILE );
-    draw();
+  for(std::vector<object>::iterator it=objects.begin(); it != objects.end(); it++ )
+    it->draw();
   glEndList();
   return;
 }
@@ -143,388 +194,853 @@ void model::setAlpha( float alpha ) {
   return;
 }
 
+// The kinds of records loadModel() cares about
+enum {
+  REC_NONE = 0,      // blank lines, comments and anything we don't handle
+  REC_VERTEX,        // v
+  REC_TEXTURE,       // vt
+  REC_NORMAL,        // vn
+  REC_FACE,          // f
+  REC_OBJECT,        // o
+  REC_SHADING,       // s
+  REC_MATERIAL,      // usemtl
+  REC_LIBRARY        // mtllib
+};
+
+// Work out what kind of record a line holds, and strip the keyword off it
+static int recordType( token &line ) {
+  token key;
+
+  // The first word on the line says what kind of record it is
+  if ( !line.nextWord( key ) || key[0] == '#' )   // Blank or comment
+    return REC_NONE;
+
+  switch ( key[0] ) {
+  case 'v':
+    if ( key.len == 1 )     return REC_VERTEX;
+    if ( key.equals("vt") ) return REC_TEXTURE;
+    if ( key.equals("vn") ) return REC_NORMAL;
+    break;
+  case 'f':
+    if ( key.len == 1 )     return REC_FACE;
+    break;
+  case 'o':
+    if ( key.len == 1 )     return REC_OBJECT;
+    break;
+  case 's':
+    if ( key.len == 1 )     return REC_SHADING;
+    break;
+  case 'u':
+    if ( key.equals("usemtl") ) return REC_MATERIAL;
+    break;
+  case 'm':
+    if ( key.equals("mtllib") ) return REC_LIBRARY;
+    break;
+  }
+  return REC_NONE;
+}
+
 bool model::loadModel( void ) {
 
   // Open the object file, if the open fails, bail now and yell about it
-  ifstream objectFile (this->objFile.c_str());	
-  if ( !objectFile.is_open() ) {
+  reader objectFile( this->objFile );
+  if ( !objectFile.isOpen() ) {
     perror(this->objFile.c_str());
     return false;
   }
 
-  string line;
-  material currentMaterial;
-  object   currentObject;
-  group  * currentGroup = 0x0;
-  uint shading=0;
+  load_state state( this->options.pools );
+
+  if ( this->options.progress )
+    this->options.progress->bytesTotal = objectFile.getSize();
 
   if ( this->debug )
     cout << "\nLoading model from " << this->objFile << "\n";
 
-  // OBJ files start numbering vertices from 1, not from 0 as C arrays
-  // So make the arrays 1 bigger than otherwise, and start counting from 1
-  // instead of 0 to adjust the vertex we're grabbing to the OBJ numbering
-  uint vertices=1, texcoords=1, normals=1;
-  vec V[this->NumberOfVertices+1];  // object vertices
-  vec N[this->NumberOfNormals+1];   // vertex normals
-  vec T[this->NumberOfTextures+1];  // texture coordinates
+  // A parallel load has to hold the whole file's worth of records,
+  // which is exactly what streaming is trying to avoid
+  if ( this->options.parallel && !this->options.streaming() )
+    this->loadParallel( state, objectFile );
+  else
+    this->loadSerial( state, objectFile );
 
-  // If there's no objects defined in the obj file, make a default
-  if ( !this->NumberOfObjects ) {
-    // Set a default name
-    currentObject.setName( "Object001" );
+  objectFile.close();
+
+  if ( this->options.progress && this->options.progress->cancel ) {
+    cout << "Loading " << this->objFile << " cancelled\n";
+    return false;
   }
 
-  // Read in the file line-by-line and push the information to the right place
-  while ( !objectFile.eof() ) {
+  // The counts are a by-product of the load now
+  this->NumberOfVertices  = state.V.size()-1;
+  this->NumberOfTextures  = state.T.size()-1;
+  this->NumberOfNormals   = state.N.size()-1;
+  this->NumberOfFaces     = state.faces;
+  this->NumberOfObjects   = state.objects;
 
-    getline( objectFile, line );
-    char c1 = line.c_str()[0], c2 = line.c_str()[1];
+  if ( this->debug )
+    cout << "Loaded " << this->NumberOfVertices << " vertices, " << this->NumberOfNormals << " normals, " 
+	 << this->NumberOfTextures << " texture coordinates, " << state.faces << " faces and " 
+	 << state.objects << " objects\n";
 
-    if ( c1 == '#' )                              // Comment
-      continue;
+  // If nothing asked for the materials along the way, try the default file
+  if ( !this->materialsLoaded && !this->loadMaterials() )
+    cout << "No materials associated with model\n";
 
-    else if ( c1 == 'o' && c2 == 32 ) {           // New object
+  // Finalize the last object in the model
+  this->finishObject( state );
 
-      // If this is a new object, store the current object (if it exists) ...
-      if ( currentObject.getName() != "" ) {
-	currentObject.purgeGroups();
-	this->objects.push_back(currentObject);
-      }
+  if ( !state.objects ) 
+    cout << "No objects defined in " << this->objFile << "\n";
 
-      // Clear out the current object
-      currentObject.flush();
+  // If we don't have the minimum we need 
+  // build a model, complain about it
+  if ( !this->NumberOfVertices || !state.faces ) {
+    cout << "Error parsing " << this->objFile << "\n";
+    return false;
+  }
 
-      // And store the new name (other attributes will get stored as they're read in from the file)
-      currentObject.setName( line.substr(2, line.length()-2) );
+  /*
+  for ( uint i=0; i<this->objects.size(); i++ ) {
+    vector<group> g = this->objects[i].getGroupVec();
 
-    } // End else if (c1 == 'o' && c2 == 32 )
-    
-    else if ( c1 == 'f' && c2 == 32 ) {           // New face
+    for ( uint j=0; j<g.size(); j++ ) {
+      g[j].checkConsistancy();
+    }
+  } 
+  */
+  return true;
+}
 
-      uint type = 0;
-      // Figure out if we're loading triangles or quads by 
-      // counting the number of spaces in this "f" -- face line
-      for ( uint i=0; i<line.length(); i++ ) {
-	char c = line.c_str()[i];
-	if ( c == 32 )
-	  type++;
-      }
+// Read the file line-by-line and push the information to the right place
+void model::loadSerial( load_state &state, reader &objectFile ) {
 
-      if ( type != LINES && type != TRIANGLES && type != QUADS ) {
-	cout << line << "\n";
-	cout << "Unknown face type " << type << " not attempting to process\n";
-	continue;
-      }
+  token line;
+  vector <int64_t> idx;
+  bool  good;
+  size_t lines = 0, records = 0, reported = 0;
 
-      // Using the type and the number of normals/texture coordinates there are in the file
-      // figure out what the format string for sscanf has to look like
-      string baseForm, format;
-      if ( this->NumberOfNormals == 0 && this->NumberOfTextures == 0 )
-	baseForm = "%i";
-      else if ( this->NumberOfNormals > 0 && this->NumberOfTextures  == 0 )
-	baseForm = "%i//%i";
-      else if ( this->NumberOfNormals == 0 && this->NumberOfTextures > 0 )
-	baseForm = "%i/%i";
-      else
-	baseForm = "%i/%i/%i";
+  while ( objectFile.getLine( line ) ) {
 
-      // Make the format string
-      for (uint i=0; i<type; i++ )
-	format += baseForm + " ";
+    // Every so often let anyone watching know how far along we are
+    if ( ++lines % 4096 == 0 ) {
+      if ( !this->reportProgress( objectFile.getPosition() - reported, records ) )
+	return;
+      reported = objectFile.getPosition();
+      records  = 0;
+    }
 
-      face *f = new face(type);
+    token record = line;
+    int   kind   = recordType( line );
 
-      uint v[type], n[type], t[type];
-      line = line.substr(2, line.length()-2);
+    if ( kind != REC_NONE )
+      records++;
 
-      if ( this->NumberOfNormals == 0 && this->NumberOfTextures == 0 ) {     // Only object vertices
+    switch ( kind ) {
 
-	// Scan in the 2, 3, or 4 vertices corresponding to LINES, TRIANGLES, or QUADS
-	if ( type == LINES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &v[1] );
+    case REC_VERTEX:                               // A new vertex
+      state.V.push_back( parseVector(line) );
+      break;
 
-	else if ( type == TRIANGLES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &v[1], &v[2] );
+    case REC_TEXTURE:                              // A new texture coordinate
+      state.T.push_back( parseVector(line) );
+      break;
 
-	else if ( type == QUADS )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &v[1], &v[2], &v[3] );
+    case REC_NORMAL:                               // A new vertex normal
+      state.N.push_back( parseVector(line) );
+      break;
 
-	else
-	  cout << "Unknown type " << type << "\n";
+    case REC_FACE: {                               // New face
+      uint corners = parseFace( line, idx, good );
+      this->addFace( state, idx.data(), corners, good,
+		     state.V.size()-1, state.T.size()-1, state.N.size()-1, record );
+      break;
+    }
 
-	// Add this vertex to the current face
-	for ( uint i=0; i<type; i++ )
-	  f->addVertex( new vertex(V[v[i]]) );
+    case REC_OBJECT:                               // New object
+      this->beginObject( state, line );
 
-      } // End if ( this->NumberOfNormals == 0 && this->NumberOfTextures == 0 )
+      // When streaming, nothing before this point is needed any more
+      if ( this->options.streaming() )
+	objectFile.release();
+      break;
 
-      else if ( this->NumberOfNormals > 0 && this->NumberOfTextures == 0 ) { // Object vertices & normals
+    case REC_SHADING:                              // New shading model
+      this->setShading( state, line );
+      break;
 
-	// Scan in the 2, 3, or 4 vertices corresponding to LINES, TRIANGLES, or QUADS
-	if ( type == LINES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &n[0], &v[1], &n[1] );
+    case REC_MATERIAL:                             // Switch materials
+      this->useMaterial( state, line );
+      break;
 
-	else if ( type == TRIANGLES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &n[0], &v[1], &n[1], &v[2], &n[2] );
+    case REC_LIBRARY:                              // Name of the material libary file to use
+      this->useMaterialLibrary( state, line );
+      break;
+    }
 
-	else if ( type == QUADS )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &n[0], &v[1], &n[1], &v[2], &n[2], &v[3], &n[3] );
+  } // End while ( objectFile.getLine( line ) )
 
-	else
-	  cout << "Unknown type " << type << "\n";
+  this->reportProgress( objectFile.getPosition() - reported, records );
+  return;
+}
 
-	// Add this vertex to the current face
-	for ( uint i=0; i<type; i++ )
-	  f->addVertex( new vertex(V[v[i]], N[n[i]], type) );
+// Add to the running totals in the caller's load_progress (if there is one).
+// Returns false if the caller has asked for the load to be cancelled
+bool model::reportProgress( size_t bytes, size_t records ) {
 
-      } // End else if ( this->NumberOfNormals > 0 && this->NumberOfTextures == 0 )
-            
-      else if ( this->NumberOfNormals == 0 && this->NumberOfTextures > 0 ) { // Object vertices & texture coordinates
+  load_progress *p = this->options.progress;
+  if ( !p )
+    return true;
 
-	// Scan in the 2, 3, or 4 vertices corresponding to LINES, TRIANGLES, or QUADS
-	if ( type == LINES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &t[0], &v[1], &t[1] );
+  p->bytesRead += bytes;
+  p->records   += records;
+  return !p->cancel;
+}
 
-	else if ( type == TRIANGLES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &t[0], &v[1], &t[1], &v[2], &t[2] );
+/*
+ * One newline aligned piece of the .obj file for the parallel loader. The
+ * attributes are parsed straight into per-chunk lists, everything else is
+ * noted down in file order so it can be played back through exactly the same
+ * code the serial loader uses
+ */
+struct chunk {
+  const char *begin;
+  const char *end;
+
+  vector <vec> V, N, T;
+
+  struct entry {
+    int      kind;
+    uint     corners;    // REC_FACE: how many corners, ...
+    size_t   first;      //           where they start in 'idx' ...
+    uint64_t nv, nt, nn; //           and how many v/vt/vn this chunk had read by then
+    bool     good;
+    token    text;       // names, or the whole line for a face
+  };
+
+  vector <entry>   records;
+  vector <int64_t> idx;
+
+  void parse( load_progress *progress ) {
+    const char *p = begin, *reported = begin;
+    token line;
+    vector <int64_t> face;
+    size_t lines = 0, count = 0;
+
+    while ( p < end ) {
+
+      if ( progress && ++lines % 4096 == 0 ) {
+	progress->bytesRead += p - reported;
+	progress->records   += count;
+	reported = p;
+	count    = 0;
+	if ( progress->cancel )
+	  return;
+      }
 
-	else if ( type == QUADS )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &t[0], &v[1], &t[1], &v[2], &t[2], &v[3], &t[3] );
+      reader::nextLine( p, end, line );
+
+      token record = line;
+      int   kind   = recordType( line );
+
+      if ( kind != REC_NONE )
+	count++;
+
+      if ( kind == REC_VERTEX )
+	V.push_back( parseVector(line) );
+      else if ( kind == REC_TEXTURE )
+	T.push_back( parseVector(line) );
+      else if ( kind == REC_NORMAL )
+	N.push_back( parseVector(line) );
+      else if ( kind != REC_NONE ) {
+	entry e;
+	e.kind    = kind;
+	e.text    = ( kind == REC_FACE ) ? record : line;
+	e.corners = 0;
+	e.first   = idx.size();
+	e.nv = V.size(); e.nt = T.size(); e.nn = N.size();
+	e.good    = true;
+
+	if ( kind == REC_FACE ) {
+	  e.corners = parseFace( line, face, e.good );
+	  idx.insert( idx.end(), face.begin(), face.end() );
+	}
+	records.push_back( e );
+      }
+    }
 
-	else
-	  cout << "Unknown type " << type << "\n";
+    if ( progress ) {
+      progress->bytesRead += p - reported;
+      progress->records   += count;
+    }
+    return;
+  }
+};
+
+void model::loadParallel( load_state &state, reader &objectFile ) {
+
+  const char *data = objectFile.getData();
+  size_t      size = objectFile.getSize();
+
+  int threads = this->options.threads > 0 ? this->options.threads : omp_get_max_threads();
+
+  // A few chunks per thread to even out the load, but nothing silly small
+  size_t nchunks = threads * 4;
+  const size_t minChunk = 1 << 20;
+  if ( size / minChunk < nchunks )
+    nchunks = size / minChunk;
+  if ( nchunks < 1 )
+    nchunks = 1;
+
+  // Cut the file into pieces, moving each cut up to the next line
+  vector <chunk> chunks( nchunks );
+  const char *start = data, *stop = data + size;
+  for ( size_t i=0; i<nchunks; i++ ) {
+    const char *cut = ( i == nchunks-1 ) ? stop : data + (size * (i+1)) / nchunks;
+    if ( cut < start )
+      cut = start;
+    if ( cut < stop ) {
+      const char *nl = (const char *)memchr( cut, '\n', stop - cut );
+      cut = nl ? nl+1 : stop;
+    }
+    chunks[i].begin = start;
+    chunks[i].end   = cut;
+    start = cut;
+  }
 
-	// Add this vertex to the current face
-	vertex *vtx;
-	for ( uint i=0; i<type; i++ ) {
-	  vtx = new vertex( V[v[i]], type );
-	  vtx->setTextureCoordinates(T[t[i]]);
-	  f->addVertex(vtx );
-	}
-	delete vtx;
+  if ( this->debug )
+    cout << "Parsing " << this->objFile << " in " << nchunks << " chunks on " << threads << " threads\n";
+
+  // The mtllib line is normally near the top. Load the library now, so its
+  // textures decode during the parse as they would in the serial loader,
+  // instead of after it when the line is played back. Only as far as the
+  // first usemtl (which loads the default library if it comes first); a
+  // library named later than that, or past the first chunk, still waits
+  const char *early = 0x0;
+  for ( const char *p = chunks[0].begin; p < chunks[0].end; ) {
+    token line;
+    reader::nextLine( p, chunks[0].end, line );
+    int kind = recordType( line );
+    if ( kind == REC_MATERIAL )
+      break;
+    if ( kind == REC_LIBRARY ) {
+      early = line.ptr;
+      this->useMaterialLibrary( state, line );
+      break;
+    }
+  }
 
-      } // End else if ( this->NumberOfNormals == 0 && this->NumberOfTextures > 0 )
+#pragma omp parallel for schedule(dynamic,1) num_threads(threads)
+  for ( size_t i=0; i<nchunks; i++ )
+    chunks[i].parse( this->options.progress );
 
-      else {                                                                 // Object vertices, normals, & texture coordinates
+  if ( this->options.progress && this->options.progress->cancel )
+    return;
 
-	// Scan in the 2, 3, or 4 vertices corresponding to LINES, TRIANGLES, or QUADS
-	if ( type == LINES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &n[0], &t[0], &v[1], &n[1], &t[1] );
+  // Stitch the attribute lists back together in file order. Since the
+  // chunks are in order, OBJ's global 1-based numbering carries over
+  uint64_t nv = 0, nt = 0, nn = 0;
+  for ( size_t i=0; i<nchunks; i++ ) {
+    nv += chunks[i].V.size();
+    nt += chunks[i].T.size();
+    nn += chunks[i].N.size();
+  }
+  state.V.reserve( nv+1 );
+  state.T.reserve( nt+1 );
+  state.N.reserve( nn+1 );
+
+  // And play everything else back in order, exactly as the serial loader would
+  for ( size_t i=0; i<nchunks; i++ ) {
+    chunk &c = chunks[i];
+
+    uint64_t v0 = state.V.size()-1, t0 = state.T.size()-1, n0 = state.N.size()-1;
+    state.V.append( c.V.data(), c.V.size() );
+    state.T.append( c.T.data(), c.T.size() );
+    state.N.append( c.N.data(), c.N.size() );
+    vector<vec>().swap( c.V );
+    vector<vec>().swap( c.T );
+    vector<vec>().swap( c.N );
+
+    for ( size_t r=0; r<c.records.size(); r++ ) {
+      chunk::entry &e = c.records[r];
+
+      if ( r % 4096 == 0 && !this->reportProgress( 0, 0 ) )
+	return;
+
+      switch ( e.kind ) {
+      case REC_FACE:
+	this->addFace( state, c.idx.data() + e.first, e.corners, e.good,
+		       v0 + e.nv, t0 + e.nt, n0 + e.nn, e.text );
+	break;
+      case REC_OBJECT:
+	this->beginObject( state, e.text );
+	break;
+      case REC_SHADING:
+	this->setShading( state, e.text );
+	break;
+      case REC_MATERIAL:
+	this->useMaterial( state, e.text );
+	break;
+      case REC_LIBRARY:
+	if ( e.text.ptr != early )
+	  this->useMaterialLibrary( state, e.text );
+	break;
+      }
+    }
 
-	else if ( type == TRIANGLES )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &n[0], &t[0], &v[1], &n[1], &t[1], &v[2], &n[2], &t[2] );
+    vector<chunk::entry>().swap( c.records );
+    vector<int64_t>().swap( c.idx );
+  }
 
-	else if ( type == QUADS )
-	  sscanf( line.c_str(), format.c_str(), &v[0], &n[0], &t[0], &v[1], &n[1], &t[1], &v[2], &n[2], &t[2], &v[3], &n[3], &t[3] );
+  return;
+}
 
-	else
-	  cout << "Unknown type " << type << "\n";
+future <model *> model::loadAsync( string objFile, string mtlFile, load_options options ) {
 
-	// Add this vertex to the current face
-	for ( uint i=0; i<type; i++ )
-	  f->addVertex( new vertex(V[v[i]], N[n[i]], T[t[i]], type) );
+  // Nothing on the loader thread gets to touch GL
+  options.deferGL = true;
 
-      } // End else
+  return std::async( std::launch::async, [=]() -> model * {
+      model *m = new model( objFile, mtlFile, options );
 
-      // And add this face to the render group in the current object
-      if ( !currentGroup ) {
-	// If the current render group is undefined... create a new one and get a pointer to it
-	currentGroup = currentObject.addGroup( new group() );
+      if ( options.progress && options.progress->cancel ) {
+	delete m;
+	return 0x0;
       }
-      currentGroup->addFace(f);
+      return m;
+    } );
+}
 
-    } // End else if ( c1 == 'f' && c2 == 32 )
+void model::finalize( void ) {
+  this->bindTextures();
+  if ( this->options.buffers )
+    this->uploadBuffers();
+  return;
+}
 
-    else if ( c1 == 's' && c2 == 32 ) {           // New shading model
+void model::uploadBuffers( void ) {
 
-      if ( line.substr(2, 3) == "off" )
-	shading = 0;
-      else
-	shading = atoi( line.substr(2,1).c_str() );
+  uint groups = 0, uploaded = 0;
+  for ( uint i=0; i<this->objects.size(); i++ ) {
+    groups   += this->objects[i].getNumberOfGroups();
+    uploaded += this->objects[i].upload();
+  }
 
-      // Create a new render group if it doesn't already exist
-      if ( !currentObject.hasGroup( currentMaterial.getName(), shading ) )
-	currentGroup =	currentObject.addGroup( new group(currentMaterial, shading) );
-      else
-	currentGroup = currentObject.getGroup(currentMaterial.getName() + "_" + to_string(shading));
+  if ( groups && bufferSupport() == BUFFERS_NONE )
+    cout << "No GL buffer objects here, " << this->objFile << " is drawn from client arrays\n";
+  else if ( uploaded < groups )
+    cout << uploaded << " of " << groups << " groups of " << this->objFile << " in GL buffers\n";
 
-    } // End else if ( c1 == 's' && c2 == 32 )
+  return;
+}
 
-    else if ( line.substr(0,6) == "usemtl" ) {    // Switch materials
-      string name = line.substr(7, line.length()-7);
-      currentMaterial = this->getMaterialByName( name );
+void model::generateLODs( uint levels, float ratio ) {
 
-      // Create a new render group
-      if ( !currentObject.hasGroup( currentMaterial.getName(), shading ) ) 
-	currentGroup =	currentObject.addGroup( new group(currentMaterial, shading) );
-      else
-	currentGroup = currentObject.getGroup(currentMaterial.getName() + "_" + to_string(shading));
+  this->options.lods = levels;
+  this->options.lodRatio = ratio;
 
-    } // End else if ( line.substr(0,6) == "usemtl" )
+  for ( uint i=0; i<this->objects.size(); i++ ) {
+    object &o = this->objects[i];
+    ::generateLODs( o, levels, ratio );
+    for ( uint j=0; j<o.getNumberOfGroups(); j++ ) {
+      group *g = o.getGroup( j );
+      g->packIndices();
+      if ( g->isUploaded() )
+	g->upload();
+    }
+  }
+  return;
+}
 
-    else if ( c1 == 'v' && c2 == 32 ) {           // A new vertex
+void model::releaseBuffers( void ) {
+  for ( uint i=0; i<this->objects.size(); i++ )
+    this->objects[i].release();
+  return;
+}
 
-      if ( vertices <= this->NumberOfVertices ) {
-	vec v;
+void model::reportMemory( ostream &os ) {
 
-	line[0] = line[1] = ' ';
-	sscanf( line.c_str(), " %f %f %f", &v.x, &v.y, &v.z );
-	V[vertices++] = v;
+  uint64_t bytes = 0, triangles = 0;
 
-	if ( vertices > this->NumberOfVertices+1 )
-	  cout << "There's a problem with the number of vertices!\n";
+  for ( uint i=0; i<this->objects.size(); i++ ) {
+    object &o = this->objects[i];
+    for ( uint j=0; j<o.getNumberOfGroups(); j++ ) {
+      group *g = o.getGroup( j );
+      uint64_t b = g->getMemoryBytes(), t = g->getNumberOfTriangles();
+      os << o.getName() << "/" << g->getID() << ": " << t << " triangles, " << b << " bytes";
+      if ( t )
+	os << ", " << (double)b / t << " bytes per triangle";
+      os << "\n";
+      bytes += b;
+      triangles += t;
+    }
+  }
 
-      }
+  os << this->objFile << ": " << triangles << " triangles, " << bytes << " bytes";
+  if ( triangles )
+    os << ", " << (double)bytes / triangles << " bytes per triangle";
+  os << "\n";
+  return;
+}
 
-    } // End else if ( c1 == 'v' && c2 == 32 )
+const bvh & model::buildBVH( void ) {
+  std::lock_guard<std::mutex> hold( this->accelLock );
+  if ( !this->accel ) {
+    this->accel.reset( new bvh() );
+    this->accel->build( this->objects, this->options.threads );
+  }
+  return *this->accel;
+}
 
-    else if ( c1 == 'v' && c2 == 't' ) {          // A new texture coordinate
+void model::releaseBVH( void ) {
+  std::lock_guard<std::mutex> hold( this->accelLock );
+  this->accel.reset();
+  return;
+}
 
-      if ( texcoords <= this->NumberOfTextures ) {
+bool model::raycast( const ray &r, ray_hit &hit ) {
+  return buildBVH().raycast( r, hit );
+}
 
-	vec v;
+bool model::anyHit( const ray &r ) {
+  return buildBVH().anyHit( r );
+}
 
-	line[0] = line[1] = ' ';
+const kd_tree & model::buildVertexIndex( void ) {
+  std::lock_guard<std::mutex> hold( this->vertexLock );
+  if ( !this->vertexIndex ) {
+    this->vertexIndex.reset( new kd_tree() );
+    this->vertexIndex->build( this->objects, this->options.threads );
+  }
+  return *this->vertexIndex;
+}
 
-	sscanf( line.c_str(), " %f %f %f", &v.x, &v.y, &v.z );
-	T[texcoords++] = v;
+void model::releaseVertexIndex( void ) {
+  std::lock_guard<std::mutex> hold( this->vertexLock );
+  this->vertexIndex.reset();
+  return;
+}
 
-	if ( texcoords > this->NumberOfTextures+1 )
-	  cout << "There's a problem with the number of textures!\n";
+bool model::nearestVertex( const vec &p, vertex_hit &hit, float maxDistance ) {
+  return buildVertexIndex().nearest( p, hit, maxDistance );
+}
 
-      }
+void model::verticesWithin( const vec &p, float radius, vector <vertex_hit> &hits ) {
+  buildVertexIndex().within( p, radius, hits );
+  return;
+}
 
-    } // End else if ( c1 == 'v' && c2 == 't )
+bool model::closestPoint( const vec &p, ray_hit &hit, float maxDistance ) {
+  return buildBVH().closestPoint( p, hit, maxDistance );
+}
 
-    else if ( c1 == 'v' && c2 == 'n' ) {          // A new vertex normal
+void model::reportVertexCache( ostream &os ) {
 
-      if ( normals <= this->NumberOfNormals ) {
+  for ( uint i=0; i<this->objects.size(); i++ ) {
+    object &o = this->objects[i];
+    for ( uint j=0; j<o.getNumberOfGroups(); j++ ) {
+      group *g = o.getGroup( j );
+      cache_stats s = g->getCacheStats();
+      if ( s.acmr == 0.0f )
+	continue;
+      os << o.getName() << "/" << g->getID() << ": " << g->getNumberOfIndices()/3 << " triangles, "
+	 << g->getNumberOfVertices() << " vertices, ACMR " << s.acmr << ", ATVR " << s.atvr << "\n";
+    }
+  }
+  return;
+}
 
-	vec v;
+stream_stats model::stream( string objFile, object_callback onObject, string mtlFile, load_options options ) {
 
-	line[0] = line[1] = ' ';
+  if ( onObject )
+    options.onObject = onObject;
 
-	sscanf( line.c_str(), " %f %f %f", &v.x, &v.y, &v.z );
-	N[normals++] = v;
+  model m( objFile, mtlFile, options );
 
-	if ( normals > this->NumberOfNormals+1 )
-	  cout << "There's a problem with the number of normals!\n";
+  stream_stats stats;
+  stats.objects  = m.NumberOfObjects;
+  stats.groups   = m.NumberOfGroups;
+  stats.faces    = m.NumberOfFaces;
+  stats.vertices = m.NumberOfVertices;
+  stats.normals  = m.NumberOfNormals;
+  stats.textures = m.NumberOfTextures;
+  stats.peakResidentBytes = getPeakResidentBytes();
 
-      }
+  return stats;
+}
 
-    } // End  else if ( c1 == 'v' && c2 == 'n' )
+size_t model::getPeakResidentBytes( void ) {
+  struct rusage usage;
 
-  } // End while ( !objectFile.eof() )
+  if ( getrusage( RUSAGE_SELF, &usage ) )
+    return 0;
 
-  objectFile.close();
+#ifdef __DARWIN__
+  return usage.ru_maxrss;           // already in bytes
+#else
+  return usage.ru_maxrss * 1024;    // kilobytes
+#endif
+}
 
-  if ( this->debug )
-    cout << "Loaded " << vertices-1 << " vertices, " << normals-1 << " normals, " << texcoords-1 << " texture coordinates\n";
+// Build a face out of its corner indices and file it in the current render group.
+// nv, nt and nn are how many vertices/texture coordinates/normals had been read
+// when the face turned up... anything past those is a bad reference, and
+// negative indices count back from there (-1 is the latest one)
+void model::addFace( load_state &state, const int64_t *idx, uint type, bool good,
+		     uint64_t nv, uint64_t nt, uint64_t nn, token record ) {
 
-  // Finalize the last object in the model
-  if ( currentObject.getName() != "" ) {
-    currentObject.purgeGroups();
-    this->objects.push_back(currentObject);
+  bool polygon = this->options.triangulate && type > QUADS;
+
+  if ( type != LINES && type != TRIANGLES && type != QUADS && !polygon ) {
+    cout << record.str() << "\n";
+    cout << "Unknown face type " << type << " not attempting to process\n";
+    return;
   }
 
-  /*
-  for ( uint i=0; i<this->objects.size(); i++ ) {
-    vector<group> g = this->objects[i].getGroupVec();
+  // Each corner carries its own v/vt/vn layout, so there's no need
+  // to know up front whether the file has normals or texture coordinates
+  vector <vertex> &corners = state.corners;
+  corners.clear();
 
-    for ( uint j=0; j<g.size(); j++ ) {
-      g[j].checkConsistancy();
+  for ( uint i=0; i<type && good; i++ ) {
+    int64_t v = idx[3*i], t = idx[3*i+1], n = idx[3*i+2];
+
+    // (a relative vt/vn that reaches back past the first one is an error,
+    // not a missing index, hence the -1)
+    if ( v < 0 ) v += nv + 1;
+    if ( t < 0 ) t = ( t + (int64_t)nt >= 0 ) ? t + (int64_t)nt + 1 : -1;
+    if ( n < 0 ) n = ( n + (int64_t)nn >= 0 ) ? n + (int64_t)nn + 1 : -1;
+
+    if ( v < 1 || v > (int64_t)nv ||
+	 t < 0 || t > (int64_t)nt ||
+	 n < 0 || n > (int64_t)nn ) {
+      good = false;
+      break;
     }
-  } 
-  */
-  return true;
-}
 
-bool model::parseModel( void ) {
-  /*
-   * Parse the input file, read through and count the number of vertices, normals, uv, faces, materials, etc
-   */
+    vertex vtx( state.V[v] );
+    if ( t )
+      vtx.setTextureCoordinates( state.T[t] );
+    if ( n )
+      vtx.setNormal( state.N[n] );
 
-  ifstream objectFile (this->objFile.c_str());	
-  if ( !objectFile.is_open() ) {
-    perror(this->objFile.c_str());
-    return false;
+    corners.push_back( vtx );
+  }
+
+  if ( !good ) {
+    cout << record.str() << "\n";
+    cout << "Face refers to an undefined vertex, not attempting to process\n";
+    return;
+  }
+
+  // If the faces show up before any "o" line, give them a default object
+  if ( state.currentObject.getName() == "" )
+    state.currentObject.setName( "Object001" );
+
+  // And add this face to the render group in the current object
+  if ( !state.currentGroup ) {
+    // If the current render group is undefined... create a new one (carrying
+    // over any material/shading still in effect) and get a pointer to it
+    if ( state.currentMaterial >= 0 || state.shading )
+      state.currentGroup = this->findGroup( state );
+    else {
+      group g;
+      g.setIndexed( this->options.indexed );
+      g.setLayout( this->options.layout );
+      g.setTangentAttribute( this->options.tangentAttribute );
+      state.currentGroup = state.currentObject.addGroup( &g );
+      if ( !state.currentGroup )
+	state.currentGroup = state.currentObject.getGroup( g.getID() );
+    }
   }
 
-  string line;
-  unsigned int normals = 0, textures = 0, vertices = 0, faces = 0, objects = 0;
+  // Leave lines (and, unless asked, triangles and quads) alone
+  if ( type == LINES || type == TRIANGLES || !this->options.triangulate ) {
+    face f(type);
+    for ( uint i=0; i<type; i++ )
+      f.addVertex( corners[i] );
 
-  while ( !objectFile.eof() ) {
+    state.currentGroup->addFace(f);
+    state.faces++;
+    return;
+  }
+
+  // Otherwise break the polygon up so the whole group is one batch of triangles
+  vector <vec> &points = state.points;
+  points.resize( type );
+  for ( uint i=0; i<type; i++ )
+    points[i] = corners[i].getVtx();
+
+  triangulatePolygon( points.data(), type, state.triangles );
 
-    getline( objectFile, line );
+  for ( uint i=0; i<state.triangles.size(); i+=3 ) {
+    face f(TRIANGLES);
+    for ( uint j=0; j<3; j++ )
+      f.addVertex( corners[ state.triangles[i+j] ] );
+    state.currentGroup->addFace(f);
+  }
+  state.faces++;
 
-    // Grad the first two characters to check the vertex tags
-    char c1 = line.c_str()[0], c2 = line.c_str()[1];
+  return;
+}
 
-    if ( c1 == '#' || c1 == 's' )                // Ignore these tags for now
-      continue;                                  // s is the shading model, # is a comment
-    else if ( c1 == 'o' )                        // Objects
-      objects++;
-    else if ( c1 == 'v' && c2 == 'n' )           // Vertex normals
-      normals++;
-    else if ( c1 == 'v' && c2 == 't' )           // Texture vertices
-      textures++;
-    else if ( c1 == 'v' && c2 == 32 )            // Model vertices
-      vertices++;
-    else if ( c1 == 'f' && c2 == 32 ) {          // Face definitions
-      faces++;
-    } else if ( line.substr(0,6) == "mtllib" ) { // Name of the material libary file to use
+void model::beginObject( load_state &state, token name ) {
 
-      std::string key = "/";
-      std::size_t pos = this->objFile.rfind( key );
+  state.objects++;
 
-      if ( pos == std::string::npos )
-	this->mtlFile = line.substr(7, line.length());
-      else
-	this->mtlFile = this->objFile.substr(0, pos+1) + line.substr( 7, line.length() );
+  // If this is a new object, store the current object (if it exists) ...
+  this->finishObject( state );
+
+  // Clear out the current object
+  state.currentObject.flush();
+  state.currentGroup = 0x0;
+
+  // And store the new name (other attributes will get stored as they're read in from the file)
+  state.currentObject.setName( name.trim().str() );
+
+  return;
+}
+
+// Done with the current object... keep it, or hand it over if we're streaming
+void model::finishObject( load_state &state ) {
+
+  if ( state.currentObject.getName() == "" )
+    return;
 
+  state.currentObject.purgeGroups();
+  this->NumberOfGroups += state.currentObject.getNumberOfGroups();
+
+  // Smooth what the file left flat before the vertices are settled
+  if ( this->options.smooth )
+    smoothNormals( state.currentObject, this->options.creaseAngle );
+
+  // No more faces coming for these groups
+  for ( uint i=0; i<state.currentObject.getNumberOfGroups(); i++ ) {
+    group *g = state.currentObject.getGroup( i );
+    if ( this->options.optimize )
+      g->optimize( this->options.overdraw );
+    // Tangents last, in the order the cache keeps the corners in, so they
+    // come out the same from either
+    if ( this->options.tangents )
+      generateTangents( *g );
+  }
+
+  // The levels of detail once the vertices are settled, as they're kept
+  // as triangles over them
+  if ( this->options.lods )
+    ::generateLODs( state.currentObject, this->options.lods, this->options.lodRatio );
+
+  for ( uint i=0; i<state.currentObject.getNumberOfGroups(); i++ )
+    state.currentObject.getGroup( i )->packIndices();
+  state.currentObject.computeBounds();
+
+  if ( !this->options.streaming() ) {
+    this->objects.push_back( std::move(state.currentObject) );
+    return;
+  }
+
+  // Whoever gets the object will want its textures in place (this waits
+  // for the decoding, but only the first time round)
+  if ( !this->options.deferGL ) {
+    this->bindTextures();
+    this->applyTextures( state.currentObject );
+  }
+
+  if ( this->options.onGroup ) {
+    for ( uint i=0; i<state.currentObject.getNumberOfGroups(); i++ ) {
+      group *g = state.currentObject.getGroup( i );
+      this->options.onGroup( *g, state.currentObject );
     }
+  }
 
-  } // End while ( !objectFile.eof() )
-  
-  if ( debug )
-    cout << "Found " << vertices << " vertices, " << normals << " normals, " 
-	 << textures << " textures " << faces << " faces and " << objects << " objects\n";
+  if ( this->options.onObject )
+    this->options.onObject( state.currentObject );
 
-  objectFile.close();
+  // The object's storage gets reused for the next one
+  state.currentObject.flush();
+  state.currentGroup = 0x0;
 
-  // If we don't have the minimum we need 
-  // build a model, bail right now
-  if ( !vertices || !faces )
-    return false;
+  return;
+}
 
-  if ( !objects ) 
-    cout << "No objects defined in " << this->objFile << "\n";
+void model::setShading( load_state &state, token line ) {
 
-  // Save these since we'll need the information in the loader
-  this->NumberOfVertices  = vertices;
-  this->NumberOfTextures  = textures;
-  this->NumberOfNormals   = normals;
-  this->NumberOfObjects   = objects;
+  token word;
+  if ( !line.nextWord( word ) || word.equals("off") )
+    state.shading = 0;
+  else
+    state.shading = word.toInt();
 
-  return true;
+  // Create a new render group if it doesn't already exist
+  state.currentGroup = this->findGroup( state );
+
+  return;
+}
+
+void model::useMaterial( load_state &state, token name ) {
+
+  // No mtllib line so far... fall back on the default material file
+  if ( !this->materialsLoaded && !this->loadMaterials() )
+    cout << "No materials associated with model\n";
+
+  state.currentMaterial = this->getMaterialID( name.trim().str() );
+
+  // Create a new render group if it doesn't already exist
+  state.currentGroup = this->findGroup( state );
+
+  return;
+}
+
+// The current object's render group for the current material and shading,
+// created if this is the first time the pair has come up
+group * model::findGroup( load_state &state ) {
+
+  object &o = state.currentObject;
+  group  *g = o.findGroup( state.currentMaterial, state.shading );
+  if ( g )
+    return g;
+
+  group ng( this->getMaterialByID( state.currentMaterial ), state.shading );
+  ng.setIndexed( this->options.indexed );
+  ng.setLayout( this->options.layout );
+  ng.setTangentAttribute( this->options.tangentAttribute );
+  g = o.addGroup( &ng );
+  if ( !g )
+    g = o.getGroup( ng.getID() );
+  return g;
+}
+
+void model::useMaterialLibrary( load_state &state, token name ) {
+
+  std::size_t pos = this->objFile.rfind( '/' );
+
+  if ( pos == std::string::npos )
+    this->mtlFile = name.trim().str();
+  else
+    this->mtlFile = this->objFile.substr(0, pos+1) + name.trim().str();
+
+  if ( this->debug )
+    cout << this->objFile << ", " << this->mtlFile << "\n";
+
+  if ( !this->loadMaterials() )
+    cout << "No materials associated with model\n";
+
+  return;
 }
 
 bool model::loadMaterials( void ) {
 
   material mat;
   float    v[3];
-  string   line;
-  float    Ni = 0.0f, d = 0.0f;
-  int      illum = 0;
-  char     dummy[8];
+  token    line, key, word;
 
-  char     *texMap;
+  // Only ever try this once per model
+  this->materialsLoaded = true;
 
   // Open the materials file... If it's not there 
   // complain, set NumberOfMaterials to 0, and return
-  ifstream materialFile (this->mtlFile.c_str());	
-  if ( !materialFile.is_open() ) {
+  reader materialFile( this->mtlFile );
+  if ( !materialFile.isOpen() ) {
     perror(this->mtlFile.c_str());
     return false;
   }
@@ -532,11 +1048,12 @@ bool model::loadMaterials( void ) {
   // Read in each material definition in the file
   // See protected section in material.h for definitions 
   // of what the tags mean
-  while ( !materialFile.eof() ) {
+  while ( materialFile.getLine( line ) ) {
 
-    getline( materialFile, line );
+    if ( !line.nextWord( key ) || key[0] == '#' )
+      continue;
 
-    if ( line.substr(0,6) == "newmtl" ) {
+    if ( key.equals("newmtl") ) {
       
       // If we're changing materials store the current material
       if ( mat.getName() != "" ) {
@@ -545,58 +1062,55 @@ bool model::loadMaterials( void ) {
 	  cout << "material #" << this->materials.size() << ": " << mat << "\n";
 
 	// Store the current material
-	this->materials.push_back(mat);
+	this->addMaterial(mat);
 
 	// And flush the current values in preparation for the next one
 	mat.flush();
       }
 
-      mat.setName( line.substr(7, line.length()) );
+      mat.setName( line.trim().str() );
 
-    } else if ( line.substr(0,2) == "Ns" )
-      mat.setNs( atof( line.substr(3, line.length()).c_str() ) );
-
-    else if ( line.substr(0,2) == "Ka" ) {
-      sscanf( line.c_str(), "%s %f %f %f", dummy, &v[0], &v[1], &v[2] );
-      mat.setKa( v );
-    }
-    else if ( line.substr(0,2) == "Kd" ) {
-      sscanf( line.c_str(), "%s %f %f %f", dummy, &v[0], &v[1], &v[2] );
-      mat.setKd( v );
+    } else if ( key.equals("Ns") ) {
+      if ( line.nextWord( word ) )
+	mat.setNs( word.toFloat() );
     }
-    else if ( line.substr(0,2) == "Ks" ) {
-      sscanf( line.c_str(), "%s %f %f %f", dummy, &v[0], &v[1], &v[2] );
-      mat.setKs( v );
+    else if ( key.equals("Ka") || key.equals("Kd") || key.equals("Ks") ) {
+      vec c = parseVector( line );
+      v[0] = c.x; v[1] = c.y; v[2] = c.z;
+
+      if ( key[1] == 'a' )
+	mat.setKa( v );
+      else if ( key[1] == 'd' )
+	mat.setKd( v );
+      else
+	mat.setKs( v );
     }
-    else if ( line.substr(0,2) == "Ni" ) {
-      sscanf( line.c_str(), "%s %f", dummy, &Ni );
-      mat.setNi( Ni );
+    else if ( key.equals("Ni") ) {
+      if ( line.nextWord( word ) )
+	mat.setNi( word.toFloat() );
     }
-    else if ( line.substr(0,1) == "d" ) {
-      sscanf( line.c_str(), "%s %f", dummy, &d );
-      mat.setD( d );
+    else if ( key.equals("d") ) {
+      if ( line.nextWord( word ) )
+	mat.setD( word.toFloat() );
     }
-    else if ( line.substr(0,5) == "illum" ) {
-      sscanf( line.c_str(), "%s %i", dummy, &illum );
-      mat.setIllum( illum );
+    else if ( key.equals("illum") ) {
+      if ( line.nextWord( word ) )
+	mat.setIllum( word.toInt() );
     }
-    else if ( line.substr(0,6) == "map_Kd" ) {
-      texMap = (char *)malloc( sizeof(char) * line.size() + 1 );
-      sscanf( line.c_str(), "%s %s", dummy, texMap );
-      mat.setDiffuseTexture( texMap );
+    else if ( key.equals("map_Kd") ) {
+      if ( line.nextWord( word ) )
+	mat.setDiffuseTexture( word.str(), false );
     }
-    else if ( line.substr(0,6) == "map_Ka" ) {
-      texMap = (char *)malloc( sizeof(char) * line.size() + 1 );
-      sscanf( line.c_str(), "%s %s", dummy, texMap );
-      mat.setAmbientTexture( texMap );
+    else if ( key.equals("map_Ka") ) {
+      if ( line.nextWord( word ) )
+	mat.setAmbientTexture( word.str(), false );
     }
-    else if ( line.substr(0,6) == "map_Ks" ) {
-      texMap = (char *)malloc( sizeof(char) * line.size() + 1 );
-      sscanf( line.c_str(), "%s %s", dummy, texMap );
-      mat.setSpecularTexture( texMap );
+    else if ( key.equals("map_Ks") ) {
+      if ( line.nextWord( word ) )
+	mat.setSpecularTexture( word.str(), false );
     }
 
-  } // End while ( !materialFile.eof() )
+  } // End while ( materialFile.getLine( line ) )
 
   // Done reading the materials... close it up
   materialFile.close();
@@ -607,7 +1121,10 @@ bool model::loadMaterials( void ) {
     cout << "material #" << this->materials.size() << ": " << mat << "\n";
 
   // Store the current material, and get set for a new one
-  this->materials.push_back(mat);
+  this->addMaterial(mat);
+
+  // Get the textures decoding while the geometry is read
+  this->requestTextures();
 
   if ( this->debug )
     cout << "Loaded " << this->materials.size() << " materials\n";
@@ -615,16 +1132,76 @@ bool model::loadMaterials( void ) {
   return true;
 }
 
+// Hand every material's texture to the texture manager to decode
+void model::requestTextures( void ) {
+
+  for ( uint i=0; i<this->materials.size(); i++ )
+    this->textures.request( this->materials[i].getTextureFile() );
+
+  return;
+}
+
+// Upload whatever has been decoded and point the materials (and the render
+// groups' copies of them) at the new textures. Needs a current GL context
+void model::bindTextures( void ) {
+
+  if ( !this->textures.upload() )
+    return;
+
+  for ( uint i=0; i<this->materials.size(); i++ ) {
+    material &m = this->materials[i];
+    uint id = this->textures.getTextureID( m.getTextureFile() );
+    if ( !id || id == m.getTextureID() )
+      continue;
+
+    m.setTextureID( id );
+    cout << "Image " << m.getTextureFile() << " bound to texture " << id
+	 << " for material " << m.getName() << "\n";
+  }
+
+  for ( uint k=0; k<this->objects.size(); k++ )
+    this->applyTextures( this->objects[k] );
+
+  return;
+}
+
+void model::applyTextures( object &o ) {
+
+  for ( uint i=0; i<this->materials.size(); i++ )
+    if ( this->materials[i].getTextureID() )
+      o.setTextureID( this->materials[i].getName(), this->materials[i].getTextureID() );
+
+  return;
+}
+
 material model::getMaterialByName( string name ) {
+  return this->getMaterialByID( this->getMaterialID( name ) );
+}
+
+material model::getMaterialByID( int id ) {
 
   material mat;
-  for (uint i=0; i<this->materials.size(); i++ ) {
-    if ( this->materials[i].getName() == name ) {
-      mat = this->materials[i];
-      break;
-    }
-  }
+  if ( id >= 0 && id < (int)this->materials.size() )
+    mat = this->materials[id];
 
   return mat;
 }
 
+// Number the material, store it and index it by name. If a name turns
+// up twice the first one wins, as it always did
+void model::addMaterial( material &mat ) {
+  mat.setID( this->materials.size() );
+  this->materials.push_back( mat );
+  this->materialIndex.insert( make_pair( mat.getName(), (uint)mat.getID() ) );
+  return;
+}
+
+void model::indexMaterials( void ) {
+  this->materialIndex.clear();
+  for ( uint i=0; i<this->materials.size(); i++ ) {
+    this->materials[i].setID( i );
+    this->materialIndex.insert( make_pair( this->materials[i].getName(), i ) );
+  }
+  return;
+}
+
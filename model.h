@@ -3,8 +3,19 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include <object.h>
+#include <reader.h>
+#include <pool.h>
+#include <texture.h>
+#include <bvh.h>
+#include <kdtree.h>
 
 #define POINTS    1
 #define LINES     2
@@ -24,14 +35,189 @@ struct initial_conditions {
   float scale;
 };
 
+// Streaming loads hand over each object (and its render groups) as soon as it's complete
+typedef std::function<void (object &)>          object_callback;
+typedef std::function<void (group &, object &)> group_callback;
+
+/*
+ *  load_progress: how far along a load is. The loader updates it as it
+ *                 goes, so it can be watched from another thread, and
+ *                 setting cancel asks the loader to stop as soon as it can
+ */
+
+struct load_progress {
+  std::atomic <size_t> bytesRead;    // of the .obj file
+  std::atomic <size_t> bytesTotal;
+  std::atomic <size_t> records;      // v/vt/vn/f/o/s/usemtl/mtllib lines handled
+  std::atomic <bool>   cancel;
+  std::atomic <bool>   done;
+
+  load_progress() : bytesRead(0), bytesTotal(0), records(0), cancel(false), done(false) {}
+
+  float fraction( void ) {
+    size_t total = bytesTotal;
+    return total ? (float)bytesRead / total : 0.0f;
+  }
+};
+
+/*
+ *  load_options: knobs for how a model gets read in. The defaults
+ *                load the way the library always has
+ */
+
+struct load_options {
+  bool parallel;    // Parse the .obj in newline aligned chunks on all cores
+  int  threads;     // How many threads for a parallel load (0 = all of them)
+
+  // When either of these is set the model is streamed: each finished object
+  // is handed over here and then dropped instead of being kept in the model
+  object_callback onObject;
+  group_callback  onGroup;
+
+  load_progress  *progress;  // Optional, owned by the caller, must outlive the load
+  bool            deferGL;   // Leave all GL calls (texture and buffer uploads) for finalize()
+
+  attribute_pools *pools;    // Optional v/vt/vn storage to reuse from one load to the next
+
+  bool triangulate;          // Split quads and n-gons into triangles as they're read
+  bool indexed;              // Weld identical corners and draw with glDrawElements (see group.h)
+  bool optimize;             // Indexed triangles: reorder for the vertex cache and vertex fetch
+  bool overdraw;             // ... and then for less overdraw (see optimize.h)
+  bool smooth;               // Smooth normals for faces without any, by smoothing group (see normals.h)
+  float creaseAngle;         // ... keeping edges sharper than this (degrees) sharp
+  bool tangents;             // Tangents for normal mapping, in every vertex (see tangents.h)
+  int tangentAttribute;      // ... handed to GL as this generic vertex attribute (-1 for none)
+  vertex_layout layout;      // How each group packs, and so keeps, its vertices (see vertex.h)
+  bool buffers;              // Upload the arrays to GL buffer objects once and draw from those
+  bool cull;                 // draw() skips groups outside the view frustum (see bounds.h)
+  uint lods;                 // Coarser levels of detail to make for each group of triangles (see simplify.h)
+  float lodRatio;            // ... each keeping about this much of the one before
+  float lodPixels;           // ... and draw() uses the coarsest whose error looks no bigger than this
+
+  // Keep a binary copy of the loaded model next to the .obj, and load from
+  // that instead whenever it's newer than both the .obj and the .mtl.
+  // Each texture's mip chain is kept next to its image the same way
+  bool        useCache;
+  std::string cacheFile;     // Where to keep it ("" for <objFile>.cache)
+
+  load_options() {
+    parallel = false;
+    threads  = 0;
+    progress = 0x0;
+    deferGL  = false;
+    pools    = 0x0;
+
+    triangulate = false;
+    indexed     = false;
+    optimize    = false;
+    overdraw    = false;
+    smooth      = false;
+    creaseAngle = 180.0f;
+    tangents    = false;
+    tangentAttribute = -1;
+    buffers     = false;
+    cull        = false;
+    lods        = 0;
+    lodRatio    = 0.5f;
+    lodPixels   = 1.0f;
+    useCache    = false;
+  }
+
+  bool streaming( void ) const {
+    return onObject || onGroup;
+  }
+};
+
+/*
+ *  stream_stats: what a streaming load got through, and the most memory
+ *                the process had resident while doing it
+ */
+
+struct stream_stats {
+  unsigned int objects;
+  unsigned int groups;
+  unsigned int faces;
+  uint64_t     vertices;
+  uint64_t     normals;
+  uint64_t     textures;
+  size_t       peakResidentBytes;
+};
+
+/*
+ *  load_state: everything loadModel() carries from one record to the
+ *              next while it builds up objects and render groups
+ */
+
+struct load_state {
+  int      currentMaterial;  // index into the model's materials, -1 for none
+  object   currentObject;
+  group  * currentGroup;
+  uint     shading;
+
+  // The attribute lists... either the caller's (see load_options) or our own.
+  // OBJ indices start at 1, so each list holds a dummy entry at [0]
+  attribute_pools  own;
+  attribute_pools &pools;
+
+  pool <vec> &V;  // object vertices
+  pool <vec> &N;  // vertex normals
+  pool <vec> &T;  // texture coordinates
+
+  unsigned int faces;
+  unsigned int objects;
+
+  // Scratch space for building faces, kept to save reallocating every time
+  std::vector <vertex>       corners;
+  std::vector <vec>          points;
+  std::vector <unsigned int> triangles;
+
+  load_state( attribute_pools *reuse=0x0 ) : pools( reuse ? *reuse : own ), V( pools.V ), N( pools.N ), T( pools.T ) {
+    vec zero = {0.0f, 0.0f, 0.0f};
+
+    pools.reset();
+    V.push_back( zero );
+    N.push_back( zero );
+    T.push_back( zero );
+
+    currentMaterial = -1;
+    currentGroup = 0x0;
+    shading = 0;
+    faces = objects = 0;
+  }
+};
+
 class model {
 public: 
-  model(std::string, std::string="");
+  model(std::string, std::string="", load_options=load_options());
   ~model();
 
   void draw(void);
   void setAlpha( float );
-  void makeList(void);
+  void makeList(void);          // Not needed with load_options::buffers, just draw(). Never culled, always in full
+
+  // Cull in draw() against the matrices current then, or stop (see load_options::cull)
+  void setCulling( bool on ) {
+    this->options.cull = on;
+  }
+
+  // How big (in pixels) a level of detail's error may look before draw()
+  // takes a finer one; 0 for every group in full (see load_options::lods)
+  void setLODPixels( float pixels ) {
+    this->options.lodPixels = pixels;
+  }
+
+  // Make (or make again) every group's levels of detail, if the load
+  // didn't. Groups already in GL buffers are uploaded again, so needs the
+  // context current if they are
+  void generateLODs( uint levels, float ratio=0.5f );
+
+  // Around every object
+  bounds getBounds(void) const {
+    bounds b;
+    for ( uint i=0; i<this->objects.size(); i++ )
+      b.extend( this->objects[i].getBounds() );
+    return b;
+  }
   void set_initial_conditions( initial_conditions i ) {
     ic = i;
   }
@@ -76,7 +262,8 @@ public:
       return "none";
   }
 
-  std::vector <object> getObjectVector(void) {
+  // Look, don't copy: take a copy of the vector if you need one
+  const std::vector <object> & getObjectVector(void) const {
     return this->objects;
   }
 
@@ -86,27 +273,137 @@ public:
     return object();
   }
 
+  // Load a model on a background thread. GL work is put off until the
+  // caller runs finalize() on its own (GL) thread. The future comes back
+  // with 0x0 if the load was cancelled, otherwise the caller owns the model
+  static std::future <model *> loadAsync( std::string, std::string="", load_options=load_options() );
+
+  // Do whatever GL work a deferred load left behind (uploading textures
+  // and, with load_options::buffers, the vertex arrays)
+  void finalize( void );
+
+  // Upload every group's arrays to GL buffers (done for you when
+  // load_options::buffers is set), or free them again. Streamed objects
+  // are the caller's to upload, with object::upload()
+  void uploadBuffers ( void );
+  void releaseBuffers( void );
+
+  bool isLoaded( void ) {
+    return this->loaded;
+  }
+
+  // Binary snapshots of the loaded model (see cache.cpp). loadCache() only
+  // takes the cache if it's newer than the .obj and .mtl, unless told not to check
+  bool saveCache( std::string="" );
+  bool loadCache( std::string="", bool=true );
+  std::string getCacheFile( void );
+
+  // Stream a model through a callback, one object at a time. Only the
+  // v/vt/vn lists (which any later face may refer back to) and the object
+  // being read are held in memory; the object is flushed after each call
+  static stream_stats stream( std::string, object_callback, std::string="", load_options=load_options() );
+
+  // High water mark of the resident set size for the whole process
+  static size_t getPeakResidentBytes( void );
+
+  // Record counts, gathered as a by-product of loading the model
+  uint64_t     getNumberOfVertices (void) { return this->NumberOfVertices; }
+  uint64_t     getNumberOfTextures (void) { return this->NumberOfTextures; }
+  uint64_t     getNumberOfNormals  (void) { return this->NumberOfNormals;  }
+  unsigned int getNumberOfFaces    (void) { return this->NumberOfFaces;    }
+  unsigned int getNumberOfObjects  (void) { return this->NumberOfObjects;  }
+  unsigned int getNumberOfGroups   (void) { return this->NumberOfGroups;   }
+
+  // ACMR and ATVR of every indexed triangle group (see optimize.h)
+  void reportVertexCache( std::ostream & );
+
+  // What each group's geometry takes up, and per triangle
+  void reportMemory( std::ostream & );
+
+  // Ray queries against every triangle of the model, in its own space
+  // (see bvh.h): the nearest hit, or whether there's any. The BVH is built
+  // on the first query (or by buildBVH) and kept until releaseBVH().
+  // For lots of rays at once use the bvh buildBVH() hands back
+  bool raycast( const ray &, ray_hit & );
+  bool anyHit ( const ray & );
+  const bvh & buildBVH  ( void );
+  void        releaseBVH( void );
+
+  // Snapping to the model: the nearest vertex, every vertex within a
+  // radius (see kdtree.h), and the nearest point on the surface (from the
+  // BVH). The vertex index is built on the first query (or by
+  // buildVertexIndex) and kept until releaseVertexIndex()
+  bool nearestVertex ( const vec &, vertex_hit &, float maxDistance=INFINITY );
+  void verticesWithin( const vec &, float radius, std::vector <vertex_hit> & );
+  bool closestPoint  ( const vec &, ray_hit &, float maxDistance=INFINITY );
+  const kd_tree & buildVertexIndex  ( void );
+  void            releaseVertexIndex( void );
+
+  // Index of the named material (-1 if there's no such material)
+  int getMaterialID( std::string name ) {
+    std::unordered_map<std::string, uint>::iterator it = this->materialIndex.find( name );
+    return ( it == this->materialIndex.end() ) ? -1 : (int)it->second;
+  }
+
   friend std::ostream & operator << (std::ostream &, model &);
 
  protected:
   std::vector <material> materials;
   std::vector <object>   objects;
 
+  // Where each material sits in 'materials', by name
+  std::unordered_map <std::string, uint> materialIndex;
+
   std::string objFile;
   std::string mtlFile;
 
   initial_conditions ic;
   GLuint       listNum;
 
-  unsigned int NumberOfVertices;
-  unsigned int NumberOfTextures;
-  unsigned int NumberOfNormals;
+  uint64_t     NumberOfVertices;
+  uint64_t     NumberOfTextures;
+  uint64_t     NumberOfNormals;
+  unsigned int NumberOfFaces;
   unsigned int NumberOfObjects;
+  unsigned int NumberOfGroups;
+
+  bool materialsLoaded;
+  bool loaded;
+
+  load_options options;
+
+  // Every texture file the materials use, decoded in the background
+  // from the moment the .mtl is read, and uploaded by bindTextures()
+  texture_manager textures;
+
+  // For raycast() and anyHit(), once there's been one
+  std::unique_ptr <bvh> accel;
+  std::mutex            accelLock;
+
+  // For nearestVertex() and verticesWithin(), likewise
+  std::unique_ptr <kd_tree> vertexIndex;
+  std::mutex                vertexLock;
 
-  bool      parseModel         ( void );
   bool      loadModel          ( void );
+  void      loadSerial         ( load_state &, reader & );
+  void      loadParallel       ( load_state &, reader & );
+  void      addFace            ( load_state &, const int64_t *, uint, bool, uint64_t, uint64_t, uint64_t, token );
+  void      beginObject        ( load_state &, token );
+  void      finishObject       ( load_state & );
+  void      setShading         ( load_state &, token );
+  void      useMaterial        ( load_state &, token );
+  void      useMaterialLibrary ( load_state &, token );
+  bool      reportProgress     ( size_t, size_t );
+  void      requestTextures    ( void );
+  void      bindTextures       ( void );
+  void      applyTextures      ( object & );
+  uint32_t  cacheFlags         ( void );
   bool      loadMaterials      ( void );
   material  getMaterialByName  ( std::string );
+  material  getMaterialByID    ( int );
+  void      addMaterial        ( material & );
+  void      indexMaterials     ( void );
+  group   * findGroup          ( load_state & );
 
  private:
   static const bool debug = false;
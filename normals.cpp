@@ -0,0 +1,253 @@
+#include <normals.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+ * normals.cpp : The smoothing pass. The flat faces of one smoothing group
+ *               are gathered into flat arrays, their corners welded by
+ *               position (bit for bit, as the .obj shares positions), and
+ *               then each corner's normal is summed from the corners at
+ *               its position, the corners shared out across the cores
+ */
+
+#define NO_POSITION 0xFFFFFFFFu
+
+// The corners of every face being smoothed, one entry apiece
+struct smooth_set {
+  vector <group *>  groups;
+  vector <uint32_t> owner;       // which group the corner is in
+  vector <uint64_t> local;       // ... and which corner of it
+  vector <uint32_t> face;        // which face (of the set) it belongs to
+  vector <uint64_t> faceFirst;   // each face's first corner, and one past the last
+  vector <float>    px, py, pz;  // where it is
+};
+
+// Gather the flat faces of every group in smoothing group s
+static void gather( object &o, unsigned int s, smooth_set &set ) {
+
+  for ( uint j=0; j<o.getNumberOfGroups(); j++ ) {
+    group *g = o.getGroup( j );
+    if ( g->getShading() != s || !g->getLayout().normals )
+      continue;
+
+    uint32_t owner = set.groups.size();
+    bool used = false;
+
+    uint64_t start = 0;
+    for ( uint i=0; i<g->getNumberOfFaces(); start += g->getFaceSize( i ), i++ ) {
+      uint n = g->getFaceSize( i );
+      if ( !g->isFaceFlat( i ) || n < TRIANGLE )
+	continue;
+
+      uint32_t f = set.faceFirst.size();
+      set.faceFirst.push_back( set.owner.size() );
+      for ( uint64_t c = start; c < start + n; c++ ) {
+	const float *p = g->getCornerData( c );
+	set.owner.push_back( owner );
+	set.local.push_back( c );
+	set.face.push_back( f );
+	set.px.push_back( p[0] );
+	set.py.push_back( p[1] );
+	set.pz.push_back( p[2] );
+      }
+      used = true;
+    }
+
+    if ( used )
+      set.groups.push_back( g );
+  }
+  set.faceFirst.push_back( set.owner.size() );
+  return;
+}
+
+static uint64_t hashPosition( float x, float y, float z ) {
+  float p[3] = { x, y, z };
+  uint64_t h = 1469598103934665603ULL;
+  for ( uint i=0; i<3; i++ ) {
+    uint32_t bits;
+    memcpy( &bits, p+i, sizeof(bits) );
+    h = ( h ^ bits ) * 1099511628211ULL;
+  }
+  return h ^ ( h >> 29 );
+}
+
+// Number the distinct positions, and give each corner its position's number
+static uint32_t weldPositions( const smooth_set &set, vector <uint32_t> &position ) {
+
+  uint64_t corners = set.owner.size();
+  size_t slots = 1024;
+  while ( slots < 2*corners )
+    slots *= 2;
+
+  vector <uint32_t> table( slots, NO_POSITION );
+  vector <uint64_t> first;    // a corner at each position
+  position.resize( corners );
+
+  for ( uint64_t c=0; c<corners; c++ ) {
+    for ( size_t i = hashPosition( set.px[c], set.py[c], set.pz[c] ) & (slots-1); ; i = (i+1) & (slots-1) ) {
+
+      if ( table[i] == NO_POSITION ) {
+	table[i] = position[c] = first.size();
+	first.push_back( c );
+	break;
+      }
+
+      uint64_t k = first[ table[i] ];
+      if ( !memcmp( &set.px[k], &set.px[c], sizeof(float) ) &&
+	   !memcmp( &set.py[k], &set.py[c], sizeof(float) ) &&
+	   !memcmp( &set.pz[k], &set.pz[c], sizeof(float) ) ) {
+	position[c] = table[i];
+	break;
+      }
+    }
+  }
+  return first.size();
+}
+
+static void smoothSet( smooth_set &set, float creaseAngle ) {
+
+  int64_t corners = set.owner.size();
+  int64_t faces   = set.faceFirst.size() - 1;
+  if ( !faces )
+    return;
+
+  // Each face's area vector (its normal, as long as it's big) and unit normal
+  vector <float> ax( faces ), ay( faces ), az( faces ), ux( faces ), uy( faces ), uz( faces );
+
+  #pragma omp parallel for schedule(static)
+  for ( int64_t f=0; f<faces; f++ ) {
+    uint64_t c = set.faceFirst[f];
+    bool quad = set.faceFirst[f+1] - c == QUAD;
+
+    // A quad's area vector is half the cross product of its diagonals
+    uint64_t a = c, b = c+1, d = c+2, e = c;
+    if ( quad ) {
+      b = c+2;
+      d = c+3;
+      e = c+1;
+    }
+    float x1 = set.px[b] - set.px[a], y1 = set.py[b] - set.py[a], z1 = set.pz[b] - set.pz[a];
+    float x2 = set.px[d] - set.px[e], y2 = set.py[d] - set.py[e], z2 = set.pz[d] - set.pz[e];
+
+    ax[f] = 0.5f * ( y1*z2 - z1*y2 );
+    ay[f] = 0.5f * ( z1*x2 - x1*z2 );
+    az[f] = 0.5f * ( x1*y2 - y1*x2 );
+
+    float len = sqrtf( ax[f]*ax[f] + ay[f]*ay[f] + az[f]*az[f] );
+    float inv = ( len > 0.0f ) ? 1.0f/len : 0.0f;
+    ux[f] = ax[f] * inv;
+    uy[f] = ay[f] * inv;
+    uz[f] = az[f] * inv;
+  }
+
+  // What each corner adds to its position: the face's area vector scaled
+  // by the corner's angle
+  vector <float> wx( corners ), wy( corners ), wz( corners );
+
+  #pragma omp parallel for schedule(static)
+  for ( int64_t f=0; f<faces; f++ ) {
+    uint64_t first = set.faceFirst[f];
+    uint n = set.faceFirst[f+1] - first;
+
+    for ( uint k=0; k<n; k++ ) {
+      uint64_t c = first + k, next = first + (k+1) % n, prev = first + (k+n-1) % n;
+      float x1 = set.px[next] - set.px[c], y1 = set.py[next] - set.py[c], z1 = set.pz[next] - set.pz[c];
+      float x2 = set.px[prev] - set.px[c], y2 = set.py[prev] - set.py[c], z2 = set.pz[prev] - set.pz[c];
+
+      float lengths = sqrtf( ( x1*x1 + y1*y1 + z1*z1 ) * ( x2*x2 + y2*y2 + z2*z2 ) );
+      float angle = 0.0f;
+      if ( lengths > 0.0f ) {
+	float cosine = ( x1*x2 + y1*y2 + z1*z2 ) / lengths;
+	angle = acosf( cosine < -1.0f ? -1.0f : ( cosine > 1.0f ? 1.0f : cosine ) );
+      }
+
+      wx[c] = angle * ax[f];
+      wy[c] = angle * ay[f];
+      wz[c] = angle * az[f];
+    }
+  }
+
+  // Which corners are at each position, all in one array
+  vector <uint32_t> position;
+  uint32_t positions = weldPositions( set, position );
+
+  vector <uint64_t> start( positions+1, 0 );
+  for ( int64_t c=0; c<corners; c++ )
+    start[ position[c]+1 ]++;
+  for ( uint32_t p=0; p<positions; p++ )
+    start[p+1] += start[p];
+
+  vector <uint64_t> fill( start.begin(), start.end()-1 );
+  vector <uint64_t> around( corners );
+  for ( int64_t c=0; c<corners; c++ )
+    around[ fill[ position[c] ]++ ] = c;
+
+  // Then every corner's normal, from the corners around it on faces
+  // within the crease angle of its own
+  bool crease = creaseAngle < 180.0f;
+  float limit = cosf( creaseAngle * (float)M_PI / 180.0f );
+  vector <float> nx( corners ), ny( corners ), nz( corners );
+
+  #pragma omp parallel for schedule(static)
+  for ( int64_t c=0; c<corners; c++ ) {
+    uint32_t f = set.face[c], p = position[c];
+    float x = 0.0f, y = 0.0f, z = 0.0f;
+
+    for ( uint64_t i = start[p]; i < start[p+1]; i++ ) {
+      uint64_t other = around[i];
+      uint32_t h = set.face[other];
+      if ( crease && h != f && ux[f]*ux[h] + uy[f]*uy[h] + uz[f]*uz[h] < limit )
+	continue;
+      x += wx[other];
+      y += wy[other];
+      z += wz[other];
+    }
+
+    float len = sqrtf( x*x + y*y + z*z );
+    float inv = ( len > 0.0f ) ? 1.0f/len : 0.0f;
+    nx[c] = x * inv;
+    ny[c] = y * inv;
+    nz[c] = z * inv;
+  }
+
+  // Nothing to go on (all the faces there have no area)? Keep the flat one
+  for ( int64_t c=0; c<corners; c++ ) {
+    if ( nx[c] == 0.0f && ny[c] == 0.0f && nz[c] == 0.0f )
+      continue;
+    vec n = { nx[c], ny[c], nz[c] };
+    set.groups[ set.owner[c] ]->setCornerNormal( set.local[c], n );
+  }
+
+  // Indexed corners that were apart only for their flat normals can share a vertex now
+  for ( uint i=0; i<set.groups.size(); i++ )
+    set.groups[i]->reweld();
+
+  return;
+}
+
+void smoothNormals( object &o, float creaseAngle ) {
+
+  // Each smoothing group in turn (0 is smoothing off)
+  vector <unsigned int> done;
+
+  for ( uint j=0; j<o.getNumberOfGroups(); j++ ) {
+    unsigned int s = o.getGroup( j )->getShading();
+    bool seen = false;
+    for ( uint k=0; k<done.size(); k++ )
+      seen = seen || done[k] == s;
+    if ( !s || seen )
+      continue;
+    done.push_back( s );
+
+    smooth_set set;
+    gather( o, s, set );
+    smoothSet( set, creaseAngle );
+  }
+
+  return;
+}
@@ -0,0 +1,21 @@
+#ifndef __NORMALS_H
+#define __NORMALS_H 1
+
+#include <object.h>
+
+/*
+ *  normals.h : Smooth normals for faces that came without any. face.h
+ *              gives such a face its own flat normal; smoothNormals()
+ *              replaces those, in every smoothing group of an object
+ *              (the "s" lines, across all its materials), with the
+ *              normal at each position averaged over the faces that
+ *              meet there, weighted by the faces' areas and the angles
+ *              of their corners. Faces meeting at more than the crease
+ *              angle stay sharp. Faces with normals of their own, and
+ *              faces with smoothing off ("s off" or "s 0"), are left
+ *              alone
+ */
+
+void smoothNormals( object &o, float creaseAngle=180.0f );
+
+#endif
@@ -3,6 +3,10 @@
 
 #include <group.h>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
 
 /*
  * object.h : Defines a high-level container object for Wavefront models
@@ -28,13 +32,33 @@ class object {
 
   // Overload of the assignment operator
   inline object & operator = (const object &o) {
-    (*this).name = o.name;
-    copy ( o.groups.begin(), o.groups.end(), back_inserter( (*this).groups ) );
+    (*this).name   = o.name;
+    (*this).groups = o.groups;
+    (*this).box    = o.box;
+    reindex();
+    return (*this);
+  }
+
+  object( object &&o ) {
+    (*this) = std::move( o );
+    return;
+  }
+
+  // Moving hands the groups (and their lookups) over without copying
+  inline object & operator = (object &&o) {
+    (*this).name       = std::move( o.name );
+    (*this).groups     = std::move( o.groups );
+    (*this).byMaterial = std::move( o.byMaterial );
+    (*this).byID       = std::move( o.byID );
+    (*this).box        = o.box;
     return (*this);
   }
 
   void flush( void ) {
     groups.clear();
+    byMaterial.clear();
+    byID.clear();
+    box.clear();
     this->name = "";
   }
 
@@ -49,111 +73,137 @@ class object {
     return;
   }
 
-  std::string getName(void) {
+  const std::string & getName(void) const {
     return this->name;
   }
 
-  unsigned int getNumberOfGroups(void) {
+  unsigned int getNumberOfGroups(void) const {
     return this->groups.size();
   }
 
-  std::vector <group> getGroupVec(void) {
+  const std::vector <group> & getGroupVec(void) const {
     return this->groups;
   }
 
   // Given a material and a shading model....
-  // find the group in this object which matches
-  group getGroup( material m, unsigned int s ) {
+  // find the group in this object which matches (good until the next
+  // group is added)
+  group & getGroup( const material &m, unsigned int s ) {
 
-
-    std::string id = m.getName() + "_" + std::to_string(s);
-
-    for ( uint i=0; i<groups.size(); i++ ) {
-      if ( groups[i].getID() == id )
-	return groups[i];
-    }
+    group *g = findGroup( m.getName() + "_" + std::to_string(s) );
+    if ( g )
+      return *g;
 
     // In the (unlikely) event that (m,s) don't define a group.... create it
     std::cout << "No such group... creating it\n";
-    this->addGroup(m,s);
-    return this->groups[ this->groups.size()-1 ];
+    return this->addGroup(m,s);
+  }
+
+  // Get a pointer to the n'th group
+  group * getGroup( unsigned int n ) {
+    if ( n < groups.size() )
+      return &groups[n];
+    return 0x0;
+  }
+
+  const group * getGroup( unsigned int n ) const {
+    if ( n < groups.size() )
+      return &groups[n];
+    return 0x0;
   }
 
   // Get a pointer to a particular group with ID 
   group * getGroup( std::string id ) {
 
-    for ( uint i=0; i<groups.size(); i++ ) {
-      if ( groups[i].getID() == id )
-	return &groups[i];
-    }
+    group *g = findGroup( id );
+    if ( g )
+      return g;
 
     // If the group doesn't exist... bitch & whine and return null
     std::cout << "No such group!\n";
     return 0x0;
   }
 
-  // Add a new group to the list and return it for use
-  group addGroup( material m, unsigned int s ) {
+  // Quietly look a group up by its (material ID, shading) pair... one hash
+  // probe, no strings. Returns null if there isn't one
+  group * findGroup( int materialID, unsigned int s ) {
+    std::unordered_map<uint64_t, uint>::iterator it = byMaterial.find( groupKey(materialID, s) );
+    return ( it == byMaterial.end() ) ? 0x0 : &groups[it->second];
+  }
+
+  // ... or by its ID string
+  group * findGroup( const std::string &id ) {
+    std::unordered_map<std::string, uint>::iterator it = byID.find( id );
+    return ( it == byID.end() ) ? 0x0 : &groups[it->second];
+  }
+
+  // Add a new group to the list and return it for use (good until the
+  // next group is added)
+  group & addGroup( const material &m, unsigned int s ) {
     
     std::string id = m.getName() + "_" + std::to_string(s);
       
     // Make sure this group doesn't already exist
-    for ( uint i=0; i<groups.size(); i++ ) {
-      if ( groups[i].getID() == id )
-	return groups[i];
-    }
+    group *g = findGroup( id );
+    if ( g )
+      return *g;
 
-    groups.push_back(group(m,s));
+    insertGroup( group(m,s) );
     return groups[ groups.size()-1 ];
 
   }
 
-  group * addGroup( group * g ) {
-    for ( uint i=0; i<groups.size(); i++ ) {
-      if ( g->getID() == groups[i].getID() )
-	return 0x0;
-    }
-    groups.push_back(*g);
+  group * addGroup( const group * g ) {
+    if ( findGroup( g->getID() ) )
+      return 0x0;
+    insertGroup( *g );
     return &groups[ groups.size()-1 ];
   }
 
-  void addGroup( group g ) {
-    for ( uint i=0; i<groups.size(); i++ ) {
-      if ( g.getID() == groups[i].getID() )
-	return;
-    }
-    groups.push_back(g);
+  void addGroup( const group &g ) {
+    if ( findGroup( g.getID() ) )
+      return;
+    insertGroup( g );
+    return;
+  }
+
+  // Hand a finished group over, arrays and all
+  void addGroup( group &&g ) {
+    if ( findGroup( g.getID() ) )
+      return;
+    insertGroup( std::move( g ) );
     return;
   }
 
   bool hasGroup( std::string materialName, unsigned int shading ) {
-    std::string id = materialName + "_" + std::to_string(shading);
-    for ( uint i=0; i<groups.size(); i++ ) {
-      if ( groups[i].getID() == id )
-	return true;
-    }
-    return false;
+    return findGroup( materialName + "_" + std::to_string(shading) ) != 0x0;
   }
 
   bool hasGroup( std::string id ) {
-    for ( uint i=0; i<groups.size(); i++ ) {
-      if ( groups[i].getID() == id )
-	return true;
-    }
-    return false;
+    return findGroup( id ) != 0x0;
   }
 
   // If we accidentally added a group that ended up with no faces, remove it
   void purgeGroups(void) {
 
-    for(std::vector<group>::iterator it=groups.begin(); it != groups.end(); it++ ) {
-      if ( it->getNumberOfFaces() == 0 ) {
-	this->groups.erase(it);
-      }
+    std::vector<group>::iterator last = 
+      std::remove_if( groups.begin(), groups.end(), [](group &g) { return g.getNumberOfFaces() == 0; } );
+
+    if ( last != groups.end() ) {
+      groups.erase( last, groups.end() );
+      reindex();
     }
     return;
   }
 
+  // Point every group using material 'name' at a (newly loaded) texture
+  void setTextureID( std::string name, uint id ) {
+    for ( uint i=0; i<this->groups.size(); i++ )
+      if ( this->groups[i].getMaterial().getName() == name )
+	this->groups[i].setTextureID( id );
+    return;
+  }
+
   void setupMaterial(void) {
 
     for(std::vector<group>::iterator it=groups.begin(); it != groups.end(); it++ )
@@ -162,6 +212,21 @@ class object {
     return;
   }
 
+  // Put every group's arrays in GL buffers (see group::upload). Returns
+  // how many groups made it
+  uint upload(void) {
+    uint n = 0;
+    for(std::vector<group>::iterator it=groups.begin(); it != groups.end(); it++ )
+      n += it->upload() ? 1 : 0;
+    return n;
+  }
+
+  void release(void) {
+    for(std::vector<group>::iterator it=groups.begin(); it != groups.end(); it++ )
+      it->release();
+    return;
+  }
+
   GLuint makeList(void) {
     GLuint theList = glGenLists (1);
     glNewList( theList, GL_COMPILE );
@@ -178,10 +243,94 @@ class object {
     return;
   }
 
+  // Just the groups that could be in view (see bounds.h)
+  void draw( const frustum &view ) {
+
+    if ( !view.visible( this->box ) )
+      return;
+
+    for(std::vector<group>::iterator it=groups.begin(); it != groups.end(); it++ )
+      if ( view.visible( it->getBounds() ) )
+	it->draw();
+
+    return;
+  }
+
+  // Each group at the coarsest level of detail (see lod.h) that looks no
+  // different from the full one at the object's size on screen, skipping
+  // whatever's out of view if there's a frustum too
+  void draw( const lod_view &detail, const frustum *view=0x0 ) {
+
+    if ( view && !view->visible( this->box ) )
+      return;
+
+    float scale = detail.pixelsPerUnit( this->box );
+    for(std::vector<group>::iterator it=groups.begin(); it != groups.end(); it++ )
+      if ( !view || view->visible( it->getBounds() ) )
+	it->draw( it->pickLevel( scale, detail.threshold ) );
+
+    return;
+  }
+
+  // Every group's bounds, and the object's around them all (do it again
+  // after adding faces by hand, or draw( view ) may skip them)
+  void computeBounds( void ) {
+    this->box.clear();
+    for(std::vector<group>::iterator it=groups.begin(); it != groups.end(); it++ ) {
+      it->computeBounds();
+      this->box.extend( it->getBounds() );
+    }
+    return;
+  }
+
+  const bounds & getBounds( void ) const {
+    return this->box;
+  }
+
   friend std::ostream & operator << (std::ostream &, object &);
 
  protected:
   std::string name;
   std::vector <group> groups;
+  bounds box;
+
+  // Where each group sits in 'groups', by (material ID, shading) and by ID string
+  std::unordered_map <uint64_t, uint>    byMaterial;
+  std::unordered_map <std::string, uint> byID;
+
+  static uint64_t groupKey( int materialID, unsigned int s ) {
+    return ((uint64_t)(uint32_t)materialID << 32) | s;
+  }
+
+  void insertGroup( const group &g ) {
+    groups.push_back( g );
+    indexLast();
+    return;
+  }
+
+  void insertGroup( group &&g ) {
+    groups.push_back( std::move( g ) );
+    indexLast();
+    return;
+  }
+
+  // A new group isn't in the bounds until computeBounds() runs again
+  void indexLast( void ) {
+    group &added = groups.back();
+    box.clear();
+    byMaterial.insert( std::make_pair( groupKey(added.getMaterialID(), added.getShading()), groups.size()-1 ) );
+    byID.insert( std::make_pair( added.getID(), groups.size()-1 ) );
+    return;
+  }
+
+  void reindex( void ) {
+    byMaterial.clear();
+    byID.clear();
+    for ( uint i=0; i<groups.size(); i++ ) {
+      byMaterial.insert( std::make_pair( groupKey(groups[i].getMaterialID(), groups[i].getShading()), i ) );
+      byID.insert( std::make_pair( groups[i].getID(), i ) );
+    }
+    return;
+  }
 };
 #endif
@@ -0,0 +1,326 @@
+#ifndef __OPTIMIZE_H
+#define __OPTIMIZE_H 1
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+/*
+ *  optimize.h : Reordering indexed triangle lists for the GPU.
+ *
+ *    optimizeVertexCache : Forsyth's linear-speed vertex cache ordering,
+ *                          so each vertex is transformed as few times
+ *                          as possible
+ *    optimizeOverdraw    : cut that order into clusters wherever the
+ *                          cache restarts anyway, and draw the clusters
+ *                          facing out from the middle of the mesh first
+ *    optimizeVertexFetch : renumber the vertices in the order they're
+ *                          first used, so fetching them runs forwards
+ *                          through memory
+ *    analyzeVertexCache  : ACMR (vertices transformed per triangle) and
+ *                          ATVR (transformed per distinct vertex, 1.0 is
+ *                          perfect) through a FIFO cache
+ *
+ *  The triangle orders come back as triangle numbers, so whoever holds
+ *  per-triangle data (the group's faces) can be reordered to match
+ */
+
+#define VERTEX_CACHE_SIZE 16   // FIFO entries used for the ACMR/ATVR figures
+#define FORSYTH_CACHE     32   // LRU entries Forsyth's scoring models
+
+struct cache_stats {
+  float acmr;
+  float atvr;
+};
+
+// A FIFO vertex cache, as a ring of vertex numbers plus where each vertex
+// went in. Both the stats and optimizeOverdraw's clusters run through it
+struct vertex_fifo {
+  std::vector<uint32_t> ring;
+  std::vector<uint64_t> insertedAt;   // 1 + its place in the insertion order, 0 if never
+  uint64_t              head;
+
+  vertex_fifo( uint32_t vertices, uint size=VERTEX_CACHE_SIZE ) : ring( size, 0xFFFFFFFFu ), insertedAt( vertices, 0 ), head( 0 ) {}
+
+  // Does using v mean transforming it (again)? It's still in the cache
+  // as long as its slot hasn't been handed to anything since
+  bool miss( uint32_t v ) {
+    if ( insertedAt[v] && ring[(insertedAt[v]-1) % ring.size()] == v )
+      return false;
+    ring[head % ring.size()] = v;
+    insertedAt[v] = ++head;
+    return true;
+  }
+};
+
+inline cache_stats analyzeVertexCache( const uint32_t *indices, size_t count, uint32_t vertices, uint cacheSize=VERTEX_CACHE_SIZE ) {
+
+  cache_stats stats = { 0.0f, 0.0f };
+  if ( count < 3 || !vertices )
+    return stats;
+
+  vertex_fifo       cache( vertices, cacheSize );
+  std::vector<bool> used( vertices, false );
+  uint64_t misses = 0, distinct = 0;
+
+  for ( size_t i=0; i<count; i++ ) {
+    uint32_t v = indices[i];
+    if ( !used[v] ) {
+      used[v] = true;
+      distinct++;
+    }
+
+    if ( cache.miss( v ) )
+      misses++;
+  }
+
+  stats.acmr = (float)misses / ( count/3 );
+  stats.atvr = distinct ? (float)misses / distinct : 0.0f;
+  return stats;
+}
+
+inline float forsythScore( int cachePosition, uint remaining ) {
+
+  // No triangles left to use it, so it doesn't matter
+  if ( !remaining )
+    return -1.0f;
+
+  float score = 0.0f;
+  if ( cachePosition >= 0 ) {
+    // The last triangle's vertices get a fixed score so it's not
+    // just the most recent vertex that wins
+    if ( cachePosition < 3 )
+      score = 0.75f;
+    else
+      score = powf( 1.0f - (float)(cachePosition-3) / (FORSYTH_CACHE-3), 1.5f );
+  }
+
+  // Favour vertices with few triangles left, to finish them off
+  return score + 2.0f / sqrtf( (float)remaining );
+}
+
+// The triangles (count/3 of them) in vertex cache friendly order
+inline void optimizeVertexCache( const uint32_t *indices, size_t count, uint32_t vertices, std::vector<uint32_t> &order ) {
+
+  size_t triangles = count / 3;
+  order.clear();
+  order.reserve( triangles );
+  if ( !triangles )
+    return;
+
+  // Which triangles use each vertex (compressed adjacency lists)
+  std::vector<uint32_t> start( vertices+1, 0 ), remaining( vertices, 0 );
+  for ( size_t i=0; i<3*triangles; i++ )
+    start[ indices[i]+1 ]++;
+  for ( uint32_t v=0; v<vertices; v++ )
+    start[v+1] += start[v];
+
+  std::vector<uint32_t> adjacent( 3*triangles );
+  for ( size_t i=0; i<3*triangles; i++ ) {
+    uint32_t v = indices[i];
+    adjacent[ start[v] + remaining[v]++ ] = i / 3;
+  }
+
+  std::vector<float> vertexScore( vertices );
+  for ( uint32_t v=0; v<vertices; v++ )
+    vertexScore[v] = forsythScore( -1, remaining[v] );
+
+  std::vector<float> triangleScore( triangles );
+  std::vector<bool>  emitted( triangles, false );
+  for ( size_t t=0; t<triangles; t++ )
+    triangleScore[t] = vertexScore[indices[3*t]] + vertexScore[indices[3*t+1]] + vertexScore[indices[3*t+2]];
+
+  // The LRU cache, with room for the three new vertices at the front
+  std::vector<uint32_t> cache, next;
+  cache.reserve( FORSYTH_CACHE+3 );
+  next.reserve( FORSYTH_CACHE+3 );
+
+  size_t cursor = 0;   // for finding an unused triangle when the cache runs dry
+  int64_t best = 0;
+
+  // Nothing cached to start with... take the best triangle overall
+  for ( size_t t=1; t<triangles; t++ )
+    if ( triangleScore[t] > triangleScore[best] )
+      best = t;
+
+  while ( best >= 0 ) {
+
+    emitted[best] = true;
+    order.push_back( best );
+
+    // The triangle's vertices go to the front of the cache, and each has
+    // one triangle fewer to wait for
+    next.clear();
+    for ( uint k=0; k<3; k++ ) {
+      uint32_t v = indices[3*best+k];
+      if ( std::find( next.begin(), next.end(), v ) == next.end() )
+	next.push_back( v );
+
+      uint32_t *list = &adjacent[ start[v] ];
+      for ( uint32_t j=0; j<remaining[v]; j++ )
+	if ( list[j] == best ) {
+	  std::swap( list[j], list[remaining[v]-1] );
+	  break;
+	}
+      remaining[v]--;
+    }
+    uint fresh = next.size();
+    for ( uint i=0; i<cache.size(); i++ )
+      if ( std::find( next.begin(), next.begin()+fresh, cache[i] ) == next.begin()+fresh )
+	next.push_back( cache[i] );
+
+    // Rescore everything that moved in or out of the cache
+    for ( uint i=0; i<next.size(); i++ ) {
+      uint32_t v = next[i];
+      float score = forsythScore( ( i < FORSYTH_CACHE ) ? (int)i : -1, remaining[v] );
+      float delta = score - vertexScore[v];
+      vertexScore[v] = score;
+      for ( uint32_t j=0; j<remaining[v]; j++ )
+	triangleScore[ adjacent[start[v]+j] ] += delta;
+    }
+    if ( next.size() > FORSYTH_CACHE )
+      next.resize( FORSYTH_CACHE );
+    cache.swap( next );
+
+    // The next triangle is the best one touching the cache...
+    best = -1;
+    float bestScore = -1.0f;
+    for ( uint i=0; i<cache.size(); i++ ) {
+      uint32_t v = cache[i];
+      for ( uint32_t j=0; j<remaining[v]; j++ ) {
+	uint32_t t = adjacent[start[v]+j];
+	if ( triangleScore[t] > bestScore ) {
+	  bestScore = triangleScore[t];
+	  best = t;
+	}
+      }
+    }
+
+    // ... or if none do, the next one not drawn yet
+    if ( best < 0 ) {
+      while ( cursor < triangles && emitted[cursor] )
+	cursor++;
+      if ( cursor < triangles )
+	best = cursor;
+    }
+  }
+
+  return;
+}
+
+// Reorder whole clusters of an already cache-optimized order (positions
+// are every stride floats, as in an interleaved array). A cluster
+// ends where a triangle misses the cache on all three vertices, as long as
+// the cluster's own ACMR is within threshold of the whole list's, so the
+// cache gets at most that much worse
+inline void optimizeOverdraw( const uint32_t *indices, const float *positions, uint stride, std::vector<uint32_t> &order, float threshold=1.05f ) {
+
+  size_t triangles = order.size();
+  if ( triangles < 2 )
+    return;
+
+  uint32_t vertices = 0;
+  for ( size_t i=0; i<3*triangles; i++ )
+    vertices = std::max( vertices, indices[i]+1 );
+
+  std::vector<uint32_t> ordered( 3*triangles );
+  for ( size_t t=0; t<triangles; t++ )
+    for ( uint k=0; k<3; k++ )
+      ordered[3*t+k] = indices[3*order[t]+k];
+
+  float overall = analyzeVertexCache( ordered.data(), ordered.size(), vertices ).acmr;
+
+  // Find the cluster boundaries, simulating the same FIFO as the stats
+  std::vector<size_t> bounds( 1, 0 );
+  vertex_fifo         cache( vertices );
+  uint64_t            clusterMisses = 0;
+
+  for ( size_t t=0; t<triangles; t++ ) {
+    uint misses = 0;
+    for ( uint k=0; k<3; k++ )
+      if ( cache.miss( ordered[3*t+k] ) )
+	misses++;
+
+    size_t length = t - bounds.back();
+    if ( misses == 3 && length && (float)clusterMisses / length <= threshold * overall ) {
+      bounds.push_back( t );
+      clusterMisses = 0;
+    }
+    clusterMisses += misses;
+  }
+  bounds.push_back( triangles );
+
+  // Area weighted centre and normal of each cluster, and of the whole mesh
+  size_t clusters = bounds.size()-1;
+  std::vector<float> centre( 3*clusters, 0.0f ), normal( 3*clusters, 0.0f );
+  float middle[3] = {0.0f, 0.0f, 0.0f}, total = 0.0f;
+
+  for ( size_t c=0; c<clusters; c++ ) {
+    float area = 0.0f;
+    for ( size_t t=bounds[c]; t<bounds[c+1]; t++ ) {
+      const float *a = positions + stride*ordered[3*t], *b = positions + stride*ordered[3*t+1], *d = positions + stride*ordered[3*t+2];
+      float e1[3] = { b[0]-a[0], b[1]-a[1], b[2]-a[2] }, e2[3] = { d[0]-a[0], d[1]-a[1], d[2]-a[2] };
+      float n[3] = { e1[1]*e2[2] - e1[2]*e2[1], e1[2]*e2[0] - e1[0]*e2[2], e1[0]*e2[1] - e1[1]*e2[0] };
+      float w = sqrtf( n[0]*n[0] + n[1]*n[1] + n[2]*n[2] );
+
+      for ( uint k=0; k<3; k++ ) {
+	centre[3*c+k] += w * ( a[k] + b[k] + d[k] ) / 3.0f;
+	normal[3*c+k] += n[k];
+      }
+      area += w;
+    }
+
+    for ( uint k=0; k<3; k++ )
+      middle[k] += centre[3*c+k];
+    total += area;
+
+    if ( area > 0.0f )
+      for ( uint k=0; k<3; k++ )
+	centre[3*c+k] /= area;
+  }
+  if ( total > 0.0f )
+    for ( uint k=0; k<3; k++ )
+      middle[k] /= total;
+
+  // Clusters facing furthest out from the middle go first
+  std::vector<float>    facing( clusters );
+  std::vector<uint32_t> sorted( clusters );
+  for ( size_t c=0; c<clusters; c++ ) {
+    facing[c] = 0.0f;
+    for ( uint k=0; k<3; k++ )
+      facing[c] += ( centre[3*c+k] - middle[k] ) * normal[3*c+k];
+    sorted[c] = c;
+  }
+  std::stable_sort( sorted.begin(), sorted.end(), [&facing]( uint32_t a, uint32_t b ) { return facing[a] > facing[b]; } );
+
+  std::vector<uint32_t> result;
+  result.reserve( triangles );
+  for ( size_t i=0; i<clusters; i++ )
+    for ( size_t t=bounds[sorted[i]]; t<bounds[sorted[i]+1]; t++ )
+      result.push_back( order[t] );
+  order.swap( result );
+
+  return;
+}
+
+// New vertex numbers (remap[old] = new) in first-use order. Vertices
+// that are never used go at the end
+inline uint32_t optimizeVertexFetch( const uint32_t *indices, size_t count, uint32_t vertices, std::vector<uint32_t> &remap ) {
+
+  remap.assign( vertices, 0xFFFFFFFFu );
+  uint32_t next = 0;
+
+  for ( size_t i=0; i<count; i++ )
+    if ( remap[ indices[i] ] == 0xFFFFFFFFu )
+      remap[ indices[i] ] = next++;
+
+  uint32_t used = next;
+  for ( uint32_t v=0; v<vertices; v++ )
+    if ( remap[v] == 0xFFFFFFFFu )
+      remap[v] = next++;
+
+  return used;
+}
+
+#endif
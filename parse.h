@@ -0,0 +1,234 @@
+#ifndef __PARSE_H
+#define __PARSE_H 1
+
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <string>
+#include <stdint.h>
+#include <locale.h>
+
+#ifdef __DARWIN__
+#include <xlocale.h>
+#endif
+
+/*
+ *  parse.h : Number parsing for the OBJ/MTL readers. Works straight on
+ *            (pointer, end) ranges so nothing needs to be null terminated
+ *            or copied, ignores the current locale (OBJ always uses '.'),
+ *            and rounds correctly: the common case is done exactly in
+ *            double precision, anything that might round differently
+ *            from a true decimal -> float conversion is handed to the
+ *            C library (in the "C" locale)
+ */
+
+// Eight ASCII digits at a time, packed into one 64 bit word (SIMD within
+// a register). Only valid on little endian machines, everything else
+// takes the one-digit-at-a-time loop
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PARSE_SWAR 1
+#else
+#define PARSE_SWAR 0
+#endif
+
+inline bool isEightDigits( const char *p ) {
+  uint64_t val;
+  memcpy( &val, p, 8 );
+  return !( ((val + 0x4646464646464646ULL) | (val - 0x3030303030303030ULL)) & 0x8080808080808080ULL );
+}
+
+inline uint32_t parseEightDigits( const char *p ) {
+  uint64_t val;
+  memcpy( &val, p, 8 );
+
+  const uint64_t mask = 0x000000FF000000FFULL;
+  const uint64_t mul1 = 0x000F424000000064ULL; // 100 + (1000000 << 32)
+  const uint64_t mul2 = 0x0000271000000001ULL; // 1   + (10000   << 32)
+
+  val -= 0x3030303030303030ULL;
+  val  = (val * 10) + (val >> 8);
+  val  = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+  return (uint32_t)val;
+}
+
+// Accumulate a run of digits into m, keeping at most 19 significant
+// digits. Digits past that are counted in 'dropped' instead
+inline const char * scanDigits( const char *p, const char *end, uint64_t &m, int &digits, int &dropped ) {
+
+#if PARSE_SWAR
+  while ( digits > 0 && digits <= 11 && end - p >= 8 && isEightDigits(p) ) {
+    m = m * 100000000ULL + parseEightDigits(p);
+    digits += 8;
+    p += 8;
+  }
+#endif
+
+  for ( ; p < end && (uint8_t)(*p - '0') < 10; p++ ) {
+    if ( digits < 19 ) {
+      m = m*10 + (*p - '0');
+      if ( m )                    // leading zeros don't count
+	digits++;
+    } else
+      dropped++;
+  }
+  return p;
+}
+
+// Slow but always right: strtof in the "C" locale. 'used' says how
+// much of [start, end) made up the number
+inline bool parseFloatFallback( const char *start, const char *end, float &value, size_t &used ) {
+  static locale_t cLocale = newlocale( LC_ALL_MASK, "C", (locale_t)0 );
+
+  char buf[128];
+  std::string big;
+  const char *s = buf;
+  size_t n = end - start;
+
+  if ( n < sizeof(buf) ) {
+    memcpy( buf, start, n );
+    buf[n] = 0;
+  } else {
+    big.assign( start, n );
+    s = big.c_str();
+  }
+
+  char *stop;
+  value = strtof_l( s, &stop, cLocale );
+  used  = stop - s;
+  return used != 0;
+}
+
+// Parse a float from [p, end), leaving p just past the number
+inline bool parseFloat( const char *&p, const char *end, float &value ) {
+
+  static const double pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  const char *start = p;
+  const char *s = p;
+  bool neg = false;
+
+  if ( s < end && (*s == '-' || *s == '+') )
+    neg = ( *s++ == '-' );
+
+  uint64_t m = 0;
+  int digits = 0, exp10 = 0, intDropped = 0, fracDropped = 0;
+
+  const char *first = s;
+  s = scanDigits( s, end, m, digits, intDropped );
+  bool any = ( s != first );
+  exp10 += intDropped;
+
+  if ( s < end && *s == '.' ) {
+    s++;
+    const char *frac = s;
+    int before = digits;
+
+    // Leading zeros in the fraction only move the decimal point
+    if ( !m )
+      while ( s < end && *s == '0' ) {
+	s++;
+	exp10--;
+      }
+
+    s = scanDigits( s, end, m, digits, fracDropped );
+    exp10 -= (digits - before);     // dropped fraction digits don't scale anything
+    any = any || ( s != frac );
+  }
+
+  size_t used;
+  if ( !any ) {
+    // Not a plain decimal... might still be inf/nan
+    if ( !parseFloatFallback( start, end, value, used ) )
+      return false;
+    p = start + used;
+    return true;
+  }
+
+  if ( s < end && (*s == 'e' || *s == 'E') ) {
+    const char *e = s + 1;
+    bool eneg = false;
+    if ( e < end && (*e == '-' || *e == '+') )
+      eneg = ( *e++ == '-' );
+
+    if ( e < end && (uint8_t)(*e - '0') < 10 ) {
+      int x = 0;
+      for ( ; e < end && (uint8_t)(*e - '0') < 10; e++ )
+	if ( x < 100000 )
+	  x = x*10 + (*e - '0');
+      exp10 += eneg ? -x : x;
+      s = e;
+    }
+  }
+
+  if ( !m ) {
+    value = neg ? -0.0f : 0.0f;
+    p = s;
+    return true;
+  }
+
+  // Exact fast path: m and 10^|e| are both exact doubles, so one
+  // multiply or divide rounds once. The second rounding (down to
+  // float) can only go wrong if that lands exactly halfway between
+  // two floats, so anything sitting on a midpoint goes the slow way
+  if ( !intDropped && !fracDropped && m < (1ULL << 53) && exp10 >= -22 && exp10 <= 22 ) {
+
+    double d = (double)m;
+    d = ( exp10 < 0 ) ? d / pow10[-exp10] : d * pow10[exp10];
+
+    if ( d >= FLT_MIN && d <= FLT_MAX ) {
+      uint64_t bits;
+      memcpy( &bits, &d, 8 );
+      if ( (bits & 0x1FFFFFFFULL) != 0x10000000ULL ) {
+	value = (float)( neg ? -d : d );
+	p = s;
+	return true;
+      }
+    }
+  }
+
+  if ( !parseFloatFallback( start, s, value, used ) )
+    return false;
+  p = start + used;
+  return true;
+}
+
+// Parse a (signed) integer from [p, end), leaving p just past the number
+inline bool parseInteger( const char *&p, const char *end, int64_t &value ) {
+  const char *s = p;
+  bool neg = false;
+
+  if ( s < end && (*s == '-' || *s == '+') )
+    neg = ( *s++ == '-' );
+
+  uint64_t m = 0;
+  const char *first = s;
+
+#if PARSE_SWAR
+  if ( end - s >= 8 && isEightDigits(s) ) {
+    m = parseEightDigits(s);
+    s += 8;
+  }
+#endif
+
+  for ( ; s < end && (uint8_t)(*s - '0') < 10; s++ )
+    m = m*10 + (*s - '0');
+
+  if ( s == first )
+    return false;
+
+  value = neg ? -(int64_t)m : (int64_t)m;
+  p = s;
+  return true;
+}
+
+// Step over blanks (not end of lines)
+inline const char * skipBlanks( const char *p, const char *end ) {
+  while ( p < end && (*p == ' ' || *p == '\t' || *p == '\r') )
+    p++;
+  return p;
+}
+
+#endif
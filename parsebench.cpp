@@ -0,0 +1,120 @@
+#include <reader.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+/*
+ * parsebench.cpp : How fast the number parsing in parse.h and reader.h
+ *                  gets through v and f records, against the per-line
+ *                  sscanf it replaced. The records are made up in memory
+ *                  (so the disk doesn't come into it): vertices with six
+ *                  decimals, triangles as v/vt/vn corners.
+ *
+ *   usage: parsebench [records]
+ */
+
+static double seconds( chrono::steady_clock::time_point since ) {
+  return chrono::duration<double>( chrono::steady_clock::now() - since ).count();
+}
+
+// Each line of text (without its newline), as the loader sees them
+static vector <token> lines( const string &text ) {
+  vector <token> all;
+  const char *p = text.data(), *end = p + text.size();
+  while ( p < end ) {
+    const char *eol = (const char *)memchr( p, '\n', end - p );
+    if ( !eol )
+      eol = end;
+    token t = { p, (size_t)( eol - p ) };
+    all.push_back( t );
+    p = eol + 1;
+  }
+  return all;
+}
+
+static void report( const char *what, uint64_t bytes, uint64_t records, double time ) {
+  cout << "  " << what << bytes / time / 1e6 << " MB/s, " << records / time / 1e6 << " M records/s\n";
+  return;
+}
+
+int main( int argc, char **argv ) {
+
+  uint64_t count = ( argc > 1 ) ? strtoull( argv[1], 0x0, 10 ) : 2000000;
+
+  mt19937 random( 1 );
+  uniform_real_distribution <float> coordinate( -1000.0f, 1000.0f );
+  uniform_int_distribution <int> index( 1, (int)count );
+
+  string vertices, faces;
+  char buf[128];
+  for ( uint64_t i=0; i<count; i++ ) {
+    snprintf( buf, sizeof(buf), "v %.6f %.6f %.6f\n", coordinate( random ), coordinate( random ), coordinate( random ) );
+    vertices += buf;
+    snprintf( buf, sizeof(buf), "f %d/%d/%d %d/%d/%d %d/%d/%d\n",
+	      index( random ), index( random ), index( random ), index( random ), index( random ),
+	      index( random ), index( random ), index( random ), index( random ) );
+    faces += buf;
+  }
+  vector <token> v = lines( vertices ), f = lines( faces );
+
+  // v records
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  double sum = 0.0;
+  for ( uint64_t i=0; i<v.size(); i++ ) {
+    token rest = { v[i].ptr + 1, v[i].len - 1 };
+    vec p = parseVector( rest );
+    sum += p.x + p.y + p.z;
+  }
+  double fast = seconds( start );
+
+  start = chrono::steady_clock::now();
+  double check = 0.0;
+  for ( uint64_t i=0; i<v.size(); i++ ) {
+    string line( v[i].ptr + 1, v[i].len - 1 );
+    vec p = {0.0f, 0.0f, 0.0f};
+    sscanf( line.c_str(), " %f %f %f", &p.x, &p.y, &p.z );
+    check += p.x + p.y + p.z;
+  }
+  double slow = seconds( start );
+
+  cout << count << " v records, " << vertices.size() << " bytes" << ( sum == check ? "" : " (RESULTS DIFFER)" ) << "\n";
+  report( "parseVector: ", vertices.size(), count, fast );
+  report( "sscanf:      ", vertices.size(), count, slow );
+
+  // f records
+  vector <int64_t> idx;
+  bool good;
+  int64_t total = 0;
+  start = chrono::steady_clock::now();
+  for ( uint64_t i=0; i<f.size(); i++ ) {
+    token rest = { f[i].ptr + 1, f[i].len - 1 };
+    uint corners = parseFace( rest, idx, good );
+    for ( uint k=0; k<3*corners; k++ )
+      total += idx[k];
+  }
+  fast = seconds( start );
+
+  start = chrono::steady_clock::now();
+  int64_t expect = 0;
+  for ( uint64_t i=0; i<f.size(); i++ ) {
+    string line( f[i].ptr + 1, f[i].len - 1 );
+    int c[9];
+    sscanf( line.c_str(), "%i/%i/%i %i/%i/%i %i/%i/%i", c, c+1, c+2, c+3, c+4, c+5, c+6, c+7, c+8 );
+    for ( uint k=0; k<9; k++ )
+      expect += c[k];
+  }
+  slow = seconds( start );
+
+  cout << count << " f records, " << faces.size() << " bytes" << ( total == expect ? "" : " (RESULTS DIFFER)" ) << "\n";
+  report( "parseFace:   ", faces.size(), count, fast );
+  report( "sscanf:      ", faces.size(), count, slow );
+
+  return 0;
+}
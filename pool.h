@@ -0,0 +1,142 @@
+#ifndef __POOL_H
+#define __POOL_H 1
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdint.h>
+
+#include <vertex.h>
+
+/*
+ *  pool.h : Contiguous, growable, heap backed storage for plain old data
+ *           (the vec's holding vertices, normals and texture coordinates
+ *           while a model loads). Indexed with 64 bits so there's no
+ *           ceiling short of memory, grown with realloc so big pools can
+ *           be moved by the kernel instead of copied, and reset() keeps
+ *           the memory around so one pool can serve load after load
+ */
+
+template <class T> class pool {
+
+ public:
+
+  pool(void) {
+    items    = 0x0;
+    count    = 0;
+    capacity = 0;
+    return;
+  }
+
+  ~pool(void) {
+    release();
+    return;
+  }
+
+  T & operator [] ( uint64_t i ) {
+    return items[i];
+  }
+
+  const T & operator [] ( uint64_t i ) const {
+    return items[i];
+  }
+
+  void push_back( const T &item ) {
+    if ( count == capacity )
+      grow( count+1 );
+    items[count++] = item;
+    return;
+  }
+
+  void append( const T *first, uint64_t n ) {
+    if ( !n )
+      return;
+    if ( count + n > capacity )
+      grow( count+n );
+    memcpy( (void *)(items + count), (const void *)first, n * sizeof(T) );
+    count += n;
+    return;
+  }
+
+  void reserve( uint64_t n ) {
+    if ( n > capacity )
+      resize( n );
+    return;
+  }
+
+  // Empty the pool, but hang on to the memory for next time
+  void reset( void ) {
+    count = 0;
+    return;
+  }
+
+  // Empty the pool and give the memory back
+  void release( void ) {
+    free( items );
+    items    = 0x0;
+    count    = 0;
+    capacity = 0;
+    return;
+  }
+
+  uint64_t size       ( void ) const { return this->count;    }
+  uint64_t getCapacity( void ) const { return this->capacity; }
+  bool     empty      ( void ) const { return this->count == 0; }
+  T *      data       ( void )       { return this->items;    }
+
+ protected:
+  T       *items;
+  uint64_t count;
+  uint64_t capacity;
+
+  // Double while small, then grow by half again so a pool holding
+  // hundreds of millions of entries doesn't overshoot by gigabytes
+  void grow( uint64_t needed ) {
+    uint64_t n = capacity ? capacity : 1024;
+    while ( n < needed )
+      n = ( n < (1ULL << 24) ) ? n*2 : n + n/2;
+    resize( n );
+    return;
+  }
+
+  void resize( uint64_t n ) {
+    T *p = (T *)realloc( (void *)items, n * sizeof(T) );
+    if ( !p )
+      throw std::bad_alloc();
+    items    = p;
+    capacity = n;
+    return;
+  }
+
+ private:
+  pool( const pool & );
+  pool & operator = ( const pool & );
+
+};
+
+/*
+ *  attribute_pools: the three lists of OBJ attributes. Hand the same set
+ *                   to several loads (see load_options) to reuse the memory
+ */
+
+struct attribute_pools {
+  pool <vec> V;  // object vertices
+  pool <vec> N;  // vertex normals
+  pool <vec> T;  // texture coordinates
+
+  void reset( void ) {
+    V.reset();
+    N.reset();
+    T.reset();
+    return;
+  }
+
+  void release( void ) {
+    V.release();
+    N.release();
+    T.release();
+    return;
+  }
+};
+
+#endif
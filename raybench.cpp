@@ -0,0 +1,86 @@
+#include <model.h>
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <omp.h>
+
+using namespace std;
+
+/*
+ * raybench.cpp : How fast a model's BVH (see bvh.h) answers rays, on one
+ *                core and on all of them. Rays start on a sphere around
+ *                the model and aim at random points in its box, so most
+ *                of them hit something.
+ *
+ *   usage: raybench <file.obj> [rays]
+ */
+
+static double seconds( chrono::steady_clock::time_point since ) {
+  return chrono::duration<double>( chrono::steady_clock::now() - since ).count();
+}
+
+int main( int argc, char **argv ) {
+
+  if ( argc < 2 ) {
+    cout << "usage: " << argv[0] << " <file.obj> [rays]\n";
+    return 1;
+  }
+  uint64_t count = ( argc > 2 ) ? strtoull( argv[2], 0x0, 10 ) : 1000000;
+
+  load_options options;
+  options.parallel = true;
+  model m( argv[1], "", options );
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  const bvh &tree = m.buildBVH();
+  cout << tree.getNumberOfTriangles() << " triangles, " << tree.getNumberOfNodes() << " nodes, "
+       << tree.getMemoryBytes() << " bytes, built in " << seconds( start ) << " s\n";
+
+  bounds b = m.getBounds();
+  if ( b.empty || !tree.getNumberOfTriangles() )
+    return 1;
+
+  mt19937 random( 1 );
+  uniform_real_distribution <float> unit( 0.0f, 1.0f );
+  vector <ray> rays( count );
+
+  for ( uint64_t i=0; i<count; i++ ) {
+    float z = 2.0f*unit( random ) - 1.0f, a = 2.0f*(float)M_PI*unit( random ), s = sqrtf( 1.0f - z*z );
+    float r = 1.5f * b.radius;
+    vec o = { b.center.x + r*s*cosf( a ), b.center.y + r*s*sinf( a ), b.center.z + r*z };
+    vec p = { b.min.x + unit( random )*( b.max.x - b.min.x ),
+	      b.min.y + unit( random )*( b.max.y - b.min.y ),
+	      b.min.z + unit( random )*( b.max.z - b.min.z ) };
+    rays[i] = ray( o, p - o );
+  }
+
+  int cores = omp_get_max_threads();
+  int runs[2] = { 1, cores };
+  vector <ray_hit> hits;
+
+  for ( uint k=0; k < ( cores > 1 ? 2u : 1u ); k++ ) {
+
+    start = chrono::steady_clock::now();
+    tree.raycast( rays, hits, runs[k] );
+    double nearest = seconds( start );
+
+    uint64_t hit = 0;
+    for ( uint64_t i=0; i<count; i++ )
+      hit += hits[i].object != RAY_MISS;
+
+    start = chrono::steady_clock::now();
+    uint64_t any = 0;
+    #pragma omp parallel for schedule(dynamic,256) num_threads(runs[k]) reduction(+:any)
+    for ( int64_t i=0; i<(int64_t)count; i++ )
+      any += tree.anyHit( rays[i] );
+    double shadow = seconds( start );
+
+    cout << runs[k] << ( runs[k] == 1 ? " thread:  " : " threads: " )
+	 << count / nearest / 1e6 << " M rays/s nearest (" << hit << " hit), "
+	 << count / shadow / 1e6 << " M rays/s any (" << any << " hit)\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,336 @@
+#ifndef __READER_H
+#define __READER_H 1
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <parse.h>
+#include <vertex.h>
+
+/*
+ *  struct token: a (pointer, length) window into a reader's buffer.
+ *                Nothing is copied, so a token is only good for as
+ *                long as the reader it came from stays open
+ */
+
+struct token {
+  const char *ptr;
+  size_t      len;
+
+  bool empty( void ) const {
+    return len == 0;
+  }
+
+  char operator [] ( size_t i ) const {
+    return ( i < len ) ? ptr[i] : 0;
+  }
+
+  bool equals( const char *s ) const {
+    size_t n = strlen(s);
+    return n == len && !memcmp( ptr, s, n );
+  }
+
+  bool startsWith( const char *s ) const {
+    size_t n = strlen(s);
+    return n <= len && !memcmp( ptr, s, n );
+  }
+
+  std::string str( void ) const {
+    return std::string( ptr, len );
+  }
+
+  // Drop leading and trailing white space
+  token & trim( void ) {
+    while ( len && isBlank(*ptr) ) {
+      ptr++;
+      len--;
+    }
+    while ( len && isBlank(ptr[len-1]) )
+      len--;
+    return (*this);
+  }
+
+  // Split the next white space delimited word off the front of this token
+  bool nextWord( token &word ) {
+    while ( len && isBlank(*ptr) ) {
+      ptr++;
+      len--;
+    }
+    if ( !len )
+      return false;
+
+    word.ptr = ptr;
+    word.len = 0;
+    while ( word.len < len && !isBlank(ptr[word.len]) )
+      word.len++;
+
+    ptr += word.len;
+    len -= word.len;
+    return true;
+  }
+
+  // Convert the token to a number (see parse.h)
+  float toFloat( void ) const {
+    const char *p = ptr;
+    float value = 0.0f;
+    parseFloat( p, ptr+len, value );
+    return value;
+  }
+
+  long toInt( void ) const {
+    const char *p = ptr;
+    int64_t value = 0;
+    parseInteger( p, ptr+len, value );
+    return value;
+  }
+
+  static bool isBlank( char c ) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+  }
+};
+
+/*
+ *  The OBJ records' numbers, off the tokens a reader hands out
+ */
+
+// Parse one "v", "v/vt", "v//vn" or "v/vt/vn" corner of a face line.
+// Missing indices come back as 0 which is never a valid OBJ index
+inline bool parseFaceVertex( const token &w, int64_t *idx ) {
+
+  const char *p = w.ptr, *end = w.ptr + w.len;
+
+  idx[0] = idx[1] = idx[2] = 0;
+  if ( !parseInteger( p, end, idx[0] ) )
+    return false;
+
+  if ( p < end && *p == '/' ) {
+    p++;
+    if ( p < end && *p != '/' && !parseInteger( p, end, idx[1] ) )
+      return false;
+
+    if ( p < end && *p == '/' ) {
+      p++;
+      if ( !parseInteger( p, end, idx[2] ) )
+	return false;
+    }
+  }
+
+  return p == end;
+}
+
+// Split a face line into its corners, three indices (v, vt, vn) apiece.
+// Returns the number of corners, 'good' says whether they all made sense
+inline uint parseFace( token line, std::vector <int64_t> &idx, bool &good ) {
+  token word;
+  uint  corners = 0;
+
+  good = true;
+  idx.clear();
+  while ( line.nextWord( word ) ) {
+    idx.resize( 3*(corners+1) );
+    good = parseFaceVertex( word, &idx[3*corners] ) && good;
+    corners++;
+  }
+  return corners;
+}
+
+// Read up to three numbers off what's left of a v/vt/vn line
+inline vec parseVector( const token &line ) {
+  vec   v = {0.0f, 0.0f, 0.0f};
+  float *c[3] = { &v.x, &v.y, &v.z };
+
+  const char *p = line.ptr, *end = line.ptr + line.len;
+  for ( uint i=0; i<3; i++ ) {
+    p = skipBlanks( p, end );
+    if ( !parseFloat( p, end, *c[i] ) )
+      break;
+  }
+
+  return v;
+}
+
+/*
+ *  reader.h : Read-only view of a whole text file. Regular files are
+ *             memory mapped and scanned in place, anything that can't
+ *             be mapped (pipes, fifos, /dev/stdin, ...) is read into
+ *             a buffer instead. Lines come back as tokens pointing
+ *             straight into the file data
+ */
+
+class reader {
+
+ public:
+
+  reader(void) {
+    buffer = 0x0;
+    size   = 0;
+    pos    = 0;
+    released = 0;
+    mapped = false;
+    opened = false;
+    return;
+  }
+
+  reader( std::string file ) {
+    buffer = 0x0;
+    size   = 0;
+    pos    = 0;
+    released = 0;
+    mapped = false;
+    opened = false;
+    open( file );
+    return;
+  }
+
+  ~reader(void) {
+    close();
+    return;
+  }
+
+  bool open( std::string file ) {
+
+    close();
+
+    int fd = ::open( file.c_str(), O_RDONLY );
+    if ( fd < 0 )
+      return false;
+
+    struct stat st;
+    if ( fstat( fd, &st ) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 ) {
+
+      void *p = mmap( 0x0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      if ( p != MAP_FAILED ) {
+	madvise( p, st.st_size, MADV_SEQUENTIAL );
+	buffer = (const char *)p;
+	size   = st.st_size;
+	mapped = true;
+	opened = true;
+	::close( fd );
+	return true;
+      }
+    }
+
+    // Can't map it... fall back on plain buffered reads
+    char chunk[65536];
+    ssize_t n;
+    while ( (n = ::read( fd, chunk, sizeof(chunk) )) > 0 || (n < 0 && errno == EINTR) ) {
+      if ( n > 0 )
+	storage.insert( storage.end(), chunk, chunk+n );
+    }
+    ::close( fd );
+
+    if ( n < 0 ) {
+      storage.clear();
+      return false;
+    }
+
+    buffer = storage.data();
+    size   = storage.size();
+    opened = true;
+    return true;
+  }
+
+  void close( void ) {
+    if ( mapped && buffer )
+      munmap( (void *)buffer, size );
+
+    std::vector<char>().swap( storage );
+    buffer = 0x0;
+    size   = 0;
+    pos    = 0;
+    released = 0;
+    mapped = false;
+    opened = false;
+    return;
+  }
+
+  bool isOpen( void ) {
+    return this->opened;
+  }
+
+  // Hand back the next line (without its end of line characters)
+  bool getLine( token &line ) {
+
+    if ( pos >= size )
+      return false;
+
+    const char *p = buffer + pos;
+    nextLine( p, buffer + size, line );
+    pos = p - buffer;
+
+    return true;
+  }
+
+  // Same thing for an arbitrary [p, end) window of the buffer, so
+  // pieces of one file can be worked through independently
+  static void nextLine( const char *&p, const char *end, token &line ) {
+
+    const char *stop = (const char *)memchr( p, '\n', end - p );
+
+    line.ptr = p;
+    if ( !stop ) {
+      line.len = end - p;
+      p = end;
+    } else {
+      line.len = stop - p;
+      p = stop + 1;
+    }
+
+    if ( line.len && line.ptr[line.len-1] == '\r' )
+      line.len--;
+
+    return;
+  }
+
+  void rewind( void ) {
+    pos = 0;
+    released = 0;
+  }
+
+  // Let the kernel drop the pages we've already read past, so a long
+  // sequential read doesn't keep the whole file resident. Any tokens
+  // pointing before the current position are invalid afterwards
+  void release( void ) {
+    if ( !mapped )
+      return;
+
+    size_t page = sysconf( _SC_PAGESIZE );
+    size_t stop = (pos / page) * page;
+    if ( stop > released ) {
+      madvise( (void *)(buffer + released), stop - released, MADV_DONTNEED );
+      released = stop;
+    }
+    return;
+  }
+
+  const char * getData     ( void ) { return this->buffer; }
+  size_t       getSize     ( void ) { return this->size;   }
+  size_t       getPosition ( void ) { return this->pos;    }
+  bool         isMapped    ( void ) { return this->mapped; }
+
+ protected:
+  const char *buffer;
+  size_t      size;
+  size_t      pos;
+  size_t      released;
+  bool        mapped;
+  bool        opened;
+
+  std::vector<char> storage;
+
+ private:
+  reader( const reader & );
+  reader & operator = ( const reader & );
+
+};
+
+#endif
@@ -0,0 +1,678 @@
+#include <simplify.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+ * simplify.cpp : The edge collapses. A group's corners are first welded
+ *                into the points its surface is made of (same position
+ *                and texture coordinates), and the points at one position
+ *                linked up, so each can be told apart as inside the
+ *                surface, on an open edge, on a seam, or fixed. Every
+ *                position gets the quadric of the planes of the triangles
+ *                around it, and of walls standing up from its open and
+ *                seam edges. Then in passes: every edge is costed (across
+ *                the cores), the cheapest collapses are made as long as
+ *                nothing moves twice or onto what has moved, the surface
+ *                doesn't pinch and no triangle turns over (each checked
+ *                against the surface as the pass has left it so far), and
+ *                the triangles that vanish are dropped
+ */
+
+#define NO_POINT    0xFFFFFFFFu
+#define SHARED      0xFFFFFFFEu   // A position more than one group uses
+
+#define EDGE_WEIGHT 10.0f         // The wall at an open edge against a triangle's own plane, for the same size
+#define PASS_SLACK  1.5f          // How far past the cost of the collapses it needs a pass may go
+
+// What a point is, for what it may collapse onto
+#define INSIDE 0    // Every edge around it has a triangle either side
+#define OPEN   1    // On one open edge loop, so only moves along it
+#define SEAM   2    // On a seam with one other point at its position, likewise, both at once
+#define FIXED  3    // Anything else (corners of loops, where seams meet, locked)
+
+// What's happened to a position so far in a pass
+#define GONE   1    // Moved onto another
+#define GREW   2    // Had another moved onto it
+
+static const bool canCollapse[4][4] = {
+  { true,  true,  true,  true },    // Inside onto anything
+  { false, true,  false, true },    // Open onto open, or a fixed point on its loop
+  { false, false, true,  true },    // Seam onto seam, or a fixed point on it
+  { false, false, false, false }    // Fixed stays put
+};
+
+/*
+ *  struct quadric: the sum of the squared distances from a set of planes,
+ *                  each weighted, as a symmetric 4x4 matrix
+ */
+
+struct quadric {
+  float a00, a11, a22, a10, a20, a21;   // n n^T
+  float b0, b1, b2;                     // d n
+  float c;                              // d^2
+  float w;                              // What the weights come to
+
+  void clear( void ) {
+    a00 = a11 = a22 = a10 = a20 = a21 = b0 = b1 = b2 = c = w = 0.0f;
+  }
+
+  // The plane n.p + d = 0, n unit length
+  void plane( const float *n, float d, float weight ) {
+    a00 = weight * n[0] * n[0];
+    a11 = weight * n[1] * n[1];
+    a22 = weight * n[2] * n[2];
+    a10 = weight * n[1] * n[0];
+    a20 = weight * n[2] * n[0];
+    a21 = weight * n[2] * n[1];
+    b0  = weight * n[0] * d;
+    b1  = weight * n[1] * d;
+    b2  = weight * n[2] * d;
+    c   = weight * d * d;
+    w   = weight;
+  }
+
+  void add( const quadric &q ) {
+    a00 += q.a00;  a11 += q.a11;  a22 += q.a22;
+    a10 += q.a10;  a20 += q.a20;  a21 += q.a21;
+    b0  += q.b0;   b1  += q.b1;   b2  += q.b2;
+    c   += q.c;
+    w   += q.w;
+  }
+
+  // The weighted mean of the squared distances of p from the planes
+  float error( const float *p ) const {
+    float x = p[0], y = p[1], z = p[2];
+    float r = a00*x*x + a11*y*y + a22*z*z + 2.0f*( a10*x*y + a20*x*z + a21*y*z )
+            + 2.0f*( b0*x + b1*y + b2*z ) + c;
+    return ( w > 0.0f ) ? fabsf( r ) / w : 0.0f;
+  }
+};
+
+struct collapse {
+  uint32_t from, to;
+  float    cost;
+  bool     forward, back;    // Which ways it may go (from onto to, to onto from)
+};
+
+static uint64_t hashRow( const float *f, uint n ) {
+  uint64_t h = 1469598103934665603ULL;
+  for ( uint i=0; i<n; i++ ) {
+    uint32_t bits;
+    memcpy( &bits, f+i, sizeof(bits) );
+    h = ( h ^ bits ) * 1099511628211ULL;
+  }
+  return h ^ ( h >> 29 );
+}
+
+// Number the distinct rows of n floats (bit for bit, once any -0 in keys
+// is made 0): id[i] is row i's number, first[k] the first row with number k
+static uint32_t distinctRows( vector <float> &keys, uint n, vector <uint32_t> &id, vector <uint32_t> &first ) {
+
+  for ( size_t i=0; i<keys.size(); i++ )
+    if ( keys[i] == 0.0f )
+      keys[i] = 0.0f;
+
+  uint64_t rows = keys.size() / n;
+  size_t slots = 1024;
+  while ( slots < 2*rows )
+    slots *= 2;
+
+  vector <uint32_t> table( slots, NO_POINT );
+  id.resize( rows );
+  first.clear();
+
+  for ( uint64_t r=0; r<rows; r++ ) {
+    const float *key = &keys[n*r];
+    for ( size_t i = hashRow( key, n ) & (slots-1); ; i = (i+1) & (slots-1) ) {
+      if ( table[i] == NO_POINT ) {
+	table[i] = id[r] = first.size();
+	first.push_back( r );
+	break;
+      }
+      if ( !memcmp( &keys[ n*first[ table[i] ] ], key, n*sizeof(float) ) ) {
+	id[r] = table[i];
+	break;
+      }
+    }
+  }
+  return first.size();
+}
+
+static inline void cross( const float *a, const float *b, float *n ) {
+  n[0] = a[1]*b[2] - a[2]*b[1];
+  n[1] = a[2]*b[0] - a[0]*b[2];
+  n[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+static inline float dot( const float *a, const float *b ) {
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+/*
+ *  struct simplifier: one group's surface as it's being collapsed
+ */
+
+struct simplifier {
+
+  uint32_t points;
+  vector <float>    pos;       // Each point's position, scaled into the unit cube
+  vector <uint32_t> vertex;    // A vertex of the group's for each point
+  vector <uint32_t> remap;     // The first point at each point's position
+  vector <uint32_t> wedge;     // The points at one position, in a ring
+  vector <uint8_t>  kind;
+  vector <uint32_t> openOut;   // The next point along its open edge loop (NO_POINT if none, itself if several)
+  vector <uint32_t> openIn;    // ... and the one before
+  vector <quadric>  quadrics;  // By position (the first point there)
+
+  vector <uint32_t> tris;      // Three points a triangle
+  vector <uint32_t> corners;   // ... and the vertices they're drawn with
+  float worst;                 // The costliest collapse so far
+
+  // Scratch, kept from one pass to the next. Through a pass the triangles
+  // stay as they were: target says where each point has gone, and joined
+  // (then joinedNext) the positions moved onto each
+  vector <uint32_t> around, aroundStart;
+  vector <collapse> candidates;
+  vector <uint32_t> target;
+  vector <uint8_t>  changed;
+  vector <uint32_t> joined, joinedNext;
+  vector <uint32_t> seen;
+  uint32_t stamp;
+
+  uint64_t triangles( void ) const {
+    return this->tris.size() / 3;
+  }
+
+  // Is the edge from a to b open (a point on several loops keeps none of them)?
+  bool open( uint32_t a, uint32_t b ) const {
+    return this->openOut[a] == b || this->openIn[b] == a;
+  }
+
+  void classify( const vector <uint8_t> &locked ) {
+
+    // Every half edge, from each point
+    vector <uint32_t> start( this->points+1, 0 ), to( this->tris.size() );
+    for ( uint64_t c=0; c<this->tris.size(); c++ )
+      start[ this->tris[c]+1 ]++;
+    for ( uint32_t p=0; p<this->points; p++ )
+      start[p+1] += start[p];
+    vector <uint32_t> fill( start.begin(), start.end()-1 );
+    for ( uint64_t t=0; t<triangles(); t++ )
+      for ( uint k=0; k<3; k++ )
+	to[ fill[ this->tris[3*t+k] ]++ ] = this->tris[3*t+(k+1)%3];
+
+    // An edge with no twin running the other way is open
+    this->openOut.assign( this->points, NO_POINT );
+    this->openIn.assign( this->points, NO_POINT );
+    for ( uint32_t a=0; a<this->points; a++ )
+      for ( uint32_t i=start[a]; i<start[a+1]; i++ ) {
+	uint32_t b = to[i];
+	bool twin = false;
+	for ( uint32_t j=start[b]; j<start[b+1] && !twin; j++ )
+	  twin = to[j] == a;
+	if ( twin )
+	  continue;
+	this->openOut[a] = ( this->openOut[a] == NO_POINT ) ? b : a;
+	this->openIn[b]  = ( this->openIn[b]  == NO_POINT ) ? a : b;
+      }
+
+    this->kind.assign( this->points, FIXED );
+    for ( uint32_t p=0; p<this->points; p++ ) {
+      if ( this->remap[p] != p || locked[p] )
+	continue;
+
+      uint32_t out = this->openOut[p], in = this->openIn[p], w = this->wedge[p];
+      if ( w == p ) {
+	if ( out == NO_POINT && in == NO_POINT )
+	  this->kind[p] = INSIDE;
+	else if ( out != NO_POINT && in != NO_POINT && out != p && in != p )
+	  this->kind[p] = OPEN;
+      }
+
+      // Two points, each on one open loop, the loops running opposite ways
+      else if ( this->wedge[w] == p ) {
+	uint32_t wout = this->openOut[w], win = this->openIn[w];
+	bool single = out != NO_POINT && in != NO_POINT && out != p && in != p &&
+	              wout != NO_POINT && win != NO_POINT && wout != w && win != w;
+	if ( single && this->remap[out] == this->remap[win] && this->remap[in] == this->remap[wout] )
+	  this->kind[p] = SEAM;
+      }
+    }
+
+    // Every point at a position is the same kind
+    for ( uint32_t p=0; p<this->points; p++ )
+      this->kind[p] = this->kind[ this->remap[p] ];
+    return;
+  }
+
+  void fillQuadrics( void ) {
+
+    this->quadrics.resize( this->points );
+    for ( uint32_t p=0; p<this->points; p++ )
+      this->quadrics[p].clear();
+
+    quadric q;
+    for ( uint64_t t=0; t<triangles(); t++ ) {
+
+      // The triangle's plane, weighted by its area
+      const uint32_t *c = &this->tris[3*t];
+      const float *p0 = &this->pos[3*c[0]], *p1 = &this->pos[3*c[1]], *p2 = &this->pos[3*c[2]];
+      float e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] }, e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] }, n[3];
+      cross( e1, e2, n );
+      float area = sqrtf( dot( n, n ) );
+      if ( area > 0.0f ) {
+	for ( uint k=0; k<3; k++ )
+	  n[k] /= area;
+	q.plane( n, -dot( n, p0 ), 0.5f * area );
+	for ( uint k=0; k<3; k++ )
+	  this->quadrics[ this->remap[c[k]] ].add( q );
+      }
+
+      // Walls square to it along its open edges, so they stay where they are
+      for ( uint k=0; k<3; k++ ) {
+	uint32_t i0 = c[k], i1 = c[(k+1)%3], i2 = c[(k+2)%3];
+	if ( !open( i0, i1 ) )
+	  continue;
+
+	const float *a = &this->pos[3*i0], *b = &this->pos[3*i1], *d = &this->pos[3*i2];
+	float e[3] = { b[0]-a[0], b[1]-a[1], b[2]-a[2] }, f[3] = { d[0]-a[0], d[1]-a[1], d[2]-a[2] };
+	float length = sqrtf( dot( e, e ) );
+	if ( length == 0.0f )
+	  continue;
+	for ( uint j=0; j<3; j++ )
+	  e[j] /= length;
+	float along = dot( f, e );
+	for ( uint j=0; j<3; j++ )
+	  f[j] -= along * e[j];
+	float across = sqrtf( dot( f, f ) );
+	if ( across == 0.0f )
+	  continue;
+	for ( uint j=0; j<3; j++ )
+	  f[j] /= across;
+
+	q.plane( f, -dot( f, a ), EDGE_WEIGHT * length * length );
+	this->quadrics[ this->remap[i0] ].add( q );
+	this->quadrics[ this->remap[i1] ].add( q );
+      }
+    }
+    return;
+  }
+
+  // Call f with the points of each triangle around position r as they are
+  // now, part way through a pass (those that have lost an edge left out)
+  template <class F> void eachAround( uint32_t r, F f ) const {
+    for ( uint32_t m = r; m != NO_POINT; m = ( m == r ) ? this->joined[r] : this->joinedNext[m] )
+      for ( uint32_t i=this->aroundStart[m]; i<this->aroundStart[m+1]; i++ ) {
+	const uint32_t *t = &this->tris[ 3*this->around[i] ];
+	uint32_t c[3] = { this->target[t[0]], this->target[t[1]], this->target[t[2]] };
+	uint32_t a = this->remap[c[0]], b = this->remap[c[1]], d = this->remap[c[2]];
+	if ( a != b && b != d && a != d )
+	  f( c );
+      }
+  }
+
+  // Would moving the position r (the first point there) to point to turn
+  // any triangle around it over?
+  bool turnsOver( uint32_t r, uint32_t to ) const {
+
+    const float *moved = &this->pos[3*to];
+    uint32_t rt = this->remap[to];
+    bool over = false;
+
+    eachAround( r, [&]( const uint32_t *c ) {
+      uint k = 0;
+      while ( this->remap[c[k]] != r )
+	k++;
+      uint32_t x = c[(k+1)%3], y = c[(k+2)%3];
+      if ( over || this->remap[x] == rt || this->remap[y] == rt )
+	return;    // This one goes
+
+      const float *p = &this->pos[3*c[k]], *px = &this->pos[3*x], *py = &this->pos[3*y];
+      float ex[3] = { px[0]-p[0], px[1]-p[1], px[2]-p[2] }, ey[3] = { py[0]-p[0], py[1]-p[1], py[2]-p[2] };
+      float fx[3] = { px[0]-moved[0], px[1]-moved[1], px[2]-moved[2] }, fy[3] = { py[0]-moved[0], py[1]-moved[1], py[2]-moved[2] };
+      float before[3], after[3];
+      cross( ex, ey, before );
+      cross( fx, fy, after );
+      over = dot( before, before ) > 0.0f && dot( before, after ) <= 0.0f;
+    } );
+    return over;
+  }
+
+  // Would moving position r0 onto point to pinch the surface, joining
+  // triangles beyond the ones on the edge (which go) into a fold or a fin?
+  // Only the points across the edge may neighbour both. Nor may a triangle
+  // end up with nothing but open, seam or fixed corners: it would span an
+  // edge loop (or where groups meet, and the next group could do the same)
+  bool pinches( uint32_t r0, uint32_t to ) {
+
+    uint32_t r1 = this->remap[to], shared = 0, common = 0;
+    bool spans = false;
+
+    this->stamp++;
+    eachAround( r1, [&]( const uint32_t *c ) {
+      for ( uint k=0; k<3; k++ )
+	this->seen[ this->remap[c[k]] ] = this->stamp;
+    } );
+
+    eachAround( r0, [&]( const uint32_t *c ) {
+      uint k = 0;
+      while ( this->remap[c[k]] != r0 )
+	k++;
+      uint32_t x = c[(k+1)%3], y = c[(k+2)%3], rx = this->remap[x], ry = this->remap[y];
+      if ( rx == r1 || ry == r1 )
+	shared++;
+      else if ( this->kind[to] != INSIDE && this->kind[x] != INSIDE && this->kind[y] != INSIDE )
+	spans = true;
+      if ( rx != r1 && this->seen[rx] == this->stamp ) {
+	this->seen[rx] = 0;
+	common++;
+      }
+      if ( ry != r1 && this->seen[ry] == this->stamp ) {
+	this->seen[ry] = 0;
+	common++;
+      }
+    } );
+    return spans || common > shared;
+  }
+
+  // One round of collapses, towards goal triangles. False if none could be made
+  bool pass( uint64_t goal ) {
+
+    // The triangles around each position
+    this->aroundStart.assign( this->points+1, 0 );
+    for ( uint64_t c=0; c<this->tris.size(); c++ )
+      this->aroundStart[ this->remap[ this->tris[c] ]+1 ]++;
+    for ( uint32_t p=0; p<this->points; p++ )
+      this->aroundStart[p+1] += this->aroundStart[p];
+    this->around.resize( this->tris.size() );
+    vector <uint32_t> fill( this->aroundStart.begin(), this->aroundStart.end()-1 );
+    for ( uint64_t c=0; c<this->tris.size(); c++ )
+      this->around[ fill[ this->remap[ this->tris[c] ] ]++ ] = c / 3;
+
+    // Every edge that could go, once (an edge inside the surface turns up
+    // in both its triangles, so only the way round going to the higher
+    // numbered position counts)
+    this->candidates.clear();
+    for ( uint64_t t=0; t<triangles(); t++ )
+      for ( uint k=0; k<3; k++ ) {
+	uint32_t i0 = this->tris[3*t+k], i1 = this->tris[3*t+(k+1)%3];
+	uint32_t r0 = this->remap[i0], r1 = this->remap[i1];
+	bool edge = open( i0, i1 );
+	if ( r0 == r1 || ( r0 > r1 && !edge ) )
+	  continue;
+
+	uint k0 = this->kind[i0], k1 = this->kind[i1];
+	bool along = edge || open( i1, i0 );
+	collapse c;
+	c.from = i0;
+	c.to = i1;
+	c.cost = FLT_MAX;
+	c.forward = canCollapse[k0][k1] && ( ( k0 != OPEN && k0 != SEAM ) || along );
+	c.back    = canCollapse[k1][k0] && ( ( k1 != OPEN && k1 != SEAM ) || along );
+	if ( c.forward || c.back )
+	  this->candidates.push_back( c );
+      }
+
+    // What each costs, the cheaper way round
+    int64_t n = this->candidates.size();
+    #pragma omp parallel for schedule(static)
+    for ( int64_t i=0; i<n; i++ ) {
+      collapse &c = this->candidates[i];
+      float forward = c.forward ? this->quadrics[ this->remap[c.from] ].error( &this->pos[3*c.to] ) : FLT_MAX;
+      float back    = c.back    ? this->quadrics[ this->remap[c.to] ].error( &this->pos[3*c.from] ) : FLT_MAX;
+      if ( back < forward )
+	std::swap( c.from, c.to );
+      c.cost = std::min( forward, back );
+    }
+
+    std::sort( this->candidates.begin(), this->candidates.end(),
+	       []( const collapse &a, const collapse &b ) { return a.cost < b.cost; } );
+
+    // Each collapse takes two triangles (one on an open edge). Many of the
+    // cheapest will be blocked by one before them, so go a little past
+    // what the ones needed cost
+    uint64_t remove = triangles() - goal, reach = remove/2;
+    float limit = ( reach < (uint64_t)n ) ? PASS_SLACK * this->candidates[reach].cost : FLT_MAX;
+
+    this->target.resize( this->points );
+    for ( uint32_t p=0; p<this->points; p++ )
+      this->target[p] = p;
+    this->changed.assign( this->points, 0 );
+    this->joined.assign( this->points, NO_POINT );
+    this->joinedNext.resize( this->points );
+    this->seen.assign( this->points, 0 );
+    this->stamp = 0;
+
+    uint64_t removed = 0, done = 0;
+    for ( int64_t i=0; i<n && removed < remove; i++ ) {
+      const collapse &c = this->candidates[i];
+      if ( c.cost == FLT_MAX || ( c.cost > limit && done ) )
+	break;
+
+      // Nothing moves twice in a pass, or onto what has moved, or after
+      // something has moved onto it (its quadric, so the cost, is out of date)
+      uint32_t i0 = c.from, i1 = c.to, r0 = this->remap[i0], r1 = this->remap[i1];
+      if ( this->changed[r0] || ( this->changed[r1] & GONE ) )
+	continue;
+
+      // A seam's other side goes the same way, to the point across from i1
+      uint32_t s0 = i0, s1 = i1;
+      if ( this->kind[i0] == SEAM ) {
+	s0 = this->wedge[i0];
+	s1 = ( this->openOut[i0] == i1 ) ? this->openIn[s0] : this->openOut[s0];
+      }
+
+      // One that can't be made at all leaves the ones needed further along
+      if ( s1 == NO_POINT || s1 == s0 || this->remap[s1] != r1 || pinches( r0, i1 ) || turnsOver( r0, i1 ) ) {
+	reach++;
+	limit = ( reach < (uint64_t)n ) ? PASS_SLACK * this->candidates[reach].cost : FLT_MAX;
+	continue;
+      }
+      this->target[s0] = s1;
+      this->target[i0] = i1;
+
+      this->quadrics[r1].add( this->quadrics[r0] );
+      this->changed[r0] |= GONE;
+      this->changed[r1] |= GREW;
+      this->joinedNext[r0] = this->joined[r1];
+      this->joined[r1] = r0;
+      this->worst = std::max( this->worst, c.cost );
+      removed += ( this->kind[i0] == OPEN ) ? 1 : 2;
+      done++;
+    }
+
+    if ( !done )
+      return false;
+
+    // The open loops skip the points that went (which may have gone onto
+    // the very point whose loop it was)
+    follow( this->openOut );
+    follow( this->openIn );
+
+    // Then the triangles, dropping those that have lost an edge
+    uint64_t kept = 0;
+    for ( uint64_t t=0; t<triangles(); t++ ) {
+      uint32_t c[3], v[3];
+      for ( uint k=0; k<3; k++ ) {
+	uint32_t p = this->tris[3*t+k];
+	c[k] = this->target[p];
+	v[k] = ( c[k] == p ) ? this->corners[3*t+k] : this->vertex[ c[k] ];
+      }
+      uint32_t a = this->remap[c[0]], b = this->remap[c[1]], d = this->remap[c[2]];
+      if ( a == b || b == d || a == d )
+	continue;
+      for ( uint k=0; k<3; k++ ) {
+	this->tris[3*kept+k] = c[k];
+	this->corners[3*kept+k] = v[k];
+      }
+      kept++;
+    }
+    this->tris.resize( 3*kept );
+    this->corners.resize( 3*kept );
+    return true;
+  }
+
+  void follow( vector <uint32_t> &loop ) {
+    vector <uint32_t> before( loop );
+    for ( uint32_t p=0; p<this->points; p++ ) {
+      uint32_t next = before[p];
+      if ( next == NO_POINT || next == p )
+	continue;
+      for ( uint hops=0; hops < 4 && this->target[next] == p; hops++ )
+	next = before[next];
+      loop[p] = this->target[next];
+    }
+    return;
+  }
+};
+
+uint generateLODs( group &g, uint levels, float ratio, const vector <bool> *locked ) {
+
+  g.clearLevels();
+
+  uint faces = g.getNumberOfFaces();
+  if ( !levels || !faces || ratio <= 0.0f || ratio >= 1.0f )
+    return 0;
+  for ( uint f=0; f<faces; f++ )
+    if ( g.getFaceSize( f ) != TRIANGLE )
+      return 0;
+
+  vertex_layout l = g.getLayout();
+  uint stride = l.stride(), tex = l.textures, texOffset = l.textureOffset(), n = 3 + tex;
+  const float *data = g.getInterleavedArray().data();
+  int64_t corners = g.getNumberOfCorners();
+  uint32_t vertices = g.getNumberOfVertices();
+
+  simplifier s;
+  s.worst = 0.0f;
+  s.corners.resize( corners );
+
+  // The points: corners with the same position and texture coordinates
+  vector <float> keys( n*corners );
+  #pragma omp parallel for schedule(static)
+  for ( int64_t c=0; c<corners; c++ ) {
+    uint32_t v = g.isIndexed() ? g.getIndex( c ) : c;
+    s.corners[c] = v;
+    memcpy( &keys[n*c], data + stride*v, 3*sizeof(float) );
+    memcpy( &keys[n*c+3], data + stride*v + texOffset, tex*sizeof(float) );
+  }
+
+  vector <uint32_t> first;
+  s.points = distinctRows( keys, n, s.tris, first );
+  s.vertex.resize( s.points );
+  for ( uint32_t p=0; p<s.points; p++ )
+    s.vertex[p] = s.corners[ first[p] ];
+  vector <float>().swap( keys );
+
+  // ... and the points at each position, ringed together
+  vector <float> where( 3*s.points );
+  for ( uint32_t p=0; p<s.points; p++ )
+    memcpy( &where[3*p], data + stride*s.vertex[p], 3*sizeof(float) );
+  vector <uint32_t> position, firstPoint;
+  distinctRows( where, 3, position, firstPoint );
+
+  s.remap.resize( s.points );
+  s.wedge.resize( s.points );
+  for ( uint32_t p=0; p<s.points; p++ ) {
+    uint32_t r = firstPoint[ position[p] ];
+    s.remap[p] = r;
+    s.wedge[p] = ( r == p ) ? p : s.wedge[r];
+    if ( r != p )
+      s.wedge[r] = p;
+  }
+
+  // Scaled into the unit cube, to keep the quadrics' floats happy
+  bounds box = boundsOf( where.data(), s.points, 3 );
+  float extent = fmaxf( box.max.x - box.min.x, fmaxf( box.max.y - box.min.y, box.max.z - box.min.z ) );
+  float scale = ( extent > 0.0f ) ? 1.0f/extent : 0.0f;
+  s.pos.resize( 3*s.points );
+  for ( uint32_t p=0; p<s.points; p++ ) {
+    s.pos[3*p]   = ( where[3*p]   - box.min.x ) * scale;
+    s.pos[3*p+1] = ( where[3*p+1] - box.min.y ) * scale;
+    s.pos[3*p+2] = ( where[3*p+2] - box.min.z ) * scale;
+  }
+
+  vector <uint8_t> fixed( s.points, 0 );
+  if ( locked && locked->size() == vertices )
+    for ( int64_t c=0; c<corners; c++ )
+      if ( (*locked)[ s.corners[c] ] )
+	fixed[ s.remap[ s.tris[c] ] ] = 1;
+
+  s.classify( fixed );
+  s.fillQuadrics();
+
+  // Down through the levels, each one from where the last left off
+  uint made = 0;
+  for ( uint level=0; level<levels; level++ ) {
+
+    uint64_t start = s.triangles(), goal = (uint64_t)( start * ratio );
+    while ( s.triangles() > goal && s.pass( goal ) )
+      continue;
+
+    // Not even halfway there, so it's as simple as it gets
+    uint64_t count = s.triangles();
+    if ( !count || count == start || count > start - ( start - goal )/2 )
+      break;
+
+    // In vertex cache order, as the group itself may be (see optimize.h)
+    vector <uint32_t> order, tris( 3*count );
+    optimizeVertexCache( s.corners.data(), s.corners.size(), vertices, order );
+    for ( uint64_t t=0; t<count; t++ )
+      for ( uint k=0; k<3; k++ )
+	tris[3*t+k] = s.corners[ 3*order[t]+k ];
+
+    g.addLevel( tris, sqrtf( s.worst ) * extent );
+    made++;
+  }
+
+  return made;
+}
+
+void generateLODs( object &o, uint levels, float ratio ) {
+
+  uint groups = o.getNumberOfGroups();
+  if ( groups == 1 )
+    generateLODs( *o.getGroup( 0 ), levels, ratio );
+  if ( groups <= 1 )
+    return;
+
+  // Every position, and which group it's from
+  vector <float> keys;
+  vector <uint32_t> owner, start( 1, 0 );
+  for ( uint j=0; j<groups; j++ ) {
+    const group *g = o.getGroup( j );
+    const float *data = g->getInterleavedArray().data();
+    uint stride = g->getLayout().stride();
+    for ( uint64_t v=0; v<g->getNumberOfVertices(); v++ ) {
+      keys.insert( keys.end(), data + stride*v, data + stride*v + 3 );
+      owner.push_back( j );
+    }
+    start.push_back( owner.size() );
+  }
+
+  vector <uint32_t> id, first;
+  uint32_t positions = distinctRows( keys, 3, id, first );
+  vector <float>().swap( keys );
+
+  vector <uint32_t> by( positions, NO_POINT );
+  for ( uint64_t i=0; i<owner.size(); i++ ) {
+    uint32_t &b = by[ id[i] ];
+    b = ( b == NO_POINT || b == owner[i] ) ? owner[i] : SHARED;
+  }
+
+  // Where groups meet stays put
+  for ( uint j=0; j<groups; j++ ) {
+    vector <bool> locked( start[j+1] - start[j] );
+    for ( uint64_t i=start[j]; i<start[j+1]; i++ )
+      locked[ i - start[j] ] = by[ id[i] ] == SHARED;
+    generateLODs( *o.getGroup( j ), levels, ratio, &locked );
+  }
+  return;
+}
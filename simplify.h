@@ -0,0 +1,35 @@
+#ifndef __SIMPLIFY_H
+#define __SIMPLIFY_H 1
+
+#include <object.h>
+#include <vector>
+
+/*
+ *  simplify.h : Levels of detail (see lod.h) by quadric error edge
+ *               collapse, after Garland and Heckbert. Each collapse
+ *               moves a vertex onto a neighbour, so every level is a
+ *               triangle list over vertices the group already has, and
+ *               the levels are taken one after another from a single
+ *               run: the error kept with each is the most any collapse
+ *               up to then cost, measured against the full surface.
+ *               Vertices at the same position with different texture
+ *               coordinates (UV seams) only collapse along the seam, both
+ *               sides together, open edges only along themselves, and
+ *               where groups (so materials) of an object meet nothing
+ *               moves at all. Normals and tangents aren't kept apart:
+ *               hard edges and flat faces simplify like any others, the
+ *               quadrics holding on to real creases. Only groups of
+ *               triangles are simplified (see load_options::triangulate)
+ */
+
+// A chain of up to levels ever coarser versions of the group, each with
+// about ratio of the triangles of the one before, replacing any it had.
+// Stops early once it can't get anywhere near that. locked, if given,
+// marks vertices (by number) that must stay put. Returns how many it made
+uint generateLODs( group &g, uint levels, float ratio=0.5f, const std::vector <bool> *locked=0x0 );
+
+// Every group of the object, holding the vertices groups share in place
+// so neighbouring groups still meet at every level
+void generateLODs( object &o, uint levels, float ratio=0.5f );
+
+#endif
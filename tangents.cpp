@@ -0,0 +1,217 @@
+#include <tangents.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+ * tangents.cpp : The tangent pass. A group's corners are gathered into
+ *                flat arrays, every face gets its texture space tangent
+ *                and which way round it's mapped, every corner what it
+ *                adds to its vertex, and then the corners sharing a
+ *                vertex (bit for bit, and mapped the same way round) are
+ *                summed, the faces and corners shared out across the cores
+ */
+
+#define NO_VERTEX_SET 0xFFFFFFFFu
+
+static uint64_t hashCorner( const float *f, uint n, bool flip ) {
+  uint64_t h = 1469598103934665603ULL ^ flip;
+  for ( uint i=0; i<n; i++ ) {
+    uint32_t bits;
+    memcpy( &bits, f+i, sizeof(bits) );
+    h = ( h ^ bits ) * 1099511628211ULL;
+  }
+  return h ^ ( h >> 29 );
+}
+
+// Number the sets of corners that share a vertex and a mapping, and give
+// each corner its set's number
+static uint32_t shareCorners( const group &g, const vector <uint8_t> &flip, vector <uint32_t> &set ) {
+
+  uint64_t corners = flip.size();
+  uint n = g.getLayout().tangentOffset();    // leave out any old tangent
+  size_t slots = 1024;
+  while ( slots < 2*corners )
+    slots *= 2;
+
+  vector <uint32_t> table( slots, NO_VERTEX_SET );
+  vector <uint64_t> first;    // a corner in each set
+  set.resize( corners );
+
+  for ( uint64_t c=0; c<corners; c++ ) {
+    const float *key = g.getCornerData( c );
+    for ( size_t i = hashCorner( key, n, flip[c] ) & (slots-1); ; i = (i+1) & (slots-1) ) {
+
+      if ( table[i] == NO_VERTEX_SET ) {
+	table[i] = set[c] = first.size();
+	first.push_back( c );
+	break;
+      }
+
+      uint64_t k = first[ table[i] ];
+      if ( flip[k] == flip[c] && !memcmp( g.getCornerData( k ), key, n*sizeof(float) ) ) {
+	set[c] = table[i];
+	break;
+      }
+    }
+  }
+  return first.size();
+}
+
+// v less its part along the unit vector n, made unit length (or zero)
+static void project( float &x, float &y, float &z, float nx, float ny, float nz ) {
+  float d = x*nx + y*ny + z*nz;
+  x -= d*nx;
+  y -= d*ny;
+  z -= d*nz;
+  float len = sqrtf( x*x + y*y + z*z );
+  float inv = ( len > 0.0f ) ? 1.0f/len : 0.0f;
+  x *= inv;
+  y *= inv;
+  z *= inv;
+  return;
+}
+
+bool generateTangents( group &g ) {
+
+  vertex_layout l = g.getLayout();
+  int64_t faces = g.getNumberOfFaces();
+  int64_t corners = g.getNumberOfCorners();
+  if ( !l.normals || !l.textures || !faces )
+    return false;
+
+  vector <uint64_t> faceFirst( faces+1, 0 );
+  for ( int64_t f=0; f<faces; f++ )
+    faceFirst[f+1] = faceFirst[f] + g.getFaceSize( f );
+
+  // Where every corner is, its normal and its texture coordinates
+  vector <float> px( corners ), py( corners ), pz( corners );
+  vector <float> nx( corners ), ny( corners ), nz( corners );
+  vector <float> s( corners ), t( corners );
+  uint tex = l.textureOffset();
+
+  #pragma omp parallel for schedule(static)
+  for ( int64_t c=0; c<corners; c++ ) {
+    const float *p = g.getCornerData( c );
+    px[c] = p[0];
+    py[c] = p[1];
+    pz[c] = p[2];
+    nx[c] = p[3];
+    ny[c] = p[4];
+    nz[c] = p[5];
+    s[c] = p[tex];
+    t[c] = p[tex+1];
+  }
+
+  // Each face's tangent, from its triangles (a quad's two, fanned out from
+  // its first corner), and whether its mapping keeps its winding
+  vector <float> fx( faces ), fy( faces ), fz( faces );
+  vector <uint8_t> faceFlip( faces );
+
+  #pragma omp parallel for schedule(static)
+  for ( int64_t f=0; f<faces; f++ ) {
+    uint64_t a = faceFirst[f];
+    uint n = faceFirst[f+1] - a;
+    float x = 0.0f, y = 0.0f, z = 0.0f, area = 0.0f;
+
+    for ( uint k=1; k+1<n; k++ ) {
+      uint64_t b = a+k, c = a+k+1;
+      float x1 = px[b] - px[a], y1 = py[b] - py[a], z1 = pz[b] - pz[a];
+      float x2 = px[c] - px[a], y2 = py[c] - py[a], z2 = pz[c] - pz[a];
+      float s1 = s[b] - s[a], t1 = t[b] - t[a];
+      float s2 = s[c] - s[a], t2 = t[c] - t[a];
+
+      // Twice the triangle's area in texture space, negative if it's mirrored
+      float st = s1*t2 - t1*s2;
+      float sign = ( st < 0.0f ) ? -1.0f : 1.0f;
+      x += sign * ( t2*x1 - t1*x2 );
+      y += sign * ( t2*y1 - t1*y2 );
+      z += sign * ( t2*z1 - t1*z2 );
+      area += st;
+    }
+
+    float len = sqrtf( x*x + y*y + z*z );
+    float inv = ( len > 0.0f && area != 0.0f ) ? 1.0f/len : 0.0f;
+    fx[f] = x * inv;
+    fy[f] = y * inv;
+    fz[f] = z * inv;
+    faceFlip[f] = area < 0.0f;
+  }
+
+  // What each corner adds to its vertex: its face's tangent in the plane of
+  // the corner's normal, scaled by the corner's angle in that plane
+  vector <float> wx( corners ), wy( corners ), wz( corners );
+  vector <uint8_t> flip( corners );
+
+  #pragma omp parallel for schedule(static)
+  for ( int64_t f=0; f<faces; f++ ) {
+    uint64_t first = faceFirst[f];
+    uint n = faceFirst[f+1] - first;
+
+    for ( uint k=0; k<n; k++ ) {
+      uint64_t c = first + k, next = first + (k+1) % n, prev = first + (k+n-1) % n;
+      flip[c] = faceFlip[f];
+
+      float x1 = px[next] - px[c], y1 = py[next] - py[c], z1 = pz[next] - pz[c];
+      float x2 = px[prev] - px[c], y2 = py[prev] - py[c], z2 = pz[prev] - pz[c];
+      project( x1, y1, z1, nx[c], ny[c], nz[c] );
+      project( x2, y2, z2, nx[c], ny[c], nz[c] );
+
+      float cosine = x1*x2 + y1*y2 + z1*z2;
+      float angle = acosf( cosine < -1.0f ? -1.0f : ( cosine > 1.0f ? 1.0f : cosine ) );
+
+      float x = fx[f], y = fy[f], z = fz[f];
+      project( x, y, z, nx[c], ny[c], nz[c] );
+      wx[c] = angle * x;
+      wy[c] = angle * y;
+      wz[c] = angle * z;
+    }
+  }
+
+  // Summed over the corners sharing each vertex
+  vector <uint32_t> set;
+  uint32_t sets = shareCorners( g, flip, set );
+
+  vector <float> sx( sets, 0.0f ), sy( sets, 0.0f ), sz( sets, 0.0f );
+  for ( int64_t c=0; c<corners; c++ ) {
+    sx[ set[c] ] += wx[c];
+    sy[ set[c] ] += wy[c];
+    sz[ set[c] ] += wz[c];
+  }
+
+  // Then each corner's tangent, square to its normal. With nothing to go
+  // on (no texture coordinates there, say) any direction across it will do
+  vector <float> tangents( 4*corners );
+
+  #pragma omp parallel for schedule(static)
+  for ( int64_t c=0; c<corners; c++ ) {
+    float x = sx[ set[c] ], y = sy[ set[c] ], z = sz[ set[c] ];
+    project( x, y, z, nx[c], ny[c], nz[c] );
+
+    if ( x == 0.0f && y == 0.0f && z == 0.0f ) {
+      bool alongX = fabsf( nx[c] ) > 0.9f;
+      x = alongX ? 0.0f : 1.0f;
+      y = alongX ? 1.0f : 0.0f;
+      z = 0.0f;
+      project( x, y, z, nx[c], ny[c], nz[c] );
+    }
+
+    tangents[4*c]   = x;
+    tangents[4*c+1] = y;
+    tangents[4*c+2] = z;
+    tangents[4*c+3] = flip[c] ? -1.0f : 1.0f;
+  }
+
+  g.setCornerTangents( tangents );
+  return true;
+}
+
+void generateTangents( object &o ) {
+  for ( uint j=0; j<o.getNumberOfGroups(); j++ )
+    generateTangents( *o.getGroup( j ) );
+  return;
+}
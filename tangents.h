@@ -0,0 +1,27 @@
+#ifndef __TANGENTS_H
+#define __TANGENTS_H 1
+
+#include <object.h>
+
+/*
+ *  tangents.h : Tangent frames for normal mapping. generateTangents()
+ *               works out a tangent for every corner of a group from its
+ *               positions, normals and texture coordinates, the way
+ *               MikkTSpace does: each face's tangent is the direction the
+ *               s coordinate grows in, a corner's is the sum of its
+ *               faces' (projected onto its normal, weighted by the
+ *               corner's angle) over the corners sharing its vertex on
+ *               faces mapped the same way round, and w is the sign of
+ *               the bitangent: bitangent = w * cross( normal, tangent ).
+ *               They go in the group's vertices as 4 more floats (see
+ *               vertex_layout), and so in getTangentArray(). Groups
+ *               without normals or texture coordinates are left alone
+ */
+
+// Returns false if the group had nothing to go on
+bool generateTangents( group &g );
+
+// Every group of the object
+void generateTangents( object &o );
+
+#endif
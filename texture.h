@@ -0,0 +1,206 @@
+#ifndef __TEXTURE_H
+#define __TEXTURE_H 1
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+
+#include <material.h>
+#include <mipmap.h>
+
+/*
+ *  texture.h : Loads the images behind a model's textures. Each file is
+ *              decoded once (however many materials use it, and whatever
+ *              path they use to get at it) on a small pool of threads,
+ *              so the decoding overlaps with reading the geometry. Each
+ *              image is decoded into its full mip chain (see mipmap.h),
+ *              which can be kept on disk for next time. The chains wait
+ *              until upload() is called on the thread that owns the GL
+ *              context, which makes one mipmapped texture per file
+ */
+
+class texture_manager {
+
+ public:
+
+  // threads = 0 for one decoding thread per core
+  texture_manager( unsigned int threads=0 ) {
+    maxThreads  = threads ? threads : std::thread::hardware_concurrency();
+    if ( !maxThreads )
+      maxThreads = 1;
+    outstanding = 0;
+    stopping    = false;
+    useDisk     = false;
+    return;
+  }
+
+  // Keep each image's mip chain on disk next to it (<image>.mips) and
+  // read that instead of the image while it's up to date
+  void setDiskCache( bool on ) {
+    std::lock_guard<std::mutex> hold( lock );
+    useDisk = on;
+    return;
+  }
+
+  // Anything not decoded yet is dropped
+  ~texture_manager() {
+    {
+      std::lock_guard<std::mutex> hold( lock );
+      stopping = true;
+      jobs.clear();
+    }
+    work.notify_all();
+    for ( uint i=0; i<workers.size(); i++ )
+      workers[i].join();
+    return;
+  }
+
+  // Start decoding a file (unless it's already been asked for)
+  void request( std::string file ) {
+
+    if ( file == "" )
+      return;
+
+    std::string path = canonical( file );
+
+    std::lock_guard<std::mutex> hold( lock );
+    if ( byPath.find( path ) != byPath.end() ) {
+      byPath.insert( std::make_pair( file, byPath[path] ) );
+      return;
+    }
+
+    images.push_back( image() );
+    images.back().file = file;
+    byPath.insert( std::make_pair( path, images.size()-1 ) );
+    byPath.insert( std::make_pair( file, images.size()-1 ) );
+
+    jobs.push_back( images.size()-1 );
+    outstanding++;
+
+    // Only start as many threads as there are images to decode
+    if ( workers.size() < maxThreads )
+      workers.push_back( std::thread( &texture_manager::decode, this ) );
+
+    work.notify_one();
+    return;
+  }
+
+  // Block until every requested image has been decoded
+  void wait( void ) {
+    std::unique_lock<std::mutex> hold( lock );
+    finished.wait( hold, [this]() { return outstanding == 0; } );
+    return;
+  }
+
+  // Wait for the decoding to finish, then make GL textures out of anything
+  // not uploaded yet and free the pixels. Needs a current GL context.
+  // Returns how many textures were made
+  uint upload( void ) {
+
+    std::unique_lock<std::mutex> hold( lock );
+    finished.wait( hold, [this]() { return outstanding == 0; } );
+
+    uint made = 0;
+    for ( uint i=0; i<images.size(); i++ ) {
+      image &img = images[i];
+      if ( img.uploaded )
+	continue;
+
+      img.uploaded = true;
+      if ( img.ok ) {
+	img.textureID = material::uploadImage( img.mips );
+	made++;
+      }
+      img.mips.clear();
+    }
+    return made;
+  }
+
+  // The GL texture made from a file (0 if it isn't loaded, or couldn't be)
+  uint getTextureID( std::string file ) {
+    std::lock_guard<std::mutex> hold( lock );
+    std::unordered_map<std::string, uint>::iterator it = byPath.find( file );
+    return ( it == byPath.end() ) ? 0 : images[it->second].textureID;
+  }
+
+  uint getNumberOfImages( void ) {
+    std::lock_guard<std::mutex> hold( lock );
+    return images.size();
+  }
+
+ protected:
+
+  struct image {
+    std::string file;
+    mip_chain   mips;
+    bool ok;
+    bool uploaded;
+    uint textureID;
+
+    image() : ok(false), uploaded(false), textureID(0) {}
+  };
+
+  // A deque, so the workers can fill in images while more are being added
+  std::deque <image>                     images;
+  std::unordered_map <std::string, uint> byPath;   // canonical path and name as given -> image
+  std::deque <uint>                      jobs;
+
+  std::vector <std::thread> workers;
+  unsigned int              maxThreads;
+  unsigned int              outstanding;
+  bool                      stopping;
+  bool                      useDisk;
+
+  std::mutex              lock;
+  std::condition_variable work;
+  std::condition_variable finished;
+
+  static std::string canonical( std::string file ) {
+    char *real = realpath( file.c_str(), 0x0 );
+    if ( !real )
+      return file;
+    std::string path( real );
+    free( real );
+    return path;
+  }
+
+  // Each worker takes jobs off the queue until told to stop
+  void decode( void ) {
+
+    std::unique_lock<std::mutex> hold( lock );
+    while ( true ) {
+      work.wait( hold, [this]() { return stopping || !jobs.empty(); } );
+      if ( stopping )
+	return;
+
+      uint i = jobs.front();
+      jobs.pop_front();
+      std::string file = images[i].file;
+      bool disk = useDisk;
+
+      hold.unlock();
+      mip_chain mips;
+      bool ok = material::decodeImage( file, mips, disk );
+      hold.lock();
+
+      image &img = images[i];
+      std::swap( img.mips, mips );
+      img.ok = ok;
+
+      if ( --outstanding == 0 )
+	finished.notify_all();
+    }
+  }
+
+ private:
+  texture_manager( const texture_manager & );
+  texture_manager & operator = ( const texture_manager & );
+
+};
+
+#endif
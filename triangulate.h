@@ -0,0 +1,126 @@
+#ifndef __TRIANGULATE_H
+#define __TRIANGULATE_H 1
+
+#include <vector>
+#include <cmath>
+
+#include <vertex.h>
+
+/*
+ *  triangulate.h : Split a polygon (given as its corner positions, in
+ *                  order) into triangles. Convex polygons are fanned out
+ *                  from the first corner, anything else is ear clipped in
+ *                  the plane the polygon (mostly) lies in. The triangles
+ *                  come back as corner numbers, three at a time, wound the
+ *                  same way as the polygon
+ */
+
+// Newell's method: a normal that behaves for non-planar and concave polygons
+inline vec polygonNormal( const vec *p, unsigned int n ) {
+  vec norm = {0.0f, 0.0f, 0.0f};
+
+  for ( unsigned int i=0, j=n-1; i<n; j=i++ ) {
+    norm.x += (p[j].y - p[i].y) * (p[j].z + p[i].z);
+    norm.y += (p[j].z - p[i].z) * (p[j].x + p[i].x);
+    norm.z += (p[j].x - p[i].x) * (p[j].y + p[i].y);
+  }
+  return norm;
+}
+
+// Twice the signed area of the 2D triangle (a,b,c)
+inline float cross2D( const float *a, const float *b, const float *c ) {
+  return (b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]);
+}
+
+inline bool insideTriangle2D( const float *p, const float *a, const float *b, const float *c ) {
+  return cross2D(a,b,p) >= 0.0f && cross2D(b,c,p) >= 0.0f && cross2D(c,a,p) >= 0.0f;
+}
+
+inline void triangulatePolygon( const vec *p, unsigned int n, std::vector<unsigned int> &tris ) {
+
+  tris.clear();
+  if ( n < 3 )
+    return;
+
+  vec norm = polygonNormal( p, n );
+
+  // Convex (every turn goes the same way as the polygon normal)? Then a fan will do
+  bool convex = true;
+  for ( unsigned int i=0; i<n && convex; i++ ) {
+    const vec &a = p[(i+n-1)%n], &b = p[i], &c = p[(i+1)%n];
+    vec turn = (b - a) * (c - b);
+    if ( turn.x*norm.x + turn.y*norm.y + turn.z*norm.z < 0.0f )
+      convex = false;
+  }
+
+  if ( convex ) {
+    for ( unsigned int i=1; i+1<n; i++ ) {
+      tris.push_back( 0 );
+      tris.push_back( i );
+      tris.push_back( i+1 );
+    }
+    return;
+  }
+
+  // Project onto the coordinate plane most nearly parallel to the polygon,
+  // flipping if needed so the polygon runs counter-clockwise in 2D
+  float ax = fabsf(norm.x), ay = fabsf(norm.y), az = fabsf(norm.z);
+  unsigned int u = 0, v = 1;
+  float sign = norm.z;
+  if ( ax >= ay && ax >= az ) {
+    u = 1; v = 2; sign = norm.x;
+  } else if ( ay >= az ) {
+    u = 2; v = 0; sign = norm.y;
+  }
+
+  std::vector<float> xy( 2*n );
+  for ( unsigned int i=0; i<n; i++ ) {
+    const float c[3] = { p[i].x, p[i].y, p[i].z };
+    xy[2*i]   = c[u];
+    xy[2*i+1] = ( sign < 0.0f ) ? -c[v] : c[v];
+  }
+
+  // Ear clipping over a list of the corners still left
+  std::vector<unsigned int> left( n );
+  for ( unsigned int i=0; i<n; i++ )
+    left[i] = i;
+
+  unsigned int i = 0, misses = 0;
+  while ( left.size() > 3 ) {
+    unsigned int m  = left.size();
+    unsigned int ia = left[(i+m-1)%m], ib = left[i%m], ic = left[(i+1)%m];
+    const float *a = &xy[2*ia], *b = &xy[2*ib], *c = &xy[2*ic];
+
+    bool ear = cross2D( a, b, c ) > 0.0f;
+    for ( unsigned int k=0; k<m && ear; k++ ) {
+      unsigned int ik = left[k];
+      if ( ik == ia || ik == ib || ik == ic )
+	continue;
+      if ( insideTriangle2D( &xy[2*ik], a, b, c ) )
+	ear = false;
+    }
+
+    // Went all the way round without an ear (degenerate or self
+    // intersecting polygon)... clip this one anyway so we finish
+    if ( ear || misses >= m ) {
+      tris.push_back( ia );
+      tris.push_back( ib );
+      tris.push_back( ic );
+      left.erase( left.begin() + (i%m) );
+      misses = 0;
+      if ( i >= left.size() )
+	i = 0;
+    } else {
+      i = (i+1) % m;
+      misses++;
+    }
+  }
+
+  tris.push_back( left[0] );
+  tris.push_back( left[1] );
+  tris.push_back( left[2] );
+
+  return;
+}
+
+#endif
@@ -129,27 +129,27 @@ class vertex {
   void setNormal( vec n ) {this->vnx=n;this->hasNorms=true;}
   void setTextureCoordinates( vec t ) {this->tex=t;this->hasTexCoords=true;}
 
-  uint getSize( void ) {
+  uint getSize( void ) const {
     return this->size;
   }
 
-  vec getVtx(void) {
+  vec getVtx(void) const {
     return this->vtx;
   }
 
-  vec getNorm(void) {
+  vec getNorm(void) const {
     return this->vnx;
   }
 
-  vec getTex(void) {
+  vec getTex(void) const {
     return this->tex;
   }
 
-  bool hasNormals(void) {
+  bool hasNormals(void) const {
     return this->hasNorms;
   }
 
-  bool hasTextureCoordinates(void) {
+  bool hasTextureCoordinates(void) const {
     return this->hasTexCoords;
   }
 
@@ -180,4 +180,38 @@ class vertex {
 
 };
 
+/*
+ *  struct vertex_layout: how a render group packs its vertices for GL.
+ *                        Every vertex is one run of floats (the stride):
+ *                        the position (3), then the normal (3, or left
+ *                        out), then the texture coordinates (2 or 3, or
+ *                        left out), then the tangent (4: the direction
+ *                        and the bitangent's sign, see tangents.h; only
+ *                        there once they've been worked out)
+ */
+
+struct vertex_layout {
+  uint normals;    // 0 or 3
+  uint textures;   // 0, 2 or 3
+  uint tangents;   // 0 or 4
+
+  vertex_layout( uint n=3, uint t=2, uint tn=0 ) {
+    normals  = ( n ) ? 3 : 0;
+    textures = ( t > 3 ) ? 3 : ( t == 1 ) ? 2 : t;
+    tangents = ( tn ) ? 4 : 0;
+  }
+
+  uint stride        ( void ) const { return 3 + normals + textures + tangents; }
+  uint normalOffset  ( void ) const { return 3; }
+  uint textureOffset ( void ) const { return 3 + normals; }
+  uint tangentOffset ( void ) const { return 3 + normals + textures; }
+
+  bool operator == ( const vertex_layout &l ) const {
+    return normals == l.normals && textures == l.textures && tangents == l.tangents;
+  }
+  bool operator != ( const vertex_layout &l ) const {
+    return !( *this == l );
+  }
+};
+
 #endif